@@ -0,0 +1,648 @@
+#include "stdafx.h"
+#include "AM3Coder.h"
+
+#include "Container.h"
+#include "HuffmanCoder.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+//========================================================================
+// Limits of the frame size, which the FFT needs to be a power of two.
+static const size_t kMIN_FRAME_SIZE = 64;
+static const size_t kMAX_FRAME_SIZE = 8192;
+
+//========================================================================
+// Frames transformed or inverted at a time, bounding the memory held
+// for coefficients however long the audio is.
+static const size_t kFRAMES_PER_BATCH = 64;
+
+//========================================================================
+// A band's energy is sent as the RMS of its coefficients in 3 dB
+// steps, offset to fit a byte. Bands quieter than the lowest step are
+// silent and send no coefficients.
+static const int kENERGY_OFFSET = 128;
+static const int kMIN_ENERGY    = 1 - kENERGY_OFFSET;
+static const int kMAX_ENERGY    = 255 - kENERGY_OFFSET;
+
+//========================================================================
+// Quantization step of the loudest band at a compression factor of 1,
+// relative to its RMS, and how much coarser the step grows towards
+// the top of the spectrum.
+static const double kSTEP_SCALE = 0.08;
+static const double kSTEP_TILT  = 3.0;
+
+//========================================================================
+// Coefficients are rounded down unless at least this far past a step,
+// which widens the zero bin a little.
+static const double kROUNDING = 0.4;
+
+//========================================================================
+// Values sent in the value stream as a signed byte. Larger ones, which
+// only low compression factors give, are sent as this escape, with
+// ( |value| - kESCAPE_MIN ) * 2 + sign as a varint in the escape
+// stream.
+static const int   kMAX_VALUE  = 127;
+static const UByte kESCAPE     = 0x80;
+static const int   kESCAPE_MIN = kMAX_VALUE + 1;
+
+//========================================================================
+// Largest escaped value. Within [-1, 1] no sample comes near it; only
+// float samples far outside do.
+static const double kMAX_ESCAPED = 4294967295.0;
+
+//========================================================================
+// The factor is stored in thousandths, so smaller ones cannot be.
+static const double kMIN_COMPRESSION_FACTOR = 0.001;
+
+//========================================================================
+// Band edges for a frame: bands of four coefficients at the bottom,
+// each band above 32 an eighth wider than where it starts.
+static std::vector<size_t> bandEdges( size_t frame_size )
+{
+    std::vector<size_t> edges;
+
+    size_t edge = 0;
+    while( edge < frame_size )
+    {
+        edges.push_back( edge );
+        edge = std::min( frame_size, edge + std::max<size_t>( 4, ( edge / 8 ) & ~static_cast<size_t>( 3 ) ) );
+    }
+    edges.push_back( frame_size );
+
+    return edges;
+}
+
+//========================================================================
+// The quantization step of every band, from the frame's sent energies.
+static void bandSteps( const std::vector<size_t>& bands,
+                       double compression_factor,
+                       const UByte* energies,
+                       std::vector<double>& steps )
+{
+    const size_t num_bands  = bands.size() - 1;
+    const size_t frame_size = bands.back();
+
+    std::vector<double> rms( num_bands, 0.0 );
+
+    double loudest = 0.0;
+    for( size_t b = 0; b < num_bands; ++b )
+    {
+        if( energies[b] != 0 ) rms[b] = std::exp2( 0.5 * ( static_cast<int>( energies[b] ) - kENERGY_OFFSET ) );
+        loudest = std::max( loudest, rms[b] );
+    }
+
+    // Between the band's own energy, which alone would give every band
+    // the same signal to noise ratio, and the loudest band's, which
+    // masks the quieter ones.
+    steps.resize( num_bands );
+    for( size_t b = 0; b < num_bands; ++b )
+    {
+        const double tilt = 1.0 + kSTEP_TILT * bands[b] / frame_size;
+
+        steps[b] = compression_factor * kSTEP_SCALE * std::sqrt( rms[b] * loudest ) * tilt;
+    }
+}
+
+//========================================================================
+// Sample of a channel scaled to [-1, 1). Float samples are taken as
+// they are.
+static inline double unitSample( const WavData& data, size_t channel, size_t frame )
+{
+    switch( data.sample_type_ )
+    {
+    case WavSampleType::INT16: return std::ldexp( data.int16_channels_[channel][frame], 1 - data.bits_per_sample_ );
+    case WavSampleType::INT32: return std::ldexp( data.int32_channels_[channel][frame], 1 - data.bits_per_sample_ );
+    default:                   return data.float_channels_[channel][frame];
+    }
+}
+
+//========================================================================
+// Inverse of unitSample(), clamping to the range of the sample type.
+static inline void storeUnitSample( WavData& data, size_t channel, size_t frame, double value )
+{
+    if( data.sample_type_ == WavSampleType::FLOAT32 )
+    {
+        data.float_channels_[channel][frame] = static_cast<float>( value );
+        return;
+    }
+
+    const double  scaled    = std::ldexp( value, data.bits_per_sample_ - 1 );
+    const int64_t max_value = ( static_cast<int64_t>( 1 ) << ( data.bits_per_sample_ - 1 ) ) - 1;
+    const int64_t sample    = std::max<int64_t>( -max_value - 1, std::min<int64_t>( max_value, std::llround( scaled ) ) );
+
+    if( data.sample_type_ == WavSampleType::INT16 )
+    {
+        data.int16_channels_[channel][frame] = static_cast<int16_t>( sample );
+    }
+    else
+    {
+        data.int32_channels_[channel][frame] = static_cast<int32_t>( sample );
+    }
+}
+
+//========================================================================
+// Whether the coder handles the data's sample type at its bit depth.
+static bool supportedFormat( WavSampleType type, uint16_t bits_per_sample )
+{
+    switch( type )
+    {
+    case WavSampleType::INT16:   return bits_per_sample == 8 || bits_per_sample == 16;
+    case WavSampleType::INT32:   return bits_per_sample == 24 || bits_per_sample == 32;
+    case WavSampleType::FLOAT32: return bits_per_sample == 32 || bits_per_sample == 64;
+    default:                     return false;
+    }
+}
+
+//========================================================================
+//
+AM3Coder::AM3Coder( double compression_factor, size_t frame_size )
+    : compression_factor_( compression_factor )
+    , frame_size_( kMIN_FRAME_SIZE )
+{
+    while( frame_size_ * 2 <= std::min( frame_size, kMAX_FRAME_SIZE ) ) frame_size_ *= 2;
+}
+
+//========================================================================
+//
+AM3Coder::~AM3Coder()
+{
+
+}
+
+//========================================================================
+//
+MsgNum AM3Coder::encode( const WavData& inData,
+                         std::vector<UByte>& outData )
+{
+    outData.clear();
+
+    MemorySink sink( outData );
+
+    return encode( inData, sink );
+}
+
+//========================================================================
+//
+MsgNum AM3Coder::encode( const WavData& inData,
+                         OutputSink& sink )
+{
+    if( !supportedFormat( inData.sample_type_, inData.bits_per_sample_ ) ) return printMsg( BAD_WAV_BIT_DEPTH );
+    if( inData.num_channels_ == 0 || !( compression_factor_ >= kMIN_COMPRESSION_FACTOR ) ) return printMsg( BAD_DATA );
+
+    const size_t N            = frame_size_;
+    const size_t num_channels = inData.num_channels_;
+    const size_t num_frames   = inData.num_frames_;
+    const bool   mid_side     = num_channels == 2;
+
+    for( size_t c = 0; c < num_channels; ++c )
+    {
+        size_t available = 0;
+
+        switch( inData.sample_type_ )
+        {
+        case WavSampleType::INT16: available = c < inData.int16_channels_.size() ? inData.int16_channels_[c].size() : 0; break;
+        case WavSampleType::INT32: available = c < inData.int32_channels_.size() ? inData.int32_channels_[c].size() : 0; break;
+        default:                   available = c < inData.float_channels_.size() ? inData.float_channels_[c].size() : 0; break;
+        }
+
+        if( available < num_frames ) return printMsg( BAD_DATA );
+    }
+
+    // MDCT frame t covers samples [( t - 1 ) * N, ( t + 1 ) * N), so
+    // every sample is covered by two frames.
+    const size_t num_blocks = num_frames == 0 ? 0 : ( num_frames + N - 1 ) / N + 1;
+
+    const MDCT                mdct( N );
+    const std::vector<size_t> bands = bandEdges( N );
+
+    FrameStreams streams;
+
+    for( size_t first = 0; first < num_blocks; first += kFRAMES_PER_BATCH )
+    {
+        const size_t count = std::min( kFRAMES_PER_BATCH, num_blocks - first );
+
+        std::vector<FrameStreams> batch( count * num_channels );
+
+        ThreadPool::shared().parallelFor( count, [&]( size_t i )
+        {
+            const size_t t     = first + i;
+            const size_t start = t * N;
+
+            std::vector<double> window( 2 * N );
+            std::vector<double> coefs( N );
+
+            for( size_t c = 0; c < num_channels; ++c )
+            {
+                // Samples before the start and past the end are zero.
+                for( size_t n = 0; n < 2 * N; ++n )
+                {
+                    const size_t f = start + n;
+                    if( f < N || f - N >= num_frames )
+                    {
+                        window[n] = 0.0;
+                        continue;
+                    }
+
+                    if( mid_side )
+                    {
+                        const double left  = unitSample( inData, 0, f - N );
+                        const double right = unitSample( inData, 1, f - N );
+
+                        window[n] = c == 0 ? 0.5 * ( left + right ) : 0.5 * ( left - right );
+                    }
+                    else
+                    {
+                        window[n] = unitSample( inData, c, f - N );
+                    }
+                }
+
+                mdct.transform( window.data(), coefs.data() );
+                quantizeFrame( bands, compression_factor_, coefs.data(), batch[i * num_channels + c] );
+            }
+        } );
+
+        for( const auto& frame : batch )
+        {
+            streams.energies_.insert( streams.energies_.end(), frame.energies_.begin(), frame.energies_.end() );
+            streams.runs_.insert( streams.runs_.end(), frame.runs_.begin(), frame.runs_.end() );
+            streams.values_.insert( streams.values_.end(), frame.values_.begin(), frame.values_.end() );
+            streams.escapes_.insert( streams.escapes_.end(), frame.escapes_.begin(), frame.escapes_.end() );
+        }
+    }
+
+    // Huffman code the four streams side by side.
+    const std::vector<UByte>* raw[4] = { &streams.energies_, &streams.runs_, &streams.values_, &streams.escapes_ };
+
+    std::vector<UByte> segments[4];
+    MsgNum             results[4] = { STATUS_OKAY, STATUS_OKAY, STATUS_OKAY, STATUS_OKAY };
+
+    ThreadPool::shared().parallelFor( 4, [&]( size_t s )
+    {
+        HuffmanCoder huffCoder;
+        results[s] = huffCoder.encodeSegment( *raw[s], segments[s] );
+    } );
+
+    for( auto result : results )
+    {
+        if( result ) return result;
+    }
+
+    // 29 bytes : Magic, format, frame size and compression factor.
+    std::vector<UByte> table = { 'A', 'M', '3', '1' };
+
+    util::appendBigEndian( table, inData.audio_format_, 2 );
+    util::appendBigEndian( table, inData.num_channels_, 2 );
+    util::appendBigEndian( table, inData.sample_rate_, 4 );
+    util::appendBigEndian( table, inData.bits_per_sample_, 2 );
+    table.push_back( static_cast<UByte>( inData.sample_type_ ) );
+    util::appendBigEndian( table, num_frames, 8 );
+    util::appendBigEndian( table, N, 2 );
+    util::appendBigEndian( table, static_cast<uint32_t>( std::lround( compression_factor_ * 1000 ) ), 4 );
+
+    sink.reserve( static_cast<size_t>( ChunkWriter::containerSize( table.size() + segments[0].size() + segments[1].size() + segments[2].size() + segments[3].size(), 5 ) ) );
+
+    ChunkWriter writer( sink, ContainerFormat::AM3 );
+    writer.writeChunk( kCHUNK_TABL, table.data(), table.size() );
+
+    for( const auto& segment : segments )
+    {
+        writer.writeChunk( kCHUNK_DATA, segment.data(), segment.size() );
+    }
+
+    return writer.finish();
+}
+
+//========================================================================
+//
+void AM3Coder::quantizeFrame( const std::vector<size_t>& bands,
+                              double compression_factor,
+                              const double* coefs,
+                              FrameStreams& streams )
+{
+    const size_t num_bands = bands.size() - 1;
+
+    // Band energies, sent as differences from the band below.
+    std::vector<UByte> energies( num_bands );
+
+    UByte previous = 0;
+    for( size_t b = 0; b < num_bands; ++b )
+    {
+        double sum = 0.0;
+        for( size_t k = bands[b]; k < bands[b + 1]; ++k )
+        {
+            sum += coefs[k] * coefs[k];
+        }
+
+        const double rms    = std::sqrt( sum / ( bands[b + 1] - bands[b] ) );
+        const int    energy = rms > 0.0 ? static_cast<int>( std::ceil( 2.0 * std::log2( rms ) ) ) : kMIN_ENERGY - 1;
+
+        energies[b] = energy < kMIN_ENERGY ? 0 : static_cast<UByte>( std::min( energy, kMAX_ENERGY ) + kENERGY_OFFSET );
+
+        streams.energies_.push_back( static_cast<UByte>( energies[b] - previous ) );
+        previous = energies[b];
+    }
+
+    std::vector<double> steps;
+    bandSteps( bands, compression_factor, energies.data(), steps );
+
+    // Coefficients of the bands that are not silent, as pairs of the
+    // number of zeros skipped and the next non-zero value. A pair with
+    // a zero value only skips, and ( 0, 0 ) ends the frame.
+    size_t run = 0;
+
+    for( size_t b = 0; b < num_bands; ++b )
+    {
+        if( energies[b] == 0 ) continue;
+
+        for( size_t k = bands[b]; k < bands[b + 1]; ++k )
+        {
+            const double  scaled = std::fabs( coefs[k] ) / steps[b];
+            const int64_t value  = static_cast<int64_t>( std::min( scaled + 1.0 - kROUNDING, kMAX_ESCAPED ) );
+
+            if( value == 0 )
+            {
+                ++run;
+                continue;
+            }
+
+            while( run >= 255 )
+            {
+                streams.runs_.push_back( 255 );
+                streams.values_.push_back( 0 );
+                run -= 255;
+            }
+
+            streams.runs_.push_back( static_cast<UByte>( run ) );
+
+            if( value > kMAX_VALUE )
+            {
+                streams.values_.push_back( kESCAPE );
+                util::appendVarint( streams.escapes_, static_cast<uint64_t>( value - kESCAPE_MIN ) * 2 + ( coefs[k] < 0 ? 1 : 0 ) );
+            }
+            else
+            {
+                streams.values_.push_back( static_cast<UByte>( coefs[k] < 0 ? -value : value ) );
+            }
+            run = 0;
+        }
+    }
+
+    streams.runs_.push_back( 0 );
+    streams.values_.push_back( 0 );
+}
+
+//========================================================================
+//
+MsgNum AM3Coder::decode( const std::vector<UByte>& inData,
+                         WavData& outData )
+{
+    return decode( inData.data(), inData.size(), outData );
+}
+
+//========================================================================
+//
+MsgNum AM3Coder::decode( const UByte* inData,
+                         size_t size,
+                         WavData& outData )
+{
+    std::vector<ChunkSpan> chunks;
+
+    MsgNum err = ChunkReader::verify( inData, size, ContainerFormat::AM3, chunks );
+    if( err ) return err;
+
+    const UByte* table      = chunks[0].data_;
+    const size_t table_size = chunks[0].size_;
+
+    // Files from before the escape stream have only three data chunks.
+    if( ( chunks.size() != 4 && chunks.size() != 5 ) || table_size < 29 || table[0] != 'A' || table[1] != 'M' || table[2] != '3' || table[3] != '1' )
+    {
+        return printMsg( BAD_DATA );
+    }
+
+    size_t pos = 4;
+
+    WavData data;
+    data.audio_format_    = static_cast<uint16_t>( util::readBigEndian( table, pos, 2 ) );
+    data.num_channels_    = static_cast<uint16_t>( util::readBigEndian( table, pos, 2 ) );
+    data.sample_rate_     = static_cast<uint32_t>( util::readBigEndian( table, pos, 4 ) );
+    data.bits_per_sample_ = static_cast<uint16_t>( util::readBigEndian( table, pos, 2 ) );
+
+    const UByte    sample_type        = table[pos++];
+    const uint64_t num_frames         = util::readBigEndian( table, pos, 8 );
+    const size_t   N                  = static_cast<size_t>( util::readBigEndian( table, pos, 2 ) );
+    const double   compression_factor = util::readBigEndian( table, pos, 4 ) / 1000.0;
+
+    if( sample_type > static_cast<UByte>( WavSampleType::FLOAT32 ) ) return printMsg( BAD_DATA );
+
+    data.sample_type_ = static_cast<WavSampleType>( sample_type );
+
+    if( !supportedFormat( data.sample_type_, data.bits_per_sample_ ) || data.num_channels_ == 0 ||
+        N < kMIN_FRAME_SIZE || N > kMAX_FRAME_SIZE || ( N & ( N - 1 ) ) != 0 || !( compression_factor >= kMIN_COMPRESSION_FACTOR ) )
+    {
+        return printMsg( BAD_DATA );
+    }
+
+    const size_t num_channels = data.num_channels_;
+    const bool   mid_side     = num_channels == 2;
+    const size_t num_blocks   = num_frames == 0 ? 0 : static_cast<size_t>( ( num_frames + N - 1 ) / N + 1 );
+
+    const MDCT                mdct( N );
+    const std::vector<size_t> bands     = bandEdges( N );
+    const size_t              num_bands = bands.size() - 1;
+
+    // Every frame sends an energy per band, and at most one pair per
+    // coefficient, one per 255 zeros and one to end it. An escaped
+    // value takes at most 10 bytes.
+    FrameStreams streams;
+
+    const size_t num_streams = chunks.size() - 1;
+
+    std::vector<UByte>* raw[4]      = { &streams.energies_, &streams.runs_, &streams.values_, &streams.escapes_ };
+    const size_t        max_size[4] = { num_blocks * num_channels * num_bands,
+                                        num_blocks * num_channels * ( N + N / 255 + 1 ),
+                                        num_blocks * num_channels * ( N + N / 255 + 1 ),
+                                        num_blocks * num_channels * N * 10 };
+    MsgNum              results[4]  = { STATUS_OKAY, STATUS_OKAY, STATUS_OKAY, STATUS_OKAY };
+
+    ThreadPool::shared().parallelFor( num_streams, [&]( size_t s )
+    {
+        HuffmanCoder huffCoder;
+        results[s] = huffCoder.decodeSegment( chunks[s + 1].data_, chunks[s + 1].size_, max_size[s], *raw[s] );
+    } );
+
+    for( auto result : results )
+    {
+        if( result ) return result;
+    }
+
+    if( streams.energies_.size() != max_size[0] || streams.runs_.size() != streams.values_.size() ) return printMsg( BAD_DATA );
+
+    // The fields a .wav header would hold.
+    data.num_frames_      = static_cast<size_t>( num_frames );
+    data.block_align_     = static_cast<uint32_t>( num_channels * ( data.bits_per_sample_ / 8 ) );
+    data.byte_rate_       = data.sample_rate_ * data.block_align_;
+    data.sub_chunk1_size_ = 16;
+    data.sub_chunk2_size_ = static_cast<uint32_t>( num_frames * data.block_align_ );
+    data.chunk_size_      = 36 + data.sub_chunk2_size_;
+
+    switch( data.sample_type_ )
+    {
+    case WavSampleType::INT16:   data.int16_channels_.assign( num_channels, std::vector<int16_t>( data.num_frames_ ) ); break;
+    case WavSampleType::INT32:   data.int32_channels_.assign( num_channels, std::vector<int32_t>( data.num_frames_ ) ); break;
+    case WavSampleType::FLOAT32: data.float_channels_.assign( num_channels, std::vector<float>( data.num_frames_ ) ); break;
+    }
+
+    // The second half of the previous frame's output, waiting for the
+    // first half of the next.
+    std::vector<std::vector<double>> tails( num_channels, std::vector<double>( N, 0.0 ) );
+
+    size_t energy_pos = 0;
+    size_t value_pos  = 0;
+    size_t escape_pos = 0;
+
+    for( size_t first = 0; first < num_blocks; first += kFRAMES_PER_BATCH )
+    {
+        const size_t count = std::min( kFRAMES_PER_BATCH, num_blocks - first );
+
+        // The streams are read in order, then the frames inverted side
+        // by side.
+        std::vector<double> coefs( count * num_channels * N );
+
+        for( size_t f = 0; f < count * num_channels; ++f )
+        {
+            err = dequantizeFrame( bands, compression_factor, streams, energy_pos, value_pos, escape_pos, &coefs[f * N] );
+            if( err ) return printMsg( err );
+        }
+
+        std::vector<double> output( count * num_channels * 2 * N );
+
+        ThreadPool::shared().parallelFor( count * num_channels, [&]( size_t f )
+        {
+            mdct.inverse_transform( &coefs[f * N], &output[f * 2 * N] );
+        } );
+
+        // Overlap-add, completing samples [( t - 1 ) * N, t * N).
+        for( size_t i = 0; i < count; ++i )
+        {
+            const size_t t = first + i;
+
+            for( size_t n = 0; n < N; ++n )
+            {
+                double values[2] = { 0.0, 0.0 };
+
+                for( size_t c = 0; c < num_channels; ++c )
+                {
+                    const double* frame = &output[( i * num_channels + c ) * 2 * N];
+
+                    const double value = tails[c][n] + frame[n];
+                    tails[c][n] = frame[N + n];
+
+                    if( t == 0 || ( t - 1 ) * N + n >= data.num_frames_ ) continue;
+
+                    if( mid_side )
+                    {
+                        values[c] = value;
+                    }
+                    else
+                    {
+                        storeUnitSample( data, c, ( t - 1 ) * N + n, value );
+                    }
+                }
+
+                if( mid_side && t > 0 && ( t - 1 ) * N + n < data.num_frames_ )
+                {
+                    storeUnitSample( data, 0, ( t - 1 ) * N + n, values[0] + values[1] );
+                    storeUnitSample( data, 1, ( t - 1 ) * N + n, values[0] - values[1] );
+                }
+            }
+        }
+    }
+
+    if( value_pos != streams.values_.size() || escape_pos != streams.escapes_.size() ) return printMsg( BAD_DATA );
+
+    outData = std::move( data );
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum AM3Coder::dequantizeFrame( const std::vector<size_t>& bands,
+                                  double compression_factor,
+                                  const FrameStreams& streams,
+                                  size_t& energy_pos,
+                                  size_t& value_pos,
+                                  size_t& escape_pos,
+                                  double* coefs )
+{
+    const size_t num_bands = bands.size() - 1;
+
+    if( streams.energies_.size() - energy_pos < num_bands ) return BAD_DATA;
+
+    std::vector<UByte> energies( num_bands );
+
+    UByte previous = 0;
+    for( size_t b = 0; b < num_bands; ++b )
+    {
+        energies[b] = static_cast<UByte>( previous + streams.energies_[energy_pos++] );
+        previous    = energies[b];
+    }
+
+    std::vector<double> steps;
+    bandSteps( bands, compression_factor, energies.data(), steps );
+
+    std::fill( coefs, coefs + bands.back(), 0.0 );
+
+    // The coefficients of the bands that are not silent, in order.
+    std::vector<size_t> active;
+    std::vector<double> active_steps;
+
+    for( size_t b = 0; b < num_bands; ++b )
+    {
+        if( energies[b] == 0 ) continue;
+
+        for( size_t k = bands[b]; k < bands[b + 1]; ++k )
+        {
+            active.push_back( k );
+            active_steps.push_back( steps[b] );
+        }
+    }
+
+    size_t p = 0;
+
+    for( ;; )
+    {
+        if( value_pos >= streams.values_.size() ) return BAD_DATA;
+
+        const size_t run   = streams.runs_[value_pos];
+        int64_t      value = static_cast<signed char>( streams.values_[value_pos] );
+
+        if( streams.values_[value_pos] == kESCAPE )
+        {
+            const UByte* escape     = streams.escapes_.data() + escape_pos;
+            const UByte* escape_end = streams.escapes_.data() + streams.escapes_.size();
+
+            uint64_t coded = 0;
+            if( !util::readVarint( escape, escape_end, coded ) || coded > 2 * static_cast<uint64_t>( kMAX_ESCAPED ) + 1 ) return BAD_DATA;
+
+            escape_pos = escape - streams.escapes_.data();
+            value      = static_cast<int64_t>( coded / 2 ) + kESCAPE_MIN;
+            if( coded & 0x1 ) value = -value;
+        }
+
+        ++value_pos;
+
+        if( value == 0 && run == 0 ) return STATUS_OKAY;
+
+        p += run;
+        if( p > active.size() || ( value != 0 && p == active.size() ) ) return BAD_DATA;
+
+        if( value != 0 )
+        {
+            coefs[active[p]] = static_cast<double>( value ) * active_steps[p];
+            ++p;
+        }
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "Util.h"
+#include "Errors.h"
+#include "MDCT.h"
+#include "OutputSink.h"
+#include "WavDecoder.h"
+
+#include <vector>
+
+//--------------------------------------------------------------
+// Lossy audio coder, the counterpart of AU3Coder as IM3Coder is of
+// IN3Coder. Each channel is cut into frames of frame_size samples
+// that overlap by half and are taken through the MDCT. Stereo audio is
+// coded as mid and side.
+//
+// The coefficients of a frame are grouped into bands that widen with
+// frequency. Each band's energy is sent in 3 dB steps, and its
+// coefficients are quantized with a step that grows with the band's
+// energy, with the loudest band of the frame (quiet bands next to loud
+// ones go to zero), with frequency and with compression_factor, which
+// plays the part of IM3Coder's. The quantized coefficients are run
+// length coded as IM3Coder codes its blocks, as pairs of a zero run
+// and the next value. Values beyond a signed byte, which only low
+// compression factors give, are escaped and sent in a stream of their
+// own. The band energies, runs, values and escapes are then Huffman
+// coded as four segments. The compression factor must be at least
+// 0.001, the precision it is stored to.
+//
+// Format: the chunked container, with the table chunk holding
+//   | A M 3 1 | audio format 2 | channels 2 | sample rate 4 |
+//   bits per sample 2 | sample type 1 | frames 8 | frame size 2 |
+//   compression factor x 1000 4 |
+// and four data chunks: the band energies, the runs, the values and
+// the escaped values. Files without the escape chunk are read too.
+class AM3Coder
+{
+public:
+
+    //--------------------------------------------------------------
+    // frame_size is rounded down to a power of two between 64 and
+    // 8192.
+    AM3Coder( double compression_factor,
+              size_t frame_size = 1024 );
+
+    //--------------------------------------------------------------
+    //
+    ~AM3Coder();
+
+    //--------------------------------------------------------------
+    //
+    MsgNum encode( const WavData& inData,
+                   std::vector<UByte>& outData );
+
+    //--------------------------------------------------------------
+    // As above, writing the .am3 file to a sink.
+    MsgNum encode( const WavData& inData,
+                   OutputSink& sink );
+
+    //--------------------------------------------------------------
+    // Decodes to the sample type and bit depth of the original.
+    MsgNum decode( const std::vector<UByte>& inData,
+                   WavData& outData );
+
+    //--------------------------------------------------------------
+    // As above, reading the data in place, e.g. from a FileSource.
+    MsgNum decode( const UByte* inData,
+                   size_t size,
+                   WavData& outData );
+
+private:
+
+    //--------------------------------------------------------------
+    // The coded streams of one frame of one channel.
+    struct FrameStreams
+    {
+        std::vector<UByte> energies_;
+        std::vector<UByte> runs_;
+        std::vector<UByte> values_;
+        std::vector<UByte> escapes_;
+    };
+
+    //--------------------------------------------------------------
+    // Quantizes the coefficients of one frame and appends them to
+    // the streams.
+    static void quantizeFrame( const std::vector<size_t>& bands,
+                               double compression_factor,
+                               const double* coefs,
+                               FrameStreams& streams );
+
+    //--------------------------------------------------------------
+    // Inverse of quantizeFrame(), reading from the streams at the
+    // given positions and moving them past the frame.
+    static MsgNum dequantizeFrame( const std::vector<size_t>& bands,
+                                   double compression_factor,
+                                   const FrameStreams& streams,
+                                   size_t& energy_pos,
+                                   size_t& value_pos,
+                                   size_t& escape_pos,
+                                   double* coefs );
+
+    double compression_factor_;
+    size_t frame_size_;
+};
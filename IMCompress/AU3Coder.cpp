@@ -0,0 +1,1262 @@
+#include "stdafx.h"
+#include "AU3Coder.h"
+
+#include "Container.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//========================================================================
+// A Rice quotient this large is written as this many zero bits, with
+// no terminating one, followed by the whole value in 64 bits.
+static const Uint kRICE_ESCAPE = 32;
+
+//========================================================================
+// Limits of the block format, set by the widths of its fields.
+static const Uint   kMAX_FIXED_ORDER     = 4;
+static const Uint   kMAX_LPC_ORDER       = 32;
+static const Uint   kMAX_PARTITION_ORDER = 8;
+static const Uint   kMAX_RICE_PARAMETER  = 30;
+static const Uint   kMAX_LPC_SHIFT       = 15;
+static const size_t kMAX_BLOCK_SIZE      = 65535;
+
+//========================================================================
+// Blocks read and encoded at a time by the streaming encode.
+static const size_t kBLOCKS_PER_WINDOW = 64;
+
+//========================================================================
+// Bits in a quantized LPC coefficient, sign included.
+static const Uint kLPC_PRECISION = 14;
+
+//========================================================================
+// Maps residuals to unsigned values, small magnitudes first:
+// 0, -1, 1, -2, 2 ... become 0, 1, 2, 3, 4 ...
+static inline uint64_t zigzag( int64_t value )
+{
+    return ( static_cast<uint64_t>( value ) << 1 ) ^ static_cast<uint64_t>( value >> 63 );
+}
+
+static inline int64_t unzigzag( uint64_t value )
+{
+    return static_cast<int64_t>( ( value >> 1 ) ^ ( 0 - ( value & 1 ) ) );
+}
+
+//========================================================================
+// Writes the low width bits of value, up to 64.
+static void writeSigned( BitWriter& writer, int64_t value, Uint width )
+{
+    const uint64_t bits = static_cast<uint64_t>( value );
+
+    if( width > 32 )
+    {
+        writer.write_bits( static_cast<uint32_t>( bits >> 32 ), width - 32 );
+        width = 32;
+    }
+
+    writer.write_bits( static_cast<uint32_t>( bits ), width );
+}
+
+//========================================================================
+// Inverse of writeSigned(), sign extending the value.
+static int64_t readSigned( AU3BitReader& reader, Uint width )
+{
+    uint64_t bits = 0;
+
+    if( width > 32 )
+    {
+        bits = static_cast<uint64_t>( reader.readBits( width - 32 ) ) << 32;
+        bits |= reader.readBits( 32 );
+    }
+    else
+    {
+        bits = reader.readBits( width );
+    }
+
+    const Uint shift = 64 - width;
+    return static_cast<int64_t>( bits << shift ) >> shift;
+}
+
+//========================================================================
+// Whether every sample fits in width bits.
+static bool fitsWidth( const int64_t* samples, size_t count, Uint width )
+{
+    const int64_t max_value = ( static_cast<int64_t>( 1 ) << ( width - 1 ) ) - 1;
+    const int64_t min_value = -max_value - 1;
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        if( samples[i] < min_value || samples[i] > max_value ) return false;
+    }
+
+    return true;
+}
+
+//========================================================================
+// Rice codes value with parameter k: the quotient in unary as zeros
+// ended by a one, then the low k bits.
+static inline void writeRice( BitWriter& writer, uint64_t value, Uint k )
+{
+    const uint64_t quotient = value >> k;
+
+    if( quotient >= kRICE_ESCAPE )
+    {
+        writer.write_bits( 0, kRICE_ESCAPE );
+        writer.write_bits( static_cast<uint32_t>( value >> 32 ), 32 );
+        writer.write_bits( static_cast<uint32_t>( value ), 32 );
+        return;
+    }
+
+    const Uint     length = static_cast<Uint>( quotient ) + 1 + k;
+    const uint64_t code   = ( static_cast<uint64_t>( 1 ) << k ) | ( value & ( ( static_cast<uint64_t>( 1 ) << k ) - 1 ) );
+
+    if( length <= 32 )
+    {
+        writer.write_bits( static_cast<uint32_t>( code ), length );
+    }
+    else
+    {
+        writer.write_bits( 1, static_cast<Uint>( quotient ) + 1 );
+        writer.write_bits( static_cast<uint32_t>( value ), k );
+    }
+}
+
+//========================================================================
+//
+static inline uint64_t readRice( AU3BitReader& reader, Uint k )
+{
+    const Uint quotient = reader.readUnary( kRICE_ESCAPE );
+
+    if( quotient == kRICE_ESCAPE )
+    {
+        const uint64_t high = reader.readBits( 32 );
+        return ( high << 32 ) | reader.readBits( 32 );
+    }
+
+    return ( static_cast<uint64_t>( quotient ) << k ) | reader.readBits( k );
+}
+
+//========================================================================
+// The residuals of a subframe, split into 2^order_ partitions, each
+// with its own Rice parameter. Partitions hold count >> order_
+// samples, the last one taking the remainder, and the first one
+// starts after the warm up samples.
+struct RicePartitions
+{
+    Uint              order_ = 0;
+    std::vector<Uint> params_;
+    uint64_t          bits_  = 0;
+};
+
+//========================================================================
+// Start of partition j at the given order.
+static inline size_t partitionStart( size_t j, size_t count, Uint order, size_t warmup )
+{
+    return j == 0 ? warmup : j * ( count >> order );
+}
+
+static inline size_t partitionEnd( size_t j, size_t count, Uint order )
+{
+    return j + 1 == ( static_cast<size_t>( 1 ) << order ) ? count : ( j + 1 ) * ( count >> order );
+}
+
+//========================================================================
+// Picks the partition order and Rice parameters that code the zigzag
+// mapped residuals [warmup, count) in the fewest bits, estimating the
+// cost of each parameter from the partition's sum.
+static RicePartitions chooseRice( const uint64_t* residuals, size_t count, size_t warmup )
+{
+    // Prefix sums give every partition's sum at every order.
+    std::vector<uint64_t> prefix( count + 1, 0 );
+    for( size_t i = warmup; i < count; ++i )
+    {
+        prefix[i + 1] = prefix[i] + residuals[i];
+    }
+
+    RicePartitions best;
+    best.bits_ = std::numeric_limits<uint64_t>::max();
+
+    for( Uint order = 0; order <= kMAX_PARTITION_ORDER; ++order )
+    {
+        const size_t part_size = count >> order;
+        if( part_size == 0 || part_size < warmup ) break;
+
+        RicePartitions candidate;
+        candidate.order_ = order;
+        candidate.bits_  = 4;
+
+        const size_t num_parts = static_cast<size_t>( 1 ) << order;
+
+        for( size_t j = 0; j < num_parts; ++j )
+        {
+            const size_t   start = partitionStart( j, count, order, warmup );
+            const size_t   end   = partitionEnd( j, count, order );
+            const uint64_t n     = end - start;
+            const uint64_t sum   = prefix[end] - prefix[start];
+
+            // The parameter near log2 of the mean is best; try it and
+            // its neighbours.
+            Uint guess = 0;
+            while( guess < kMAX_RICE_PARAMETER && n > 0 && ( n << ( guess + 1 ) ) <= sum ) ++guess;
+
+            Uint     param = guess;
+            uint64_t bits  = std::numeric_limits<uint64_t>::max();
+
+            for( Uint k = guess > 0 ? guess - 1 : 0; k <= std::min( guess + 1, kMAX_RICE_PARAMETER ); ++k )
+            {
+                const uint64_t k_bits = n * ( k + 1 ) + ( sum >> k );
+                if( k_bits < bits )
+                {
+                    bits  = k_bits;
+                    param = k;
+                }
+            }
+
+            candidate.params_.push_back( param );
+            candidate.bits_ += 5 + bits;
+        }
+
+        if( candidate.bits_ < best.bits_ ) best = std::move( candidate );
+    }
+
+    return best;
+}
+
+//========================================================================
+//
+static void writeResiduals( BitWriter& writer,
+                            const uint64_t* residuals,
+                            size_t count,
+                            size_t warmup,
+                            const RicePartitions& partitions )
+{
+    writer.write_bits( partitions.order_, 4 );
+
+    for( size_t j = 0; j < partitions.params_.size(); ++j )
+    {
+        const Uint k = partitions.params_[j];
+        writer.write_bits( k, 5 );
+
+        const size_t end = partitionEnd( j, count, partitions.order_ );
+        for( size_t i = partitionStart( j, count, partitions.order_, warmup ); i < end; ++i )
+        {
+            writeRice( writer, residuals[i], k );
+        }
+    }
+}
+
+//========================================================================
+// Inverse of writeResiduals(), leaving the signed residuals in
+// samples[warmup, count).
+static MsgNum readResiduals( AU3BitReader& reader, size_t count, size_t warmup, int64_t* samples )
+{
+    const Uint order = reader.readBits( 4 );
+    if( order > kMAX_PARTITION_ORDER ) return BAD_DATA;
+
+    const size_t part_size = count >> order;
+    if( part_size == 0 || part_size < warmup ) return BAD_DATA;
+
+    const size_t num_parts = static_cast<size_t>( 1 ) << order;
+
+    for( size_t j = 0; j < num_parts; ++j )
+    {
+        const Uint k = reader.readBits( 5 );
+        if( k > kMAX_RICE_PARAMETER ) return BAD_DATA;
+
+        const size_t end = partitionEnd( j, count, order );
+        for( size_t i = partitionStart( j, count, order, warmup ); i < end; ++i )
+        {
+            samples[i] = unzigzag( readRice( reader, k ) );
+        }
+
+        if( reader.overrun() ) return BAD_DATA;
+    }
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+// Prediction of sample i by the fixed polynomial of the given order.
+// Arithmetic wraps, so damaged data cannot overflow; valid data never
+// comes near the limits.
+static inline int64_t fixedPredict( const int64_t* x, size_t i, Uint order )
+{
+    const uint64_t a = order > 0 ? static_cast<uint64_t>( x[i - 1] ) : 0;
+    const uint64_t b = order > 1 ? static_cast<uint64_t>( x[i - 2] ) : 0;
+    const uint64_t c = order > 2 ? static_cast<uint64_t>( x[i - 3] ) : 0;
+    const uint64_t d = order > 3 ? static_cast<uint64_t>( x[i - 4] ) : 0;
+
+    switch( order )
+    {
+    case 0:  return 0;
+    case 1:  return static_cast<int64_t>( a );
+    case 2:  return static_cast<int64_t>( 2 * a - b );
+    case 3:  return static_cast<int64_t>( 3 * a - 3 * b + c );
+    default: return static_cast<int64_t>( 4 * a - 6 * b + 4 * c - d );
+    }
+}
+
+//========================================================================
+// Prediction of sample i from the quantized coefficients.
+static inline int64_t lpcPredict( const int64_t* x, size_t i, const int32_t* coefs, Uint order, Uint shift )
+{
+    uint64_t sum = 0;
+
+    for( Uint j = 0; j < order; ++j )
+    {
+        sum += static_cast<uint64_t>( static_cast<int64_t>( coefs[j] ) ) * static_cast<uint64_t>( x[i - 1 - j] );
+    }
+
+    return static_cast<int64_t>( sum ) >> shift;
+}
+
+//========================================================================
+// Sum of the absolute second differences, a cheap estimate of how
+// well a channel predicts.
+static uint64_t predictionCost( const int64_t* x, size_t count )
+{
+    uint64_t cost = 0;
+
+    for( size_t i = 2; i < count; ++i )
+    {
+        const int64_t residual = x[i] - 2 * x[i - 1] + x[i - 2];
+        cost += static_cast<uint64_t>( residual < 0 ? -residual : residual );
+    }
+
+    return cost;
+}
+
+//========================================================================
+// Autocorrelation of the samples under a Tukey window, for lags 0 to
+// max_lag.
+static void autocorrelate( const int64_t* x, size_t count, Uint max_lag, std::vector<double>& autoc )
+{
+    std::vector<double> windowed( count );
+
+    // Flat in the middle, with cosine tapers over a quarter of the
+    // block at each end.
+    const size_t taper = std::max<size_t>( 1, count / 4 );
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        double weight = 1.0;
+
+        const size_t edge = std::min( i, count - 1 - i );
+        if( edge < taper ) weight = 0.5 - 0.5 * std::cos( 3.14159265358979 * edge / taper );
+
+        windowed[i] = weight * static_cast<double>( x[i] );
+    }
+
+    autoc.assign( max_lag + 1, 0.0 );
+
+    for( Uint lag = 0; lag <= max_lag; ++lag )
+    {
+        double sum = 0.0;
+
+        for( size_t i = lag; i < count; ++i )
+        {
+            sum += windowed[i] * windowed[i - lag];
+        }
+
+        autoc[lag] = sum;
+    }
+}
+
+//========================================================================
+// Levinson-Durbin recursion. Fills coefs[m] with the predictor of
+// order m + 1, such that x[i] is predicted by the sum over j of
+// coefs[m][j] * x[i - 1 - j], and errors[m] with its prediction error.
+// Returns the highest order found, which is lower than max_order if
+// the signal is predicted exactly sooner.
+static Uint levinson( const std::vector<double>& autoc,
+                      Uint max_order,
+                      std::vector<std::vector<double>>& coefs,
+                      std::vector<double>& errors )
+{
+    std::vector<double> lpc( max_order, 0.0 );
+
+    coefs.assign( max_order, std::vector<double>() );
+    errors.assign( max_order, 0.0 );
+
+    double error = autoc[0];
+
+    for( Uint i = 0; i < max_order; ++i )
+    {
+        double r = -autoc[i + 1];
+        for( Uint j = 0; j < i; ++j )
+        {
+            r -= lpc[j] * autoc[i - j];
+        }
+        r /= error;
+
+        lpc[i] = r;
+
+        Uint j = 0;
+        for( ; j < i / 2; ++j )
+        {
+            const double tmp = lpc[j];
+            lpc[j]         += r * lpc[i - 1 - j];
+            lpc[i - 1 - j] += r * tmp;
+        }
+        if( i & 1 ) lpc[j] += lpc[j] * r;
+
+        error *= 1.0 - r * r;
+
+        coefs[i].resize( i + 1 );
+        for( Uint k = 0; k <= i; ++k )
+        {
+            coefs[i][k] = -lpc[k];
+        }
+        errors[i] = error;
+
+        if( error <= 0.0 ) return i + 1;
+    }
+
+    return max_order;
+}
+
+//========================================================================
+// Quantizes the coefficients to precision bits each, carrying the
+// rounding error along. Returns false if they are too large to
+// quantize with a non-negative shift.
+static bool quantizeCoefficients( const std::vector<double>& coefs,
+                                  Uint precision,
+                                  std::vector<int32_t>& quantized,
+                                  Uint& shift )
+{
+    double max_coef = 0.0;
+    for( double coef : coefs )
+    {
+        max_coef = std::max( max_coef, std::fabs( coef ) );
+    }
+
+    if( !( max_coef > 0.0 ) || !std::isfinite( max_coef ) ) return false;
+
+    int log2_max = 0;
+    std::frexp( max_coef, &log2_max );
+    --log2_max;
+
+    const int max_shift = static_cast<int>( precision ) - 2 - log2_max;
+    if( max_shift < 0 ) return false;
+
+    shift = static_cast<Uint>( std::min( max_shift, static_cast<int>( kMAX_LPC_SHIFT ) ) );
+
+    const int32_t q_max = ( 1 << ( precision - 1 ) ) - 1;
+    const int32_t q_min = -q_max - 1;
+
+    quantized.resize( coefs.size() );
+
+    double error = 0.0;
+    for( size_t j = 0; j < coefs.size(); ++j )
+    {
+        error += coefs[j] * ( 1 << shift );
+
+        const int32_t q = static_cast<int32_t>( std::max<double>( q_min, std::min<double>( q_max, std::round( error ) ) ) );
+
+        quantized[j] = q;
+        error       -= q;
+    }
+
+    return true;
+}
+
+//========================================================================
+// Sample of a channel as an integer. Float samples are taken as their
+// bit patterns.
+static inline int64_t loadSample( const WavData& data, size_t channel, size_t frame )
+{
+    switch( data.sample_type_ )
+    {
+    case WavSampleType::INT16: return data.int16_channels_[channel][frame];
+    case WavSampleType::INT32: return data.int32_channels_[channel][frame];
+    default:
+    {
+        int32_t bits;
+        std::memcpy( &bits, &data.float_channels_[channel][frame], 4 );
+        return bits;
+    }
+    }
+}
+
+//========================================================================
+// Inverse of loadSample(). The value must fit the sample type.
+static inline void storeSample( WavData& data, size_t channel, size_t frame, int64_t value )
+{
+    switch( data.sample_type_ )
+    {
+    case WavSampleType::INT16: data.int16_channels_[channel][frame] = static_cast<int16_t>( value ); break;
+    case WavSampleType::INT32: data.int32_channels_[channel][frame] = static_cast<int32_t>( value ); break;
+    default:
+    {
+        const int32_t bits = static_cast<int32_t>( value );
+        std::memcpy( &data.float_channels_[channel][frame], &bits, 4 );
+        break;
+    }
+    }
+}
+
+//========================================================================
+// Bits per coded sample for the data's format, or 0 if the coder does
+// not support it.
+static Uint sampleWidth( WavSampleType type, uint16_t bits_per_sample )
+{
+    switch( type )
+    {
+    case WavSampleType::INT16:   return bits_per_sample == 8 || bits_per_sample == 16 ? bits_per_sample : 0;
+    case WavSampleType::INT32:   return bits_per_sample == 24 || bits_per_sample == 32 ? bits_per_sample : 0;
+    case WavSampleType::FLOAT32: return bits_per_sample == 32 ? 32 : 0;
+    default:                     return 0;
+    }
+}
+
+//========================================================================
+// Number of zero bits above the highest one bit, 64 for zero.
+static inline Uint countLeadingZeros( uint64_t value )
+{
+    if( value == 0 ) return 64;
+
+#if defined( _MSC_VER ) && defined( _M_X64 )
+    unsigned long index;
+    _BitScanReverse64( &index, value );
+    return 63 - index;
+#elif defined( _MSC_VER )
+    unsigned long index;
+    if( _BitScanReverse( &index, static_cast<unsigned long>( value >> 32 ) ) ) return 31 - index;
+    _BitScanReverse( &index, static_cast<unsigned long>( value ) );
+    return 63 - index;
+#else
+    return static_cast<Uint>( __builtin_clzll( value ) );
+#endif
+}
+
+//========================================================================
+//
+AU3BitReader::AU3BitReader( const UByte* data, size_t size )
+    : data_( data )
+    , size_( size )
+    , pos_( 0 )
+    , buffer_( 0 )
+    , buffered_( 0 )
+    , consumed_( 0 )
+{
+
+}
+
+//========================================================================
+//
+Uint AU3BitReader::readUnary( Uint limit )
+{
+    Uint count = 0;
+
+    while( count < limit )
+    {
+        refill();
+
+        // Zeros at the top of what is buffered, then the one if it is
+        // there.
+        const Uint run = std::min( countLeadingZeros( buffer_ ), buffered_ );
+
+        if( run >= limit - count )
+        {
+            skip( limit - count );
+            return limit;
+        }
+
+        if( run < buffered_ )
+        {
+            skip( run + 1 );
+            return count + run;
+        }
+
+        skip( run );
+        count += run;
+    }
+
+    return count;
+}
+
+//========================================================================
+//
+AU3Coder::AU3Coder( size_t block_size, Uint max_lpc_order )
+    : block_size_( std::max<size_t>( 16, std::min( block_size, kMAX_BLOCK_SIZE ) ) )
+    , max_lpc_order_( std::min( max_lpc_order, kMAX_LPC_ORDER ) )
+{
+
+}
+
+//========================================================================
+//
+AU3Coder::~AU3Coder()
+{
+
+}
+
+//========================================================================
+//
+MsgNum AU3Coder::encode( const WavData& inData,
+                         std::vector<UByte>& outData )
+{
+    outData.clear();
+
+    MemorySink sink( outData );
+
+    return encode( inData, sink );
+}
+
+//========================================================================
+//
+MsgNum AU3Coder::encode( const WavData& inData,
+                         OutputSink& sink )
+{
+    const Uint width = sampleWidth( inData.sample_type_, inData.bits_per_sample_ );
+    if( width == 0 ) return printMsg( BAD_WAV_BIT_DEPTH );
+
+    const size_t num_channels = inData.num_channels_;
+    const size_t num_frames   = inData.num_frames_;
+
+    if( num_channels == 0 ) return printMsg( BAD_DATA );
+
+    for( size_t c = 0; c < num_channels; ++c )
+    {
+        size_t available = 0;
+
+        switch( inData.sample_type_ )
+        {
+        case WavSampleType::INT16: available = c < inData.int16_channels_.size() ? inData.int16_channels_[c].size() : 0; break;
+        case WavSampleType::INT32: available = c < inData.int32_channels_.size() ? inData.int32_channels_[c].size() : 0; break;
+        default:                   available = c < inData.float_channels_.size() ? inData.float_channels_[c].size() : 0; break;
+        }
+
+        if( available < num_frames ) return printMsg( BAD_DATA );
+    }
+
+    // Code every block on its own.
+    const size_t num_blocks = ( num_frames + block_size_ - 1 ) / block_size_;
+
+    std::vector<std::vector<UByte>> blocks( num_blocks );
+
+    ThreadPool::shared().parallelFor( num_blocks, [&]( size_t b )
+    {
+        const size_t first = b * block_size_;
+
+        encodeBlock( inData, first, std::min( block_size_, num_frames - first ), width, blocks[b] );
+    } );
+
+    return assemble( inData, num_frames, blocks, sink );
+}
+
+//========================================================================
+//
+MsgNum AU3Coder::encode( WavDecoder& decoder,
+                         OutputSink& sink )
+{
+    MsgNum err = decoder.readHeader();
+    if( err ) return err;
+
+    const WavData& format = decoder.getData();
+
+    const Uint width = sampleWidth( format.sample_type_, format.bits_per_sample_ );
+    if( width == 0 ) return printMsg( BAD_WAV_BIT_DEPTH );
+    if( format.num_channels_ == 0 ) return printMsg( BAD_DATA );
+
+    const size_t num_frames = format.num_frames_;
+    const size_t num_blocks = ( num_frames + block_size_ - 1 ) / block_size_;
+
+    std::vector<std::vector<UByte>> blocks( num_blocks );
+
+    // Each window is a whole number of blocks, so the blocks come out
+    // as the whole-file encode cuts them.
+    WavData window;
+    size_t  first_block = 0;
+
+    while( first_block < num_blocks )
+    {
+        err = decoder.readFrames( kBLOCKS_PER_WINDOW * block_size_, window );
+        if( err ) return err;
+
+        if( window.num_frames_ == 0 ) return printMsg( BAD_DATA );
+
+        const size_t window_blocks = ( window.num_frames_ + block_size_ - 1 ) / block_size_;
+
+        ThreadPool::shared().parallelFor( window_blocks, [&]( size_t b )
+        {
+            const size_t first = b * block_size_;
+
+            encodeBlock( window, first, std::min( block_size_, window.num_frames_ - first ), width, blocks[first_block + b] );
+        } );
+
+        first_block += window_blocks;
+    }
+
+    return assemble( format, num_frames, blocks, sink );
+}
+
+//========================================================================
+//
+MsgNum AU3Coder::assemble( const WavData& format,
+                           size_t num_frames,
+                           const std::vector<std::vector<UByte>>& blocks,
+                           OutputSink& sink ) const
+{
+    const size_t num_blocks = blocks.size();
+
+    // 27 bytes : Magic, format and block size.
+    std::vector<UByte> table = { 'A', 'U', '3', '1' };
+
+    util::appendBigEndian( table, format.audio_format_, 2 );
+    util::appendBigEndian( table, format.num_channels_, 2 );
+    util::appendBigEndian( table, format.sample_rate_, 4 );
+    util::appendBigEndian( table, format.bits_per_sample_, 2 );
+    table.push_back( static_cast<UByte>( format.sample_type_ ) );
+    util::appendBigEndian( table, num_frames, 8 );
+    util::appendBigEndian( table, block_size_, 4 );
+
+    // 8 bytes per block : Offset of the block from the end of this
+    // table.
+    uint64_t offset = 0;
+    for( const auto& block : blocks )
+    {
+        util::appendBigEndian( table, offset, 8 );
+        offset += block.size();
+    }
+
+    sink.reserve( static_cast<size_t>( ChunkWriter::containerSize( table.size() + offset, num_blocks + 1 ) ) );
+
+    ChunkWriter writer( sink, ContainerFormat::AU3 );
+    writer.writeChunk( kCHUNK_TABL, table.data(), table.size() );
+
+    for( const auto& block : blocks )
+    {
+        writer.writeChunk( kCHUNK_DATA, block.data(), block.size() );
+    }
+
+    return writer.finish();
+}
+
+//========================================================================
+//
+void AU3Coder::encodeBlock( const WavData& inData,
+                            size_t first,
+                            size_t count,
+                            Uint width,
+                            std::vector<UByte>& block ) const
+{
+    const size_t num_channels = inData.num_channels_;
+
+    std::vector<std::vector<int64_t>> channels( num_channels, std::vector<int64_t>( count ) );
+
+    for( size_t c = 0; c < num_channels; ++c )
+    {
+        for( size_t i = 0; i < count; ++i )
+        {
+            channels[c][i] = loadSample( inData, c, first + i );
+        }
+    }
+
+    AU3ChannelMode mode = AU3ChannelMode::INDEPENDENT;
+
+    // For stereo, code the pair of left, right, side and mid that
+    // predicts best. Side takes one bit more than the samples.
+    std::vector<int64_t> side;
+    std::vector<int64_t> mid;
+
+    if( num_channels == 2 )
+    {
+        const auto& left  = channels[0];
+        const auto& right = channels[1];
+
+        side.resize( count );
+        mid.resize( count );
+
+        for( size_t i = 0; i < count; ++i )
+        {
+            side[i] = left[i] - right[i];
+            mid[i]  = ( left[i] + right[i] ) >> 1;
+        }
+
+        const uint64_t left_cost  = predictionCost( left.data(), count );
+        const uint64_t right_cost = predictionCost( right.data(), count );
+        const uint64_t side_cost  = predictionCost( side.data(), count );
+        const uint64_t mid_cost   = predictionCost( mid.data(), count );
+
+        uint64_t best = left_cost + right_cost;
+
+        if( left_cost + side_cost < best )  { best = left_cost + side_cost;  mode = AU3ChannelMode::LEFT_SIDE; }
+        if( right_cost + side_cost < best ) { best = right_cost + side_cost; mode = AU3ChannelMode::RIGHT_SIDE; }
+        if( mid_cost + side_cost < best )   { best = mid_cost + side_cost;   mode = AU3ChannelMode::MID_SIDE; }
+    }
+
+    block.clear();
+
+    BitWriter writer( block );
+    writer.write_bits( static_cast<uint32_t>( mode ), 2 );
+
+    switch( mode )
+    {
+    case AU3ChannelMode::LEFT_SIDE:
+        encodeSubframe( channels[0].data(), count, width, writer );
+        encodeSubframe( side.data(), count, width + 1, writer );
+        break;
+    case AU3ChannelMode::RIGHT_SIDE:
+        encodeSubframe( side.data(), count, width + 1, writer );
+        encodeSubframe( channels[1].data(), count, width, writer );
+        break;
+    case AU3ChannelMode::MID_SIDE:
+        encodeSubframe( mid.data(), count, width, writer );
+        encodeSubframe( side.data(), count, width + 1, writer );
+        break;
+    default:
+        for( const auto& channel : channels )
+        {
+            encodeSubframe( channel.data(), count, width, writer );
+        }
+        break;
+    }
+
+    writer.flush();
+}
+
+//========================================================================
+//
+void AU3Coder::encodeSubframe( const int64_t* samples,
+                               size_t count,
+                               Uint width,
+                               BitWriter& writer ) const
+{
+    // Silence, or any other constant, is a single value.
+    if( std::all_of( samples, samples + count, [&]( int64_t s ) { return s == samples[0]; } ) )
+    {
+        writer.write_bits( static_cast<uint32_t>( AU3Subframe::CONSTANT ), 2 );
+        writeSigned( writer, samples[0], width );
+        return;
+    }
+
+    AU3Subframe best      = AU3Subframe::VERBATIM;
+    uint64_t    best_bits = 2 + static_cast<uint64_t>( count ) * width;
+
+    // Fixed prediction, at whichever order leaves the smallest
+    // residuals.
+    // The residual of each order is the difference of the residuals of
+    // the order below.
+    std::array<uint64_t, kMAX_FIXED_ORDER + 1> fixed_sums = {};
+
+    if( count > kMAX_FIXED_ORDER )
+    {
+        int64_t last0 = samples[3];
+        int64_t last1 = samples[3] - samples[2];
+        int64_t last2 = last1 - ( samples[2] - samples[1] );
+        int64_t last3 = last2 - ( samples[2] - 2 * samples[1] + samples[0] );
+
+        for( size_t i = kMAX_FIXED_ORDER; i < count; ++i )
+        {
+            const int64_t e0 = samples[i];
+            const int64_t e1 = e0 - last0;
+            const int64_t e2 = e1 - last1;
+            const int64_t e3 = e2 - last2;
+            const int64_t e4 = e3 - last3;
+
+            fixed_sums[0] += static_cast<uint64_t>( e0 < 0 ? -e0 : e0 );
+            fixed_sums[1] += static_cast<uint64_t>( e1 < 0 ? -e1 : e1 );
+            fixed_sums[2] += static_cast<uint64_t>( e2 < 0 ? -e2 : e2 );
+            fixed_sums[3] += static_cast<uint64_t>( e3 < 0 ? -e3 : e3 );
+            fixed_sums[4] += static_cast<uint64_t>( e4 < 0 ? -e4 : e4 );
+
+            last0 = e0;
+            last1 = e1;
+            last2 = e2;
+            last3 = e3;
+        }
+    }
+
+    Uint fixed_order = 0;
+    for( Uint order = 1; order <= kMAX_FIXED_ORDER && order < count; ++order )
+    {
+        if( fixed_sums[order] < fixed_sums[fixed_order] ) fixed_order = order;
+    }
+
+    std::vector<uint64_t> fixed_residuals( count );
+    for( size_t i = fixed_order; i < count; ++i )
+    {
+        fixed_residuals[i] = zigzag( samples[i] - fixedPredict( samples, i, fixed_order ) );
+    }
+
+    const RicePartitions fixed_rice = chooseRice( fixed_residuals.data(), count, fixed_order );
+    const uint64_t       fixed_bits = 2 + 3 + static_cast<uint64_t>( fixed_order ) * width + fixed_rice.bits_;
+
+    if( fixed_bits < best_bits )
+    {
+        best      = AU3Subframe::FIXED;
+        best_bits = fixed_bits;
+    }
+
+    // Linear prediction, at the order expected to cost least.
+    std::vector<int32_t>  lpc_coefs;
+    Uint                  lpc_order = 0;
+    Uint                  lpc_shift = 0;
+    std::vector<uint64_t> lpc_residuals;
+    RicePartitions        lpc_rice;
+
+    const Uint max_order = static_cast<Uint>( std::min<size_t>( max_lpc_order_, count / 2 ) );
+
+    if( max_order > 0 )
+    {
+        std::vector<double> autoc;
+        autocorrelate( samples, count, max_order, autoc );
+
+        std::vector<std::vector<double>> coefs;
+        std::vector<double>              errors;
+
+        const Uint found = autoc[0] > 0.0 ? levinson( autoc, max_order, coefs, errors ) : 0;
+
+        // Residual bits per sample are about half the log of the
+        // prediction error per sample.
+        double best_estimate = std::numeric_limits<double>::max();
+
+        for( Uint order = 1; order <= found; ++order )
+        {
+            const double per_sample = std::max( 0.0, 0.5 * std::log2( std::max( errors[order - 1], 1e-30 ) / count ) );
+            const double estimate   = per_sample * ( count - order ) + order * ( kLPC_PRECISION + width );
+
+            if( estimate < best_estimate )
+            {
+                best_estimate = estimate;
+                lpc_order     = order;
+            }
+        }
+
+        if( lpc_order > 0 && quantizeCoefficients( coefs[lpc_order - 1], kLPC_PRECISION, lpc_coefs, lpc_shift ) )
+        {
+            lpc_residuals.resize( count );
+            for( size_t i = lpc_order; i < count; ++i )
+            {
+                lpc_residuals[i] = zigzag( samples[i] - lpcPredict( samples, i, lpc_coefs.data(), lpc_order, lpc_shift ) );
+            }
+
+            lpc_rice = chooseRice( lpc_residuals.data(), count, lpc_order );
+
+            const uint64_t lpc_bits = 2 + 5 + 4 + 5 + static_cast<uint64_t>( lpc_order ) * ( kLPC_PRECISION + width ) + lpc_rice.bits_;
+
+            if( lpc_bits < best_bits )
+            {
+                best      = AU3Subframe::LPC;
+                best_bits = lpc_bits;
+            }
+        }
+    }
+
+    writer.write_bits( static_cast<uint32_t>( best ), 2 );
+
+    switch( best )
+    {
+    case AU3Subframe::FIXED:
+        writer.write_bits( fixed_order, 3 );
+        for( size_t i = 0; i < fixed_order; ++i )
+        {
+            writeSigned( writer, samples[i], width );
+        }
+        writeResiduals( writer, fixed_residuals.data(), count, fixed_order, fixed_rice );
+        break;
+
+    case AU3Subframe::LPC:
+        writer.write_bits( lpc_order - 1, 5 );
+        writer.write_bits( kLPC_PRECISION - 1, 4 );
+        writer.write_bits( lpc_shift, 5 );
+        for( auto coef : lpc_coefs )
+        {
+            writeSigned( writer, coef, kLPC_PRECISION );
+        }
+        for( size_t i = 0; i < lpc_order; ++i )
+        {
+            writeSigned( writer, samples[i], width );
+        }
+        writeResiduals( writer, lpc_residuals.data(), count, lpc_order, lpc_rice );
+        break;
+
+    default:
+        for( size_t i = 0; i < count; ++i )
+        {
+            writeSigned( writer, samples[i], width );
+        }
+        break;
+    }
+}
+
+//========================================================================
+//
+MsgNum AU3Coder::decode( const std::vector<UByte>& inData,
+                         WavData& outData )
+{
+    return decode( inData.data(), inData.size(), outData );
+}
+
+//========================================================================
+//
+MsgNum AU3Coder::decode( const UByte* inData,
+                         size_t size,
+                         WavData& outData )
+{
+    // Files are checked whole before any of them is decoded, then read
+    // in place from their chunks.
+    std::vector<ChunkSpan> chunks;
+
+    MsgNum err = ChunkReader::verify( inData, size, ContainerFormat::AU3, chunks );
+    if( err ) return err;
+
+    const UByte* table        = chunks[0].data_;
+    const size_t table_size   = chunks[0].size_;
+    const size_t payload_size = static_cast<size_t>( ChunkReader::payloadSize( chunks ) );
+
+    if( table_size < 27 || table[0] != 'A' || table[1] != 'U' || table[2] != '3' || table[3] != '1' )
+    {
+        return printMsg( BAD_DATA );
+    }
+
+    size_t pos = 4;
+
+    WavData data;
+    data.audio_format_    = static_cast<uint16_t>( util::readBigEndian( table, pos, 2 ) );
+    data.num_channels_    = static_cast<uint16_t>( util::readBigEndian( table, pos, 2 ) );
+    data.sample_rate_     = static_cast<uint32_t>( util::readBigEndian( table, pos, 4 ) );
+    data.bits_per_sample_ = static_cast<uint16_t>( util::readBigEndian( table, pos, 2 ) );
+
+    const UByte    sample_type = table[pos++];
+    const uint64_t num_frames  = util::readBigEndian( table, pos, 8 );
+    const size_t   block_size  = static_cast<size_t>( util::readBigEndian( table, pos, 4 ) );
+
+    if( sample_type > static_cast<UByte>( WavSampleType::FLOAT32 ) ) return printMsg( BAD_DATA );
+
+    data.sample_type_ = static_cast<WavSampleType>( sample_type );
+
+    const Uint width = sampleWidth( data.sample_type_, data.bits_per_sample_ );
+
+    if( width == 0 || data.num_channels_ == 0 || block_size == 0 || block_size > kMAX_BLOCK_SIZE )
+    {
+        return printMsg( BAD_DATA );
+    }
+
+    // 8 bytes of the table per block.
+    const uint64_t num_blocks = ( num_frames + block_size - 1 ) / block_size;
+    if( ( table_size - pos ) / 8 < num_blocks ) return printMsg( BAD_DATA );
+
+    std::vector<size_t> offsets( static_cast<size_t>( num_blocks ) + 1 );
+    for( size_t b = 0; b < num_blocks; ++b )
+    {
+        const uint64_t offset = util::readBigEndian( table, pos, 8 );
+        if( offset > payload_size - table_size ) return printMsg( BAD_DATA );
+
+        offsets[b] = table_size + static_cast<size_t>( offset );
+    }
+    offsets[static_cast<size_t>( num_blocks )] = payload_size;
+
+    for( size_t b = 0; b < num_blocks; ++b )
+    {
+        if( offsets[b] > offsets[b + 1] ) return printMsg( BAD_DATA );
+    }
+
+    // The fields a .wav header would hold.
+    const size_t num_channels = data.num_channels_;
+
+    data.num_frames_      = static_cast<size_t>( num_frames );
+    data.block_align_     = static_cast<uint32_t>( num_channels * ( data.bits_per_sample_ / 8 ) );
+    data.byte_rate_       = data.sample_rate_ * data.block_align_;
+    data.sub_chunk1_size_ = 16;
+    data.sub_chunk2_size_ = static_cast<uint32_t>( num_frames * data.block_align_ );
+    data.chunk_size_      = 36 + data.sub_chunk2_size_;
+
+    switch( data.sample_type_ )
+    {
+    case WavSampleType::INT16:   data.int16_channels_.assign( num_channels, std::vector<int16_t>( data.num_frames_ ) ); break;
+    case WavSampleType::INT32:   data.int32_channels_.assign( num_channels, std::vector<int32_t>( data.num_frames_ ) ); break;
+    case WavSampleType::FLOAT32: data.float_channels_.assign( num_channels, std::vector<float>( data.num_frames_ ) ); break;
+    }
+
+    // Decode the blocks in parallel, each straight into its place.
+    std::vector<MsgNum> results( static_cast<size_t>( num_blocks ), STATUS_OKAY );
+
+    ThreadPool::shared().parallelFor( static_cast<size_t>( num_blocks ), [&]( size_t b )
+    {
+        const size_t first      = b * block_size;
+        const size_t count      = std::min<size_t>( block_size, data.num_frames_ - first );
+        const size_t block_bytes = offsets[b + 1] - offsets[b];
+        const UByte* block       = ChunkReader::locate( chunks, offsets[b], block_bytes );
+
+        if( !block )
+        {
+            results[b] = printMsg( BAD_DATA );
+            return;
+        }
+
+        std::vector<std::vector<int64_t>> channels( num_channels );
+
+        results[b] = decodeBlock( block, block_bytes, count, width, channels );
+        if( results[b] )
+        {
+            printMsg( results[b] );
+            return;
+        }
+
+        for( size_t c = 0; c < num_channels; ++c )
+        {
+            for( size_t i = 0; i < count; ++i )
+            {
+                storeSample( data, c, first + i, channels[c][i] );
+            }
+        }
+    } );
+
+    for( auto result : results )
+    {
+        if( result ) return result;
+    }
+
+    outData = std::move( data );
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum AU3Coder::decodeBlock( const UByte* block,
+                              size_t size,
+                              size_t count,
+                              Uint width,
+                              std::vector<std::vector<int64_t>>& channels )
+{
+    const size_t num_channels = channels.size();
+
+    AU3BitReader reader( block, size );
+
+    const AU3ChannelMode mode = static_cast<AU3ChannelMode>( reader.readBits( 2 ) );
+
+    if( mode != AU3ChannelMode::INDEPENDENT && num_channels != 2 ) return BAD_DATA;
+
+    for( size_t c = 0; c < num_channels; ++c )
+    {
+        // Which of the pair is the side channel.
+        const bool is_side = ( mode == AU3ChannelMode::RIGHT_SIDE && c == 0 ) ||
+                             ( ( mode == AU3ChannelMode::LEFT_SIDE || mode == AU3ChannelMode::MID_SIDE ) && c == 1 );
+
+        channels[c].resize( count );
+
+        MsgNum err = decodeSubframe( reader, count, is_side ? width + 1 : width, channels[c].data() );
+        if( err ) return err;
+    }
+
+    if( num_channels == 2 && mode != AU3ChannelMode::INDEPENDENT )
+    {
+        auto& first  = channels[0];
+        auto& second = channels[1];
+
+        for( size_t i = 0; i < count; ++i )
+        {
+            switch( mode )
+            {
+            case AU3ChannelMode::LEFT_SIDE:
+                second[i] = first[i] - second[i];
+                break;
+            case AU3ChannelMode::RIGHT_SIDE:
+                first[i] = first[i] + second[i];
+                break;
+            default:
+            {
+                // The bit mid lost is the low bit of side.
+                const int64_t side = second[i];
+                const int64_t sum  = first[i] * 2 + ( side & 1 );
+
+                first[i]  = ( sum + side ) >> 1;
+                second[i] = ( sum - side ) >> 1;
+                break;
+            }
+            }
+        }
+
+        // Damaged side channels can take the pair out of range.
+        if( !fitsWidth( first.data(), count, width ) || !fitsWidth( second.data(), count, width ) ) return BAD_DATA;
+    }
+
+    return reader.overrun() ? BAD_DATA : STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum AU3Coder::decodeSubframe( AU3BitReader& reader,
+                                 size_t count,
+                                 Uint width,
+                                 int64_t* samples )
+{
+    const AU3Subframe type = static_cast<AU3Subframe>( reader.readBits( 2 ) );
+
+    switch( type )
+    {
+    case AU3Subframe::CONSTANT:
+    {
+        std::fill( samples, samples + count, readSigned( reader, width ) );
+        break;
+    }
+    case AU3Subframe::VERBATIM:
+    {
+        for( size_t i = 0; i < count; ++i )
+        {
+            samples[i] = readSigned( reader, width );
+        }
+        break;
+    }
+    case AU3Subframe::FIXED:
+    {
+        const Uint order = reader.readBits( 3 );
+        if( order > kMAX_FIXED_ORDER || order > count ) return BAD_DATA;
+
+        for( size_t i = 0; i < order; ++i )
+        {
+            samples[i] = readSigned( reader, width );
+        }
+
+        MsgNum err = readResiduals( reader, count, order, samples );
+        if( err ) return err;
+
+        for( size_t i = order; i < count; ++i )
+        {
+            samples[i] = static_cast<int64_t>( static_cast<uint64_t>( samples[i] ) + static_cast<uint64_t>( fixedPredict( samples, i, order ) ) );
+        }
+        break;
+    }
+    case AU3Subframe::LPC:
+    {
+        const Uint order     = reader.readBits( 5 ) + 1;
+        const Uint precision = reader.readBits( 4 ) + 1;
+        const Uint shift     = reader.readBits( 5 );
+        if( order > count ) return BAD_DATA;
+
+        int32_t coefs[kMAX_LPC_ORDER];
+        for( Uint j = 0; j < order; ++j )
+        {
+            coefs[j] = static_cast<int32_t>( readSigned( reader, precision ) );
+        }
+
+        for( size_t i = 0; i < order; ++i )
+        {
+            samples[i] = readSigned( reader, width );
+        }
+
+        MsgNum err = readResiduals( reader, count, order, samples );
+        if( err ) return err;
+
+        for( size_t i = order; i < count; ++i )
+        {
+            samples[i] = static_cast<int64_t>( static_cast<uint64_t>( samples[i] ) + static_cast<uint64_t>( lpcPredict( samples, i, coefs, order, shift ) ) );
+        }
+        break;
+    }
+    }
+
+    if( reader.overrun() || !fitsWidth( samples, count, width ) ) return BAD_DATA;
+
+    return STATUS_OKAY;
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include "Util.h"
+#include "Errors.h"
+#include "HuffmanCoder.h"
+#include "OutputSink.h"
+#include "WavDecoder.h"
+
+#include <vector>
+
+//--------------------------------------------------------------
+// How the two channels of a stereo block are coded. Side is left
+// minus right, mid their average rounded down; the other channels
+// are coded as they are.
+enum class AU3ChannelMode : UByte
+{
+    INDEPENDENT = 0,
+    LEFT_SIDE   = 1,
+    RIGHT_SIDE  = 2,
+    MID_SIDE    = 3
+};
+
+//--------------------------------------------------------------
+// How the samples of one channel of a block are coded.
+enum class AU3Subframe : UByte
+{
+    // Every sample has the same value, stored once.
+    CONSTANT = 0,
+
+    // Samples stored as they are.
+    VERBATIM = 1,
+
+    // Polynomial prediction of order 0 to 4, Rice coded residuals.
+    FIXED    = 2,
+
+    // Linear prediction with quantized coefficients, Rice coded
+    // residuals.
+    LPC      = 3
+};
+
+//--------------------------------------------------------------
+// Reads bits most significant first from a span, as written by
+// BitWriter. Reading past the end gives zero bits and marks the
+// reader as overrun, which the caller checks once at the end.
+class AU3BitReader
+{
+public:
+
+    //--------------------------------------------------------------
+    //
+    AU3BitReader( const UByte* data, size_t size );
+
+    //--------------------------------------------------------------
+    // Reads numBits bits, at most 32.
+    uint32_t readBits( Uint numBits )
+    {
+        if( numBits == 0 ) return 0;
+
+        refill();
+
+        const uint32_t bits = static_cast<uint32_t>( buffer_ >> ( 64 - numBits ) );
+        buffer_   <<= numBits;
+        buffered_  -= numBits;
+        consumed_  += numBits;
+
+        return bits;
+    }
+
+    //--------------------------------------------------------------
+    // Counts zero bits up to the next one bit, which is consumed,
+    // stopping after limit zeros.
+    Uint readUnary( Uint limit );
+
+    //--------------------------------------------------------------
+    //
+    bool overrun() const { return consumed_ > static_cast<uint64_t>( size_ ) * 8; }
+
+private:
+
+    //--------------------------------------------------------------
+    // Drops numBits buffered bits, fewer than 64.
+    void skip( Uint numBits )
+    {
+        buffer_   <<= numBits;
+        buffered_  -= numBits;
+        consumed_  += numBits;
+    }
+
+    //--------------------------------------------------------------
+    // Tops the buffer up to at least 56 bits, a word at a time away
+    // from the end of the data.
+    void refill()
+    {
+        if( buffered_ >= 56 ) return;
+
+        if( pos_ + 8 <= size_ )
+        {
+            uint64_t next = 0;
+            for( int i = 0; i < 8; ++i )
+            {
+                next = ( next << 8 ) | data_[pos_ + i];
+            }
+
+            buffer_   |= next >> buffered_;
+            pos_      += ( 63 - buffered_ ) >> 3;
+            buffered_ |= 56;
+            return;
+        }
+
+        while( buffered_ < 56 )
+        {
+            const UByte next = pos_ < size_ ? data_[pos_] : 0;
+
+            ++pos_;
+            buffer_   |= static_cast<uint64_t>( next ) << ( 56 - buffered_ );
+            buffered_ += 8;
+        }
+    }
+
+    const UByte* data_;
+    size_t       size_;
+    size_t       pos_;
+    uint64_t     buffer_;
+    Uint         buffered_;
+    uint64_t     consumed_;
+};
+
+//--------------------------------------------------------------
+// Lossless audio coder in the manner of FLAC. The audio is cut into
+// blocks of block_size frames, each coded on its own so that blocks
+// are encoded and decoded in parallel. Within a block, stereo audio
+// is decorrelated with whichever of the four channel modes costs
+// least, and every channel is then coded with the cheapest of a
+// constant, verbatim samples, fixed polynomial prediction or linear
+// prediction up to max_lpc_order, the residuals being Rice coded
+// with the parameter chosen per partition.
+//
+// 8 to 32-bit PCM is coded exactly, as is 32-bit float data, whose
+// samples are coded as their bit patterns. 64-bit float data is not
+// supported.
+//
+// Format: the chunked container, with the table chunk holding
+//   | A U 3 1 | audio format 2 | channels 2 | sample rate 4 |
+//   bits per sample 2 | sample type 1 | frames 8 | block size 4 |
+// followed by an 8 byte offset per block from the end of the table,
+// and one data chunk per block. A block is a bit stream: the channel
+// mode in 2 bits, then one subframe per channel.
+class AU3Coder
+{
+public:
+
+    //--------------------------------------------------------------
+    //
+    AU3Coder( size_t block_size = 4096,
+              Uint max_lpc_order = 12 );
+
+    //--------------------------------------------------------------
+    //
+    ~AU3Coder();
+
+    //--------------------------------------------------------------
+    //
+    MsgNum encode( const WavData& inData,
+                   std::vector<UByte>& outData );
+
+    //--------------------------------------------------------------
+    // As above, writing the .au3 file to a sink.
+    MsgNum encode( const WavData& inData,
+                   OutputSink& sink );
+
+    //--------------------------------------------------------------
+    // As above, pulling the audio from the decoder a window of blocks
+    // at a time with WavDecoder::readFrames(), so that only one window
+    // of samples is ever decoded. The coded blocks are held until the
+    // end, as the table ahead of them records their offsets.
+    MsgNum encode( WavDecoder& decoder,
+                   OutputSink& sink );
+
+    //--------------------------------------------------------------
+    //
+    MsgNum decode( const std::vector<UByte>& inData,
+                   WavData& outData );
+
+    //--------------------------------------------------------------
+    // As above, reading the data in place, e.g. from a FileSource.
+    MsgNum decode( const UByte* inData,
+                   size_t size,
+                   WavData& outData );
+
+private:
+
+    //--------------------------------------------------------------
+    // Writes the .au3 file: the table for audio in the format of
+    // format, num_frames long, then the coded blocks.
+    MsgNum assemble( const WavData& format,
+                     size_t num_frames,
+                     const std::vector<std::vector<UByte>>& blocks,
+                     OutputSink& sink ) const;
+
+    //--------------------------------------------------------------
+    // Codes count frames of the audio, from frame first on, into a 
+    // block. width is the number of bits in a sample.
+    void encodeBlock( const WavData& inData,
+                      size_t first,
+                      size_t count,
+                      Uint width,
+                      std::vector<UByte>& block ) const;
+
+    //--------------------------------------------------------------
+    // Codes count samples of one channel as the cheapest subframe.
+    void encodeSubframe( const int64_t* samples,
+                         size_t count,
+                         Uint width,
+                         BitWriter& writer ) const;
+
+    //--------------------------------------------------------------
+    // Inverse of encodeBlock(), into count samples per channel, which
+    // the caller stores.
+    static MsgNum decodeBlock( const UByte* block,
+                               size_t size,
+                               size_t count,
+                               Uint width,
+                               std::vector<std::vector<int64_t>>& channels );
+
+    //--------------------------------------------------------------
+    // Inverse of encodeSubframe().
+    static MsgNum decodeSubframe( AU3BitReader& reader,
+                                  size_t count,
+                                  Uint width,
+                                  int64_t* samples );
+
+    size_t block_size_;
+    Uint   max_lpc_order_;
+};
@@ -0,0 +1,396 @@
+#include "stdafx.h"
+#include "BatchConverter.h"
+
+#include "AM3Coder.h"
+#include "AU3Coder.h"
+#include "BmpWriter.h"
+#include "BoundedQueue.h"
+#include "FileSource.h"
+#include "IM3Coder.h"
+#include "OutputSink.h"
+#include "WavWriter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+//========================================================================
+// A file on its way through the pipeline.
+struct BatchItem
+{
+    size_t                      job_ = 0;
+    std::unique_ptr<FileSource> source_;
+    std::vector<UByte>          encoded_;
+};
+
+//========================================================================
+//
+BatchConverter::BatchConverter( const BatchOptions& options )
+    : options_( options )
+{
+
+}
+
+//========================================================================
+//
+MsgNum BatchConverter::run( const std::vector<BatchJob>& jobs,
+                            std::vector<BatchResult>& results )
+{
+    results.assign( jobs.size(), BatchResult() );
+
+    BoundedQueue<BatchItem> loaded( options_.read_ahead_ );
+    BoundedQueue<BatchItem> encoded( options_.write_behind_ );
+
+    std::atomic<size_t> next_job( 0 );
+    std::atomic<size_t> readers_left( std::max<size_t>( 1, options_.num_readers_ ) );
+    std::atomic<size_t> encoders_left( std::max<size_t>( 1, options_.num_encoders_ ) );
+
+    // Every result is written by exactly one stage, so no locking is 
+    // needed around them.
+    auto read = [&]()
+    {
+        for( size_t j = next_job++; j < jobs.size(); j = next_job++ )
+        {
+            BatchItem item;
+            item.job_    = j;
+            item.source_.reset( new FileSource() );
+
+            results[j].status_ = item.source_->open( jobs[j].input_path_ );
+            if( results[j].status_ ) continue;
+
+            item.source_->prefetch();
+            results[j].input_size_ = item.source_->size();
+
+            loaded.push( std::move( item ) );
+        }
+
+        if( --readers_left == 0 ) loaded.close();
+    };
+
+    auto convert = [&]()
+    {
+        BatchItem item;
+
+        while( loaded.pop( item ) )
+        {
+            const BatchJob& job    = jobs[item.job_];
+            BatchResult&    result = results[item.job_];
+
+            result.status_ = this->convert( job.input_path_, item.source_->data(), item.source_->size(), item.encoded_, result );
+
+            // VERIFY records the size of the copy it coded in memory.
+            if( options_.action_ != BatchAction::VERIFY ) result.output_size_ = item.encoded_.size();
+
+            // The input is not needed once it has been converted.
+            item.source_.reset();
+
+            if( !result.status_ && !job.output_path_.empty() ) encoded.push( std::move( item ) );
+        }
+
+        if( --encoders_left == 0 ) encoded.close();
+    };
+
+    auto write = [&]()
+    {
+        BatchItem item;
+
+        while( encoded.pop( item ) )
+        {
+            BatchResult& result = results[item.job_];
+
+            FileSink sink;
+
+            result.status_ = sink.open( jobs[item.job_].output_path_ );
+            if( !result.status_ ) result.status_ = sink.write( item.encoded_.data(), item.encoded_.size() );
+            if( !result.status_ ) result.status_ = sink.close();
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for( size_t i = 0; i < std::max<size_t>( 1, options_.num_readers_ ); ++i )  threads.emplace_back( read );
+    for( size_t i = 0; i < std::max<size_t>( 1, options_.num_encoders_ ); ++i ) threads.emplace_back( convert );
+    for( size_t i = 0; i < std::max<size_t>( 1, options_.num_writers_ ); ++i )  threads.emplace_back( write );
+
+    for( auto& thread : threads )
+    {
+        thread.join();
+    }
+
+    for( const auto& result : results )
+    {
+        if( result.status_ ) return result.status_;
+    }
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+// PSNR of decoded against original, over the RGB channels, or infinity
+// if they are the same.
+static double imagePSNR( const std::vector<Color256>& original,
+                         const std::vector<Color256>& decoded )
+{
+    if( original.empty() ) return INFINITY;
+
+    double sum = 0.0;
+
+    for( size_t i = 0; i < original.size(); ++i )
+    {
+        const double dr = original[i].r - decoded[i].r;
+        const double dg = original[i].g - decoded[i].g;
+        const double db = original[i].b - decoded[i].b;
+
+        sum += dr * dr + dg * dg + db * db;
+    }
+
+    const double mse = sum / ( 3.0 * original.size() );
+
+    return mse == 0.0 ? INFINITY : 10.0 * std::log10( 255.0 * 255.0 / mse );
+}
+
+//========================================================================
+// SNR of decoded against original, or infinity if they are the same.
+static double audioSNR( const WavData& original,
+                        const WavData& decoded )
+{
+    double signal = 0.0;
+    double noise  = 0.0;
+
+    for( size_t c = 0; c < original.num_channels_; ++c )
+    {
+        for( size_t f = 0; f < original.num_frames_; ++f )
+        {
+            const double value = static_cast<double>( original.sample( c, f ) );
+            const double error = value - static_cast<double>( decoded.sample( c, f ) );
+
+            signal += value * value;
+            noise  += error * error;
+        }
+    }
+
+    return noise == 0.0 ? INFINITY : 10.0 * std::log10( signal / noise );
+}
+
+//========================================================================
+//
+MsgNum BatchConverter::convert( const std::string& input_path,
+                                const UByte* data,
+                                size_t size,
+                                std::vector<UByte>& outData,
+                                BatchResult& result ) const
+{
+    util::FILE_TYPE type;
+    if( util::determineFileType( input_path, type ) ) return printMsg( INVALID_FILE );
+
+    const BatchAction action = options_.action_;
+
+    outData.clear();
+
+    switch( type )
+    {
+    case util::FILE_TYPE::BMP:
+    {
+        if( action == BatchAction::DECODE ) return printMsg( INVALID_FILE );
+
+        BmpDecoder decoder( data, size );
+
+        MsgNum err = decoder.decode();
+        if( !err ) err = encodeImage( decoder.getData(), outData );
+        if( err || action == BatchAction::ENCODE ) return err;
+
+        // Only the size of the encoded copy is wanted.
+        result.output_size_ = outData.size();
+
+        BmpData original = decoder.releaseData();
+        err = verifyImage( original, outData, result );
+
+        outData.clear();
+        return err;
+    }
+    case util::FILE_TYPE::WAV:
+    {
+        if( action == BatchAction::DECODE ) return printMsg( INVALID_FILE );
+
+        WavDecoder decoder( data, size );
+
+        // AU3 pulls the audio a window at a time, so the samples are
+        // never all decoded at once. Verifying needs them all anyway.
+        if( action == BatchAction::ENCODE && options_.audio_format_ == BatchFormat::AU3 )
+        {
+            AU3Coder   coder;
+            MemorySink sink( outData );
+
+            return coder.encode( decoder, sink );
+        }
+
+        MsgNum err = decoder.decode();
+        if( !err ) err = encodeAudio( decoder.getData(), outData );
+        if( err || action == BatchAction::ENCODE ) return err;
+
+        result.output_size_ = outData.size();
+
+        err = verifyAudio( decoder.getData(), outData, result );
+
+        outData.clear();
+        return err;
+    }
+    case util::FILE_TYPE::IM3:
+    case util::FILE_TYPE::IN3:
+    {
+        if( action == BatchAction::ENCODE ) return printMsg( INVALID_FILE );
+
+        BmpData image;
+
+        MsgNum err = decodeImage( type, data, size, image );
+        if( err || action == BatchAction::VERIFY ) return err;
+
+        MemorySink sink( outData );
+        return BmpWriter::write( image, sink );
+    }
+    case util::FILE_TYPE::AU3:
+    case util::FILE_TYPE::AM3:
+    {
+        if( action == BatchAction::ENCODE ) return printMsg( INVALID_FILE );
+
+        WavData audio;
+
+        MsgNum err = decodeAudio( type, data, size, audio );
+        if( err || action == BatchAction::VERIFY ) return err;
+
+        MemorySink sink( outData );
+        return WavWriter::write( audio, sink );
+    }
+    }
+
+    return printMsg( INVALID_FILE );
+}
+
+//========================================================================
+//
+MsgNum BatchConverter::encodeImage( const BmpData& image,
+                                    std::vector<UByte>& outData ) const
+{
+    if( options_.image_format_ == BatchFormat::IM3 )
+    {
+        IM3Coder coder( options_.compression_factor_, options_.tile_size_ );
+        return coder.encode( image, outData );
+    }
+
+    IN3Coder coder( options_.colour_transform_, options_.effort_, options_.backend_, options_.alpha_ );
+    return coder.encode( image, outData );
+}
+
+//========================================================================
+//
+MsgNum BatchConverter::encodeAudio( const WavData& audio,
+                                    std::vector<UByte>& outData ) const
+{
+    if( options_.audio_format_ == BatchFormat::AM3 )
+    {
+        AM3Coder coder( options_.compression_factor_ );
+        return coder.encode( audio, outData );
+    }
+
+    AU3Coder coder;
+    return coder.encode( audio, outData );
+}
+
+//========================================================================
+//
+MsgNum BatchConverter::decodeImage( util::FILE_TYPE type,
+                                    const UByte* data,
+                                    size_t size,
+                                    BmpData& image ) const
+{
+    if( type == util::FILE_TYPE::IM3 )
+    {
+        IM3Coder coder( options_.compression_factor_, options_.tile_size_ );
+        return coder.decode( data, size, image );
+    }
+
+    IN3Coder coder;
+    return coder.decode( data, size, image );
+}
+
+//========================================================================
+//
+MsgNum BatchConverter::decodeAudio( util::FILE_TYPE type,
+                                    const UByte* data,
+                                    size_t size,
+                                    WavData& audio ) const
+{
+    if( type == util::FILE_TYPE::AM3 )
+    {
+        AM3Coder coder( options_.compression_factor_ );
+        return coder.decode( data, size, audio );
+    }
+
+    AU3Coder coder;
+    return coder.decode( data, size, audio );
+}
+
+//========================================================================
+//
+MsgNum BatchConverter::verifyImage( BmpData& original,
+                                    const std::vector<UByte>& encoded,
+                                    BatchResult& result ) const
+{
+    const bool lossy = options_.image_format_ == BatchFormat::IM3;
+
+    BmpData decoded;
+
+    MsgNum err = decodeImage( lossy ? util::FILE_TYPE::IM3 : util::FILE_TYPE::IN3, encoded.data(), encoded.size(), decoded );
+    if( err ) return err;
+
+    if( !lossy )
+    {
+        // The file itself must come back.
+        const bool same = decoded.headerSize() == original.headerSize() && 
+                          decoded.bodySize() == original.bodySize() &&
+                          std::memcmp( decoded.headerData(), original.headerData(), original.headerSize() ) == 0 &&
+                          std::memcmp( decoded.bodyData(), original.bodyData(), original.bodySize() ) == 0;
+
+        return same ? STATUS_OKAY : printMsg( BAD_DATA );
+    }
+
+    err = BmpDecoder::materializePixels( original );
+    if( err ) return printMsg( err );
+
+    if( decoded.pixels_.size() != original.pixels_.size() ) return printMsg( BAD_DATA );
+
+    result.quality_db_ = imagePSNR( original.pixels_, decoded.pixels_ );
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum BatchConverter::verifyAudio( const WavData& original,
+                                    const std::vector<UByte>& encoded,
+                                    BatchResult& result ) const
+{
+    const bool lossy = options_.audio_format_ == BatchFormat::AM3;
+
+    WavData decoded;
+
+    MsgNum err = decodeAudio( lossy ? util::FILE_TYPE::AM3 : util::FILE_TYPE::AU3, encoded.data(), encoded.size(), decoded );
+    if( err ) return err;
+
+    if( decoded.num_channels_ != original.num_channels_ || decoded.num_frames_ != original.num_frames_ ||
+        decoded.sample_type_ != original.sample_type_ )
+    {
+        return printMsg( BAD_DATA );
+    }
+
+    const double snr = audioSNR( original, decoded );
+
+    if( !lossy ) return std::isinf( snr ) ? STATUS_OKAY : printMsg( BAD_DATA );
+
+    result.quality_db_ = snr;
+
+    return STATUS_OKAY;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "Util.h"
+#include "Errors.h"
+#include "IN3Coder.h"
+#include "BmpDecoder.h"
+#include "WavDecoder.h"
+
+#include <string>
+#include <vector>
+
+//========================================================================
+// What a batch does with each file.
+enum class BatchAction : UByte
+{
+    // .bmp and .wav files to the formats of the options.
+    ENCODE = 0,
+
+    // Coded files back to .bmp and .wav.
+    DECODE = 1,
+
+    // Nothing is written. Coded files are decoded, which checks them,
+    // and .bmp and .wav files are encoded and decoded again in memory,
+    // and must come back exactly from the lossless formats.
+    VERIFY = 2
+};
+
+//========================================================================
+// What a batch encodes to: IM3 or IN3 for images, AU3 or AM3 for audio.
+enum class BatchFormat : UByte
+{
+    IM3 = 0,
+    IN3 = 1,
+    AU3 = 2,
+    AM3 = 3
+};
+
+//========================================================================
+//
+struct BatchOptions
+{
+    BatchAction action_       = BatchAction::ENCODE;
+    BatchFormat image_format_ = BatchFormat::IN3;
+    BatchFormat audio_format_ = BatchFormat::AU3;
+
+    // IM3 and AM3 settings. .im3 files do not record their factor, so
+    // they must be decoded with the one they were encoded with.
+    double   compression_factor_ = 1.0;
+    uint32_t tile_size_          = 0;
+
+    // IN3 settings.
+    IN3ColourTransform colour_transform_ = IN3ColourTransform::NONE;
+    IN3Effort          effort_           = IN3Effort::DEFAULT;
+    IN3Backend         backend_          = IN3Backend::HUFFMAN;
+    IN3Alpha           alpha_            = IN3Alpha::KEEP;
+
+    // Threads per stage. The coders also spread each image over the 
+    // shared thread pool, so a few encoders are enough to keep it busy
+    // between images.
+    size_t num_readers_  = 2;
+    size_t num_encoders_ = 2;
+    size_t num_writers_  = 2;
+
+    // Files read ahead of the encoders, and encoded files waiting to
+    // be written.
+    size_t read_ahead_   = 8;
+    size_t write_behind_ = 8;
+};
+
+//========================================================================
+//
+struct BatchJob
+{
+    std::string input_path_;
+
+    // Empty if nothing is to be written, as for VERIFY.
+    std::string output_path_;
+};
+
+//========================================================================
+//
+struct BatchResult
+{
+    MsgNum   status_      = STATUS_OKAY;
+    uint64_t input_size_  = 0;
+
+    // For VERIFY of a .bmp or .wav file, the size it encoded to.
+    uint64_t output_size_ = 0;
+
+    // For a .bmp or .wav file verified through IM3 or AM3, the PSNR or
+    // SNR of the round trip in dB.
+    double   quality_db_  = 0.0;
+};
+
+//========================================================================
+// Converts many files with separate read, convert and write stages
+// joined by bounded queues. Readers map and prefetch files ahead of 
+// the encoders, and writers drain converted files behind them, so disk
+// and CPU work at the same time and a batch takes about as long as 
+// the slower of the two rather than their sum. Each file is handled as
+// its extension and the action call for.
+class BatchConverter
+{
+public:
+
+    //--------------------------------------------------------------
+    //
+    explicit BatchConverter( const BatchOptions& options );
+
+    //--------------------------------------------------------------
+    // Converts every job, filling one result per job in the same 
+    // order. A failed job does not stop the others. Returns the first
+    // failure, if any.
+    MsgNum run( const std::vector<BatchJob>& jobs,
+                std::vector<BatchResult>& results );
+
+private:
+
+    //--------------------------------------------------------------
+    // Converts one mapped file, leaving what is to be written in 
+    // outData.
+    MsgNum convert( const std::string& input_path,
+                    const UByte* data,
+                    size_t size,
+                    std::vector<UByte>& outData,
+                    BatchResult& result ) const;
+
+    //--------------------------------------------------------------
+    //
+    MsgNum encodeImage( const BmpData& image,
+                        std::vector<UByte>& outData ) const;
+
+    //--------------------------------------------------------------
+    //
+    MsgNum encodeAudio( const WavData& audio,
+                        std::vector<UByte>& outData ) const;
+
+    //--------------------------------------------------------------
+    // Decodes an .im3 or .in3 file.
+    MsgNum decodeImage( util::FILE_TYPE type,
+                        const UByte* data,
+                        size_t size,
+                        BmpData& image ) const;
+
+    //--------------------------------------------------------------
+    // Decodes an .au3 or .am3 file.
+    MsgNum decodeAudio( util::FILE_TYPE type,
+                        const UByte* data,
+                        size_t size,
+                        WavData& audio ) const;
+
+    //--------------------------------------------------------------
+    // Decodes the encoded copy of original and compares the two.
+    MsgNum verifyImage( BmpData& original,
+                        const std::vector<UByte>& encoded,
+                        BatchResult& result ) const;
+
+    //--------------------------------------------------------------
+    //
+    MsgNum verifyAudio( const WavData& original,
+                        const std::vector<UByte>& encoded,
+                        BatchResult& result ) const;
+
+    BatchOptions options_;
+};
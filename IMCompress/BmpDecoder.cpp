@@ -12,15 +12,28 @@
 
 #include "stdafx.h"
 #include "BmpDecoder.h"
+#include "ThreadPool.h"
+
+#include <array>
+#include <limits>
 
 //========================================================================
 //
-BmpDecoder::BmpDecoder( const std::vector<Byte>& raw_data )
+BmpDecoder::BmpDecoder( const UByte* raw_data, size_t size )
     : raw_data_( raw_data )
+    , raw_size_( size )
 {
     bmp_data_ = { 0 };
 }
 
+//========================================================================
+//
+BmpDecoder::BmpDecoder( const std::vector<Byte>& raw_data )
+    : BmpDecoder( reinterpret_cast<const UByte*>( raw_data.data() ), raw_data.size() )
+{
+
+}
+
 //========================================================================
 //
 BmpDecoder::~BmpDecoder()
@@ -34,14 +47,11 @@ MsgNum BmpDecoder::decode()
 {
     // pos is a locator to let us keep track of where we are in the file,
     // and this gets updated when passed to the methods in here.
-    Uint pos = 0;
+    size_t pos = 0;
 
     MsgNum err = storeMetaData( pos );
     if( err ) return printMsg( err );
 
-    err = storePixelData( pos );
-    if( err ) return printMsg( err );
-
     return STATUS_OKAY;
 }
 
@@ -61,15 +71,15 @@ BmpData BmpDecoder::releaseData()
 
 //========================================================================
 //
-uint32_t BmpDecoder::bytesToUInt32LE( Uint& pos,
+uint32_t BmpDecoder::bytesToUInt32LE( size_t& pos,
                                       Uint numBytes ) const
 {
     uint32_t res    = 0;
     Uint multiplier = 0;
 
-    for( Uint i = pos; i < pos + numBytes; ++i )
+    for( size_t i = pos; i < pos + numBytes; ++i )
     {
-        UByte currByte = static_cast<UByte>( raw_data_[i] );
+        UByte currByte = raw_data_[i];
         Uint currVal = currByte << ( 8 * multiplier );
         res += currVal;
         ++multiplier;
@@ -81,90 +91,367 @@ uint32_t BmpDecoder::bytesToUInt32LE( Uint& pos,
 
 //========================================================================
 //
-MsgNum BmpDecoder::storeMetaData( Uint& pos )
+MsgNum BmpDecoder::parseHeader( const UByte* header, 
+                                size_t size,
+                                BmpData& data )
 {
     // We should see at least 54 bytes within the header.
-    if( raw_data_.size() < 54 )
+    if( size < 54 )
     {
-        return printMsg( BAD_DATA );
+        return BAD_DATA;
     }
 
-    pos = 2;
+    auto readLE = [header]( size_t pos, Uint numBytes ) -> uint32_t
+    {
+        uint32_t res = 0;
 
-    bmp_data_.file_size_      = bytesToUInt32LE( pos, 4 ) & 0xffffffff;
+        for( Uint i = 0; i < numBytes; ++i )
+        {
+            res |= static_cast<uint32_t>( header[pos + i] ) << ( 8 * i );
+        }
 
-    pos += 4;
+        return res;
+    };
 
-    bmp_data_.offset_to_data_ = bytesToUInt32LE( pos, 4 ) & 0xffffffff;
+    data.file_size_      = readLE( 2, 4 );
+    data.offset_to_data_ = readLE( 10, 4 );
+    data.bits_per_pixel_ = readLE( 28, 2 ) & 0x0000ffff;
+    data.compression_    = readLE( 30, 4 );
 
-    pos += 4;
+    const uint32_t dib_size     = readLE( 14, 4 );
+    const int32_t  width        = static_cast<int32_t>( readLE( 18, 4 ) );
+    const int32_t  height       = static_cast<int32_t>( readLE( 22, 4 ) );
+    const uint32_t colours_used = readLE( 46, 4 );
 
-    bmp_data_.width_          = bytesToUInt32LE( pos, 4 ) & 0xffffffff;
-    bmp_data_.height_         = bytesToUInt32LE( pos, 4 ) & 0xffffffff;
+    if( width < 0 || height == std::numeric_limits<int32_t>::min() ) return BAD_DATA;
 
-    pos += 2;
+    data.width_    = static_cast<uint32_t>( width );
+    data.height_   = static_cast<uint32_t>( height < 0 ? -height : height );
+    data.top_down_ = height < 0;
 
-    bmp_data_.bits_per_pixel_ = bytesToUInt32LE( pos, 2 ) & 0x0000ffff;
+    // Work out the pixel layout. BI_RGB is 0, BI_RLE8 is 1 and 
+    // BI_BITFIELDS is 3.
+    data.format_ = BmpPixelFormat::UNSUPPORTED;
 
-    pos = bmp_data_.offset_to_data_;
+    switch( data.compression_ )
+    {
+    case 0:
+        if( data.bits_per_pixel_ == 24 ) data.format_ = BmpPixelFormat::BGR24;
+        if( data.bits_per_pixel_ == 32 ) data.format_ = BmpPixelFormat::BGRA32;
+        if( data.bits_per_pixel_ == 8 )  data.format_ = BmpPixelFormat::PAL8;
+        break;
+
+    case 1:
+        // RLE8 images are always stored bottom-up.
+        if( data.bits_per_pixel_ == 8 && !data.top_down_ ) data.format_ = BmpPixelFormat::RLE8;
+        break;
+
+    case 3:
+        // The red, green and blue masks follow the 40-byte info header.
+        if( data.bits_per_pixel_ == 32 && size >= 66 &&
+            readLE( 54, 4 ) == 0x00ff0000 && readLE( 58, 4 ) == 0x0000ff00 && readLE( 62, 4 ) == 0x000000ff )
+        {
+            data.format_ = BmpPixelFormat::BGRA32;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    data.row_stride_ = rowStride( data );
+
+    // The colour table sits between the info header and the pixel 
+    // data, 4 bytes per entry, blue first.
+    data.palette_.clear();
 
-    // Save the header and data blocks if we wish to compress the file
-    // later.
-    for( Uint i = 0; i < bmp_data_.offset_to_data_; ++i )
+    if( data.format_ == BmpPixelFormat::PAL8 || data.format_ == BmpPixelFormat::RLE8 )
     {
-        bmp_data_.header_.push_back( raw_data_[i] );
+        const size_t table_start = 14 + static_cast<size_t>( dib_size );
+        const size_t table_end   = std::min<size_t>( data.offset_to_data_, size );
+
+        size_t num_colours = colours_used == 0 || colours_used > 256 ? 256 : colours_used;
+
+        if( table_start < table_end )
+        {
+            num_colours = std::min( num_colours, ( table_end - table_start ) / 4 );
+        }
+        else
+        {
+            num_colours = 0;
+        }
+
+        for( size_t i = 0; i < num_colours; ++i )
+        {
+            const UByte* entry = header + table_start + 4 * i;
+
+            data.palette_.push_back( Color256( entry[2], entry[1], entry[0] ) );
+        }
+
+        // Without a palette there is nothing to show.
+        if( data.palette_.empty() )
+        {
+            data.format_ = BmpPixelFormat::UNSUPPORTED;
+        }
     }
-    for( Uint i = bmp_data_.offset_to_data_; i < raw_data_.size(); ++i )
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+size_t BmpDecoder::rowStride( const BmpData& data )
+{
+    return ( ( static_cast<size_t>( data.width_ ) * data.bits_per_pixel_ + 31 ) / 32 ) * 4;
+}
+
+//========================================================================
+//
+void BmpDecoder::rowsToPixels( const UByte* rows,
+                               ptrdiff_t row_stride,
+                               uint32_t width,
+                               size_t num_rows,
+                               Color256* pixels )
+{
+    for( size_t y = 0; y < num_rows; ++y )
     {
-        bmp_data_.body_.push_back( raw_data_[i] );
+        const UByte* row = rows + static_cast<ptrdiff_t>( y ) * row_stride;
+        Color256*    out = pixels + y * width;
+
+        for( uint32_t x = 0; x < width; ++x )
+        {
+            out[x].r = row[3 * x + 2];
+            out[x].g = row[3 * x + 1];
+            out[x].b = row[3 * x];
+        }
     }
+}
 
-    // Add zero byte padding in the case that the file size is slightly 
-    // less than what we are given..? Not sure how this happens but this
-    // seems to provide a solution..
-    for( Uint i = raw_data_.size(); i < bmp_data_.file_size_; ++i )
+//========================================================================
+//
+void BmpDecoder::bgraRowsToPixels( const UByte* rows,
+                                   ptrdiff_t row_stride,
+                                   uint32_t width,
+                                   size_t num_rows,
+                                   Color256* pixels )
+{
+    for( size_t y = 0; y < num_rows; ++y )
     {
-        bmp_data_.body_.push_back( 0 );
+        const UByte* row = rows + static_cast<ptrdiff_t>( y ) * row_stride;
+        Color256*    out = pixels + y * width;
+
+        for( uint32_t x = 0; x < width; ++x )
+        {
+            out[x].r = row[4 * x + 2];
+            out[x].g = row[4 * x + 1];
+            out[x].b = row[4 * x];
+        }
     }
+}
 
-    return STATUS_OKAY;
+//========================================================================
+//
+void BmpDecoder::indexRowsToPixels( const UByte* rows,
+                                    ptrdiff_t row_stride,
+                                    uint32_t width,
+                                    size_t num_rows,
+                                    const Color256* palette,
+                                    Color256* pixels )
+{
+    for( size_t y = 0; y < num_rows; ++y )
+    {
+        const UByte* row = rows + static_cast<ptrdiff_t>( y ) * row_stride;
+        Color256*    out = pixels + y * width;
+
+        for( uint32_t x = 0; x < width; ++x )
+        {
+            out[x] = palette[row[x]];
+        }
+    }
 }
 
 //========================================================================
 //
-MsgNum BmpDecoder::storePixelData( Uint& pos )
+MsgNum BmpDecoder::decodeRle8( const BmpData& data,
+                               std::vector<UByte>& indices )
 {
-    // Keep track of position in row in case we need to seek over
-    // padding bytes present at the end of the row. This can happen
-    // if the image width is not a multiple of four.
-    Uint curr_row_size = 0;
+    const size_t width  = data.width_;
+    const size_t height = data.height_;
+
+    indices.assign( width * height, 0 );
+
+    const UByte* pos = data.bodyData();
+    const UByte* end = pos + data.bodySize();
+
+    size_t x = 0;
+    size_t y = 0;
 
-    // Copy the data and store and to an internal buffer.
-    for( Uint i = pos; i + 2 < raw_data_.size(); i += 3 )
+    // The body is a series of two byte codes. Runs that overhang the 
+    // end of a row are clipped rather than wrapped.
+    while( end - pos >= 2 && y < height )
     {
+        const UByte count = *pos++;
+        const UByte value = *pos++;
 
-        // Seek past padding bytes if at end of row.
-        if( curr_row_size == bmp_data_.width_ * 3 )
+        if( count > 0 )
         {
-            while( curr_row_size % 4 != 0 )
+            // Encoded mode: count copies of one index.
+            if( x < width )
             {
-                ++i;
-                ++curr_row_size;
+                std::fill_n( indices.begin() + y * width + x, std::min<size_t>( count, width - x ), value );
             }
+            x += count;
+        }
+        else if( value == 0 )
+        {
+            // End of line.
+            x = 0;
+            ++y;
+        }
+        else if( value == 1 )
+        {
+            // End of bitmap.
+            break;
+        }
+        else if( value == 2 )
+        {
+            // Delta: move right and up.
+            if( end - pos < 2 ) return BAD_DATA;
+
+            x += *pos++;
+            y += *pos++;
+        }
+        else
+        {
+            // Absolute mode: value literal indices, padded to an even
+            // number of bytes.
+            const size_t literal_bytes = value + ( value & 1 );
+            if( static_cast<size_t>( end - pos ) < literal_bytes ) return BAD_DATA;
 
-            curr_row_size = 0;
+            if( x < width )
+            {
+                std::copy( pos, pos + std::min<size_t>( value, width - x ), indices.begin() + y * width + x );
+            }
+            x   += value;
+            pos += literal_bytes;
         }
+    }
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum BmpDecoder::toPixels( const BmpData& data,
+                             Color256* pixels )
+{
+    if( data.format_ == BmpPixelFormat::UNSUPPORTED ) return BAD_DATA;
+
+    // Index formats look up a full table, so out of range indices come
+    // out black instead of reading past the palette.
+    std::array<Color256, 256> palette;
+    std::copy( data.palette_.begin(), data.palette_.begin() + std::min<size_t>( 256, data.palette_.size() ), palette.begin() );
+
+    // RLE8 has to be expanded in one pass before anything else.
+    std::vector<UByte> indices;
+    const UByte*       rows       = data.bodyData();
+    ptrdiff_t          row_stride = static_cast<ptrdiff_t>( data.row_stride_ );
+
+    if( data.format_ == BmpPixelFormat::RLE8 )
+    {
+        MsgNum err = decodeRle8( data, indices );
+        if( err ) return err;
+
+        rows       = indices.data();
+        row_stride = data.width_;
+    }
+
+    // Pixels come out bottom row first, so read top-down files from 
+    // their last row backwards.
+    const size_t num_rows = data.numRows();
+
+    if( data.top_down_ && num_rows > 0 )
+    {
+        rows      += static_cast<ptrdiff_t>( num_rows - 1 ) * row_stride;
+        row_stride = -row_stride;
+    }
+
+    // Convert blocks of rows in parallel. Each block is small enough 
+    // to stay in cache while it is converted.
+    static const size_t kROWS_PER_JOB = 64;
+
+    const size_t num_jobs = ( num_rows + kROWS_PER_JOB - 1 ) / kROWS_PER_JOB;
+
+    ThreadPool::shared().parallelFor( num_jobs, [&]( size_t job )
+    {
+        const size_t first_row  = job * kROWS_PER_JOB;
+        const size_t block_rows = std::min( kROWS_PER_JOB, num_rows - first_row );
+        const UByte* block      = rows + static_cast<ptrdiff_t>( first_row ) * row_stride;
+        Color256*    out        = pixels + first_row * data.width_;
 
-        // We have to check bounds again as we might seek past the 
-        // end of the data after the padding adjustment.
-        if( i + 2 < raw_data_.size() )
+        switch( data.format_ )
         {
-            bmp_data_.pixels_.push_back( Color256( raw_data_[i + 2],
-                                                   raw_data_[i + 1],
-                                                   raw_data_[i] ) );
+        case BmpPixelFormat::BGR24:
+            rowsToPixels( block, row_stride, data.width_, block_rows, out );
+            break;
+
+        case BmpPixelFormat::BGRA32:
+            bgraRowsToPixels( block, row_stride, data.width_, block_rows, out );
+            break;
+
+        default:
+            indexRowsToPixels( block, row_stride, data.width_, block_rows, palette.data(), out );
+            break;
         }
+    } );
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum BmpDecoder::materializePixels( BmpData& data )
+{
+    const size_t num_pixels = data.numRows() * data.width_;
+
+    if( data.pixels_.size() == num_pixels ) return STATUS_OKAY;
+
+    data.pixels_.resize( num_pixels );
+
+    MsgNum err = toPixels( data, data.pixels_.data() );
+    if( err ) data.pixels_.clear();
 
-        curr_row_size += 3;
+    return err;
+}
+
+//========================================================================
+//
+MsgNum BmpDecoder::storeMetaData( size_t& pos )
+{
+    MsgNum err = parseHeader( raw_data_, raw_size_, bmp_data_ );
+    if( err ) return printMsg( err );
+
+    if( bmp_data_.offset_to_data_ > raw_size_ ) return printMsg( BAD_DATA );
+
+    pos = bmp_data_.offset_to_data_;
+
+    // The header and data blocks are left where they are, for 
+    // compressing or converting to pixels later.
+    bmp_data_.header_view_      = raw_data_;
+    bmp_data_.header_view_size_ = pos;
+
+    // Add zero byte padding in the case that the file size is slightly 
+    // less than what we are given..? Not sure how this happens but this
+    // seems to provide a solution.. The padded body cannot be a view.
+    if( bmp_data_.file_size_ > raw_size_ )
+    {
+        bmp_data_.body_.assign( raw_data_ + pos, raw_data_ + raw_size_ );
+        bmp_data_.body_.resize( bmp_data_.body_.size() + ( bmp_data_.file_size_ - raw_size_ ), 0 );
+    }
+    else
+    {
+        bmp_data_.body_view_      = raw_data_ + pos;
+        bmp_data_.body_view_size_ = raw_size_ - pos;
     }
 
     return STATUS_OKAY;
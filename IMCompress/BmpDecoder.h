@@ -18,11 +18,39 @@
 #include "Errors.h"
 #include "Vertex.h"
 
-#include <windows.h>
 #include <vector>
+#include <algorithm>
+
+//========================================================================
+// Layout of the pixels within a row of pixel data.
+enum class BmpPixelFormat : UByte
+{
+    // Anything the decoder cannot turn into pixels. The raw data can
+    // still be stored and compressed losslessly.
+    UNSUPPORTED = 0,
+
+    // 3 bytes per pixel, blue first.
+    BGR24       = 1,
+
+    // 4 bytes per pixel, blue first and alpha last. Either BI_RGB, or
+    // BI_BITFIELDS with exactly those masks.
+    BGRA32      = 2,
+
+    // 1 byte per pixel, indexing the palette.
+    PAL8        = 3,
+
+    // Palette indices, run length coded with BI_RLE8. The body is not 
+    // made of rows.
+    RLE8        = 4
+};
 
 //========================================================================
 // Container for extracted image data.
+//
+// The raw header and pixel data are views. After BmpDecoder::decode()
+// they point into the buffer the decoder was given, which must outlive
+// the data. Coders that produce an image instead fill header_ and 
+// body_, and the views then read from those.
 struct BmpData
 {
     uint32_t width_;
@@ -32,11 +60,49 @@ struct BmpData
     uint16_t bits_per_pixel_;
     uint32_t offset_to_data_;
 
+    BmpPixelFormat format_     = BmpPixelFormat::UNSUPPORTED;
+    uint32_t       compression_ = 0;
+    size_t         row_stride_ = 0;
+
+    // Rows are stored top row first, marked by a negative height in
+    // the header. height_ is always positive.
+    bool           top_down_   = false;
+
+    // Colour table of PAL8 and RLE8 images.
+    std::vector<Color256> palette_;
+
+    // RGB pixels, bottom row first as in a standard .bmp, whatever the
+    // row order of the file. Left empty until 
+    // BmpDecoder::materializePixels() is called, or filled directly by
+    // coders that decode to pixels.
     std::vector<Color256> pixels_;
 
-    // For compressing, save the unmodified header and data blocks seperately.
+    // Owned header and pixel data, used when the views are not set.
     std::vector<UByte> header_;
     std::vector<UByte> body_;
+
+    // Views into the decoder's source buffer, or null.
+    const UByte* header_view_      = nullptr;
+    size_t       header_view_size_ = 0;
+    const UByte* body_view_        = nullptr;
+    size_t       body_view_size_   = 0;
+
+    const UByte* headerData() const { return header_view_ ? header_view_ : header_.data(); }
+    size_t       headerSize() const { return header_view_ ? header_view_size_ : header_.size(); }
+    const UByte* bodyData() const   { return body_view_ ? body_view_ : body_.data(); }
+    size_t       bodySize() const   { return body_view_ ? body_view_size_ : body_.size(); }
+
+    // Rows of pixel data that are complete within the body. An RLE8
+    // body always decodes to the full height.
+    size_t numRows() const
+    {
+        if( format_ == BmpPixelFormat::RLE8 ) return height_;
+
+        return row_stride_ == 0 ? 0 : std::min<size_t>( height_, bodySize() / row_stride_ );
+    }
+
+    // Start of row y of the pixel data, in file order.
+    const UByte* row( size_t y ) const { return bodyData() + y * row_stride_; }
 };
 
 //========================================================================
@@ -45,6 +111,11 @@ class BmpDecoder
 {
 public:
 
+    //--------------------------------------------------------------
+    // The raw data is read in place, e.g. from a FileSource, and must
+    // outlive the decoder.
+    BmpDecoder( const UByte* raw_data, size_t size );
+
     //--------------------------------------------------------------
     //
     BmpDecoder( const std::vector<Byte>& raw_data );
@@ -54,7 +125,8 @@ public:
     ~BmpDecoder();
 
     //--------------------------------------------------------------
-    // Decode and internally store the supplied data.
+    // Parses the header and points the data's views at the source
+    // buffer. Nothing is copied; see materializePixels().
     MsgNum decode();
 
     //--------------------------------------------------------------
@@ -68,6 +140,65 @@ public:
     // called more than once.
     BmpData releaseData();
 
+    //--------------------------------------------------------------
+    // Reads the image dimensions and format fields of a raw .bmp
+    // header into data, and derives its pixel format, row stride and
+    // palette. The header must hold at least 54 bytes, and the palette
+    // is read only if size reaches the pixel data.
+    static MsgNum parseHeader( const UByte* header, 
+                               size_t size,
+                               BmpData& data );
+
+    //--------------------------------------------------------------
+    // Converts the complete rows of the pixel data to RGB, writing
+    // data.numRows() * data.width_ pixels to storage supplied by the
+    // caller.
+    static MsgNum toPixels( const BmpData& data,
+                            Color256* pixels );
+
+    //--------------------------------------------------------------
+    // Fills data.pixels_ from the pixel data, if not already done.
+    static MsgNum materializePixels( BmpData& data );
+
+    //--------------------------------------------------------------
+    // Number of bytes per row of pixel data, including the padding
+    // that rounds each row up to a multiple of four bytes.
+    static size_t rowStride( const BmpData& data );
+
+    //--------------------------------------------------------------
+    // Converts num_rows rows of 24-bit BGR pixel data, row_stride
+    // bytes apart, to width RGB pixels per row. A negative stride 
+    // walks the rows backwards.
+    static void rowsToPixels( const UByte* rows,
+                              ptrdiff_t row_stride,
+                              uint32_t width,
+                              size_t num_rows,
+                              Color256* pixels );
+
+    //--------------------------------------------------------------
+    // As rowsToPixels(), for 32-bit BGRA rows. Alpha is dropped.
+    static void bgraRowsToPixels( const UByte* rows,
+                                  ptrdiff_t row_stride,
+                                  uint32_t width,
+                                  size_t num_rows,
+                                  Color256* pixels );
+
+    //--------------------------------------------------------------
+    // As rowsToPixels(), for rows of 8-bit indices into a full 256 
+    // entry palette.
+    static void indexRowsToPixels( const UByte* rows,
+                                   ptrdiff_t row_stride,
+                                   uint32_t width,
+                                   size_t num_rows,
+                                   const Color256* palette,
+                                   Color256* pixels );
+
+    //--------------------------------------------------------------
+    // Expands a BI_RLE8 body into height_ rows of width_ indices, 
+    // bottom row first. Pixels the body skips are left as index 0.
+    static MsgNum decodeRle8( const BmpData& data,
+                              std::vector<UByte>& indices );
+
 
 private:
 
@@ -80,18 +211,13 @@ private:
     // Converts numBytes bytes in a byte array to a 32-bit signed 
     // int starting at index pos. Little endian intepretation.
     // Updates pos to next position after the final read byte.
-    uint32_t bytesToUInt32LE( Uint& pos,
+    uint32_t bytesToUInt32LE( size_t& pos,
                               Uint numBytes ) const;
 
     //--------------------------------------------------------------
-    // Extracts the header data from the byte array. Updates pos to 
-    // next position in the raw data.
-    MsgNum storeMetaData( Uint& pos );
-
-    //--------------------------------------------------------------
-    // Extracts the image data from the byte array. Updates pos to 
-    // next position in the raw data.
-    MsgNum storePixelData( Uint& pos );
+    // Extracts the header data from the byte array and sets up the
+    // views of it. Updates pos to next position in the raw data.
+    MsgNum storeMetaData( size_t& pos );
 
 
     //==============================================================
@@ -99,5 +225,6 @@ private:
     //==============================================================
 
     BmpData                     bmp_data_;
-    const std::vector<Byte>&    raw_data_;
+    const UByte*                raw_data_;
+    size_t                      raw_size_;
 };
@@ -0,0 +1,205 @@
+#include "stdafx.h"
+#include "BmpRowReader.h"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+//========================================================================
+//
+BmpRowReader::BmpRowReader()
+    : fd_( -1 )
+    , owns_fd_( false )
+    , body_size_( 0 )
+    , num_rows_( 0 )
+{
+
+}
+
+//========================================================================
+//
+BmpRowReader::~BmpRowReader()
+{
+    close();
+}
+
+//========================================================================
+//
+MsgNum BmpRowReader::open( const std::string& file_path )
+{
+#ifdef _WIN32
+    const int fd = _open( file_path.c_str(), _O_RDONLY | _O_BINARY | _O_SEQUENTIAL );
+#else
+    const int fd = ::open( file_path.c_str(), O_RDONLY );
+#endif
+    if( fd < 0 ) return printMsg( FAILURE_READING_FILE );
+
+    return open( fd, true );
+}
+
+//========================================================================
+//
+MsgNum BmpRowReader::open( int fd, bool owns_fd )
+{
+    close();
+
+    fd_      = fd;
+    owns_fd_ = owns_fd;
+
+#ifdef _WIN32
+    struct _stat64 file_stat;
+    if( _fstat64( fd_, &file_stat ) != 0 ) return printMsg( FAILURE_READING_FILE );
+#else
+    struct stat file_stat;
+    if( fstat( fd_, &file_stat ) != 0 ) return printMsg( FAILURE_READING_FILE );
+#endif
+
+    const uint64_t file_size = static_cast<uint64_t>( file_stat.st_size );
+
+    // Read the fixed part of the header to find out how long the whole
+    // header is, then read it again with the colour table.
+    if( file_size < 54 ) return printMsg( BAD_DATA );
+
+    bmp_data_ = BmpData();
+    bmp_data_.header_.resize( 54 );
+
+    MsgNum err = readAt( 0, 54, bmp_data_.header_.data() );
+    if( err ) return err;
+
+    err = BmpDecoder::parseHeader( bmp_data_.header_.data(), 54, bmp_data_ );
+    if( err ) return printMsg( err );
+
+    const uint64_t offset = bmp_data_.offset_to_data_;
+    if( offset < 54 || offset > file_size ) return printMsg( BAD_DATA );
+
+    bmp_data_.header_.resize( static_cast<size_t>( offset ) );
+
+    err = readAt( 0, bmp_data_.header_.size(), bmp_data_.header_.data() );
+    if( err ) return err;
+
+    err = BmpDecoder::parseHeader( bmp_data_.header_.data(), bmp_data_.header_.size(), bmp_data_ );
+    if( err ) return printMsg( err );
+
+    body_size_ = file_size - offset;
+    num_rows_  = 0;
+
+    const bool has_rows = bmp_data_.format_ != BmpPixelFormat::RLE8 && bmp_data_.row_stride_ > 0;
+    if( has_rows )
+    {
+        num_rows_ = static_cast<size_t>( std::min<uint64_t>( bmp_data_.height_, body_size_ / bmp_data_.row_stride_ ) );
+    }
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+void BmpRowReader::close()
+{
+    if( fd_ >= 0 && owns_fd_ )
+    {
+#ifdef _WIN32
+        _close( fd_ );
+#else
+        ::close( fd_ );
+#endif
+    }
+
+    fd_         = -1;
+    owns_fd_    = false;
+    bmp_data_   = BmpData();
+    body_size_  = 0;
+    num_rows_   = 0;
+}
+
+//========================================================================
+//
+MsgNum BmpRowReader::readBody( uint64_t offset,
+                               size_t size,
+                               UByte* out )
+{
+    if( offset > body_size_ || size > body_size_ - offset ) return printMsg( BMP_DATA_OUT_RANGE );
+
+    return readAt( bmp_data_.offset_to_data_ + offset, size, out );
+}
+
+//========================================================================
+//
+MsgNum BmpRowReader::readRows( size_t first_row,
+                               size_t num_rows,
+                               UByte* rows )
+{
+    if( first_row > num_rows_ || num_rows > num_rows_ - first_row ) return printMsg( BMP_DATA_OUT_RANGE );
+
+    const uint64_t stride = bmp_data_.row_stride_;
+
+    return readAt( bmp_data_.offset_to_data_ + first_row * stride, static_cast<size_t>( num_rows * stride ), rows );
+}
+
+//========================================================================
+//
+MsgNum BmpRowReader::readImageRows( size_t first_row,
+                                    size_t num_rows,
+                                    UByte* rows )
+{
+    if( bmp_data_.top_down_ ) return readRows( first_row, num_rows, rows );
+
+    // Image row y is file row height - 1 - y, so the band is one block
+    // of file rows in the opposite order.
+    const size_t height = bmp_data_.height_;
+    if( first_row > height || num_rows > height - first_row ) return printMsg( BMP_DATA_OUT_RANGE );
+
+    MsgNum err = readRows( height - first_row - num_rows, num_rows, rows );
+    if( err ) return err;
+
+    const size_t stride = bmp_data_.row_stride_;
+
+    for( size_t y = 0; y < num_rows / 2; ++y )
+    {
+        UByte* top    = rows + y * stride;
+        UByte* bottom = rows + ( num_rows - 1 - y ) * stride;
+
+        std::swap_ranges( top, top + stride, bottom );
+    }
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum BmpRowReader::readAt( uint64_t offset,
+                             size_t size,
+                             UByte* out )
+{
+    if( fd_ < 0 ) return printMsg( FAILURE_READING_FILE );
+
+#ifdef _WIN32
+    if( _lseeki64( fd_, static_cast<__int64>( offset ), SEEK_SET ) < 0 ) return printMsg( FAILURE_READING_FILE );
+#endif
+
+    // Reads may come back short, so keep going until everything is in.
+    while( size > 0 )
+    {
+        const size_t chunk = std::min<size_t>( size, 1 << 30 );
+
+#ifdef _WIN32
+        const int got = _read( fd_, out, static_cast<unsigned int>( chunk ) );
+#else
+        const ssize_t got = pread( fd_, out, chunk, static_cast<off_t>( offset ) );
+#endif
+        if( got <= 0 ) return printMsg( FAILURE_READING_FILE );
+
+        out    += got;
+        offset += static_cast<uint64_t>( got );
+        size   -= static_cast<size_t>( got );
+    }
+
+    return STATUS_OKAY;
+}
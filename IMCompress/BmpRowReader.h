@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Util.h"
+#include "Errors.h"
+#include "BmpDecoder.h"
+
+#include <string>
+#include <vector>
+
+//========================================================================
+// Reads a .bmp file a band of rows at a time, straight from a file
+// descriptor, so that encoders can work through images far larger than
+// memory. Only the header is kept; rows are read on request at their
+// offset in the file, in any order.
+class BmpRowReader
+{
+public:
+
+    //--------------------------------------------------------------
+    //
+    BmpRowReader();
+
+    //--------------------------------------------------------------
+    //
+    ~BmpRowReader();
+
+    //--------------------------------------------------------------
+    // Opens the file at file_path and parses its header, replacing any
+    // file already open.
+    MsgNum open( const std::string& file_path );
+
+    //--------------------------------------------------------------
+    // As above, reading from a descriptor the caller opened. The file
+    // must be seekable. The reader closes fd if owns_fd is set.
+    MsgNum open( int fd, bool owns_fd );
+
+    //--------------------------------------------------------------
+    // Called by the destructor.
+    void close();
+
+    //--------------------------------------------------------------
+    // The parsed header. header_ holds the raw header; the pixel data
+    // is left empty.
+    const BmpData& getData() const { return bmp_data_; }
+
+    //--------------------------------------------------------------
+    // Bytes of pixel data in the file, from the data offset to the end.
+    uint64_t bodySize() const { return body_size_; }
+
+    //--------------------------------------------------------------
+    // Rows that are complete within the file. Zero for formats that
+    // are not made of rows, such as RLE8.
+    size_t numRows() const { return num_rows_; }
+
+    //--------------------------------------------------------------
+    // Reads size bytes of the pixel data, starting offset bytes in.
+    MsgNum readBody( uint64_t offset,
+                     size_t size,
+                     UByte* out );
+
+    //--------------------------------------------------------------
+    // Reads num_rows rows in file order, starting at row first_row,
+    // each including its padding.
+    MsgNum readRows( size_t first_row,
+                     size_t num_rows,
+                     UByte* rows );
+
+    //--------------------------------------------------------------
+    // As readRows(), in image order: row 0 is the top of the image
+    // whether the file is stored top-down or bottom-up. A bottom-up
+    // band is read as one block from further back in the file, then
+    // its rows are reversed in place.
+    MsgNum readImageRows( size_t first_row,
+                          size_t num_rows,
+                          UByte* rows );
+
+private:
+
+    //--------------------------------------------------------------
+    // The descriptor cannot be shared.
+    BmpRowReader( const BmpRowReader& ) = delete;
+    BmpRowReader& operator=( const BmpRowReader& ) = delete;
+
+    //--------------------------------------------------------------
+    // Reads size bytes at an absolute offset in the file.
+    MsgNum readAt( uint64_t offset,
+                   size_t size,
+                   UByte* out );
+
+    int       fd_;
+    bool      owns_fd_;
+    BmpData   bmp_data_;
+    uint64_t  body_size_;
+    size_t    num_rows_;
+};
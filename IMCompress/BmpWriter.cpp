@@ -0,0 +1,84 @@
+#include "stdafx.h"
+#include "BmpWriter.h"
+
+//========================================================================
+// Sizes of the file header and of the BITMAPINFOHEADER after it.
+static const uint32_t kFILE_HEADER_SIZE = 14;
+static const uint32_t kINFO_HEADER_SIZE = 40;
+
+//========================================================================
+// 72 DPI, in pixels per metre.
+static const uint32_t kPIXELS_PER_METRE = 2835;
+
+//========================================================================
+//
+MsgNum BmpWriter::write( const BmpData& data,
+                         OutputSink& sink )
+{
+    if( data.headerSize() > 0 && data.bodySize() > 0 )
+    {
+        MsgNum err = sink.write( data.headerData(), data.headerSize() );
+        if( err ) return err;
+
+        return sink.write( data.bodyData(), data.bodySize() );
+    }
+
+    const size_t num_pixels = static_cast<size_t>( data.width_ ) * data.height_;
+
+    if( num_pixels == 0 || data.pixels_.size() != num_pixels ) return printMsg( BAD_DATA );
+
+    // Rows are padded to a multiple of four bytes.
+    const uint64_t row_stride = ( static_cast<uint64_t>( data.width_ ) * 3 + 3 ) & ~static_cast<uint64_t>( 3 );
+    const uint64_t body_size  = row_stride * data.height_;
+    const uint32_t offset     = kFILE_HEADER_SIZE + kINFO_HEADER_SIZE;
+
+    if( body_size + offset > 0xffffffff || data.width_ > 0x7fffffff || data.height_ > 0x7fffffff )
+    {
+        return printMsg( BAD_DATA );
+    }
+
+    std::vector<UByte> header;
+    header.reserve( offset );
+
+    header.push_back( 'B' );
+    header.push_back( 'M' );
+    util::appendLittleEndian( header, body_size + offset, 4 );
+    util::appendLittleEndian( header, 0, 4 );
+    util::appendLittleEndian( header, offset, 4 );
+
+    util::appendLittleEndian( header, kINFO_HEADER_SIZE, 4 );
+    util::appendLittleEndian( header, data.width_, 4 );
+    util::appendLittleEndian( header, data.height_, 4 );
+    util::appendLittleEndian( header, 1, 2 );
+    util::appendLittleEndian( header, 24, 2 );
+    util::appendLittleEndian( header, 0, 4 );
+    util::appendLittleEndian( header, body_size, 4 );
+    util::appendLittleEndian( header, kPIXELS_PER_METRE, 4 );
+    util::appendLittleEndian( header, kPIXELS_PER_METRE, 4 );
+    util::appendLittleEndian( header, 0, 4 );
+    util::appendLittleEndian( header, 0, 4 );
+
+    MsgNum err = sink.write( header.data(), header.size() );
+    if( err ) return err;
+
+    sink.reserve( static_cast<size_t>( body_size ) );
+
+    std::vector<UByte> row( static_cast<size_t>( row_stride ), 0 );
+
+    for( uint32_t y = 0; y < data.height_; ++y )
+    {
+        const Color256* src = data.pixels_.data() + static_cast<size_t>( y ) * data.width_;
+
+        for( uint32_t x = 0; x < data.width_; ++x )
+        {
+            row[x * 3]     = src[x].b;
+            row[x * 3 + 1] = src[x].g;
+            row[x * 3 + 2] = src[x].r;
+        }
+
+        err = sink.write( row.data(), row.size() );
+        if( err ) return err;
+    }
+
+    return STATUS_OKAY;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Util.h"
+#include "Errors.h"
+#include "BmpDecoder.h"
+#include "OutputSink.h"
+
+//========================================================================
+// Writes decoded images back out as .bmp files, the inverse of 
+// BmpDecoder.
+class BmpWriter
+{
+public:
+
+    //--------------------------------------------------------------
+    // Writes the raw header and pixel data if data has them, as after
+    // IN3Coder::decode(), so the original file comes back byte for 
+    // byte. Otherwise pixels_ is written as a 24-bit image, bottom row
+    // first.
+    static MsgNum write( const BmpData& data,
+                         OutputSink& sink );
+
+private:
+
+    //--------------------------------------------------------------
+    //
+    BmpWriter() = delete;
+};
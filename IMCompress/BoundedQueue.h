@@ -0,0 +1,85 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+//========================================================================
+// Queue between two pipeline stages, holding at most capacity items.
+// Producers block while it is full and consumers while it is empty, so
+// a fast stage can run ahead of a slow one only by that many items.
+template<typename T>
+class BoundedQueue
+{
+public:
+
+    //--------------------------------------------------------------
+    //
+    explicit BoundedQueue( size_t capacity )
+        : capacity_( capacity == 0 ? 1 : capacity )
+        , closed_( false )
+    { }
+
+    //--------------------------------------------------------------
+    // Waits for room, then adds item. Returns false, dropping the
+    // item, if the queue has been closed.
+    bool push( T item )
+    {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        not_full_.wait( lock, [this]() { return closed_ || items_.size() < capacity_; } );
+
+        if( closed_ ) return false;
+
+        items_.push_back( std::move( item ) );
+        lock.unlock();
+
+        not_empty_.notify_one();
+        return true;
+    }
+
+    //--------------------------------------------------------------
+    // Waits for an item and takes it. Returns false once the queue is
+    // closed and everything in it has been taken.
+    bool pop( T& item )
+    {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        not_empty_.wait( lock, [this]() { return closed_ || !items_.empty(); } );
+
+        if( items_.empty() ) return false;
+
+        item = std::move( items_.front() );
+        items_.pop_front();
+        lock.unlock();
+
+        not_full_.notify_one();
+        return true;
+    }
+
+    //--------------------------------------------------------------
+    // No more items will be pushed. Waiting consumers drain what is
+    // left; waiting producers give up.
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            closed_ = true;
+        }
+
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+
+    //--------------------------------------------------------------
+    //
+    BoundedQueue( const BoundedQueue& ) = delete;
+    BoundedQueue& operator=( const BoundedQueue& ) = delete;
+
+    std::deque<T>           items_;
+    size_t                  capacity_;
+    bool                    closed_;
+    std::mutex              mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
@@ -0,0 +1,153 @@
+#include "stdafx.h"
+#include "Checksum.h"
+
+#include <array>
+#include <cstring>
+
+//--------------------------------------------------------------
+// The crc32 instruction comes with SSE4.2. It is compiled in for any
+// x86 target and only used after checking the CPU at run time.
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#define IMC_HAVE_CRC32C_HW 1
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define IMC_TARGET_SSE42
+#else
+#define IMC_TARGET_SSE42 __attribute__( ( target( "sse4.2" ) ) )
+#endif
+#endif
+
+//========================================================================
+// Reflected CRC-32C polynomial.
+static const uint32_t kCRC32C_POLY = 0x82f63b78;
+
+//========================================================================
+// Byte-at-a-time lookup table, built on first use.
+static const std::array<uint32_t, 256>& crcTable()
+{
+    static const std::array<uint32_t, 256> table = []()
+    {
+        std::array<uint32_t, 256> t;
+
+        for( uint32_t b = 0; b < 256; ++b )
+        {
+            uint32_t crc = b;
+
+            for( int k = 0; k < 8; ++k )
+            {
+                crc = ( crc >> 1 ) ^ ( ( crc & 1 ) ? kCRC32C_POLY : 0 );
+            }
+
+            t[b] = crc;
+        }
+
+        return t;
+    }();
+
+    return table;
+}
+
+//========================================================================
+// Table driven fallback. Takes and returns the inverted CRC. dst may
+// be null, in which case nothing is copied.
+static uint32_t crc32cSoftware( UByte* dst, const UByte* src, size_t size, uint32_t crc )
+{
+    const auto& table = crcTable();
+
+    for( size_t i = 0; i < size; ++i )
+    {
+        crc = table[( crc ^ src[i] ) & 0xff] ^ ( crc >> 8 );
+    }
+
+    if( dst != nullptr ) std::memcpy( dst, src, size );
+
+    return crc;
+}
+
+#ifdef IMC_HAVE_CRC32C_HW
+
+//========================================================================
+//
+static bool hasHardwareCrc()
+{
+    static const bool has_sse42 = []()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid( info, 1 );
+        return ( info[2] & ( 1 << 20 ) ) != 0;
+#else
+        return __builtin_cpu_supports( "sse4.2" ) != 0;
+#endif
+    }();
+
+    return has_sse42;
+}
+
+//========================================================================
+// As crc32cSoftware(), eight bytes per instruction on x64 and four on 
+// x86. The copy rides along with the loads.
+IMC_TARGET_SSE42
+static uint32_t crc32cHardware( UByte* dst, const UByte* src, size_t size, uint32_t crc )
+{
+    size_t i = 0;
+
+#if defined( _M_X64 ) || defined( __x86_64__ )
+    uint64_t crc64 = crc;
+
+    for( ; i + 8 <= size; i += 8 )
+    {
+        uint64_t word;
+        std::memcpy( &word, src + i, 8 );
+        if( dst != nullptr ) std::memcpy( dst + i, &word, 8 );
+
+        crc64 = _mm_crc32_u64( crc64, word );
+    }
+
+    crc = static_cast<uint32_t>( crc64 );
+#else
+    for( ; i + 4 <= size; i += 4 )
+    {
+        uint32_t word;
+        std::memcpy( &word, src + i, 4 );
+        if( dst != nullptr ) std::memcpy( dst + i, &word, 4 );
+
+        crc = _mm_crc32_u32( crc, word );
+    }
+#endif
+
+    for( ; i < size; ++i )
+    {
+        if( dst != nullptr ) dst[i] = src[i];
+
+        crc = _mm_crc32_u8( crc, src[i] );
+    }
+
+    return crc;
+}
+
+#endif
+
+//========================================================================
+//
+uint32_t util::crc32c( const UByte* data, 
+                       size_t size, 
+                       uint32_t crc )
+{
+    return copyCrc32c( nullptr, data, size, crc );
+}
+
+//========================================================================
+//
+uint32_t util::copyCrc32c( UByte* dst,
+                           const UByte* src, 
+                           size_t size, 
+                           uint32_t crc )
+{
+#ifdef IMC_HAVE_CRC32C_HW
+    if( hasHardwareCrc() ) return ~crc32cHardware( dst, src, size, ~crc );
+#endif
+
+    return ~crc32cSoftware( dst, src, size, ~crc );
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Util.h"
+
+namespace util
+{
+//--------------------------------------------------------------
+// CRC-32C (Castagnoli) of size bytes at data. Pass the result of a
+// previous call as crc to continue a checksum over several pieces.
+// Uses the SSE4.2 crc32 instruction when the CPU has it.
+uint32_t crc32c( const UByte* data, 
+                 size_t size, 
+                 uint32_t crc = 0 );
+
+//--------------------------------------------------------------
+// As crc32c(), also copying the bytes to dst on the way, so that
+// data can be checked as it is written or read without a second 
+// pass over it. dst and src must not overlap.
+uint32_t copyCrc32c( UByte* dst,
+                     const UByte* src, 
+                     size_t size, 
+                     uint32_t crc = 0 );
+};
@@ -0,0 +1,238 @@
+#include "stdafx.h"
+#include "ColourTransform.h"
+#include "Simd.h"
+
+//========================================================================
+// Signed half of a byte, as used by the YCoCg-R lifting steps.
+static inline UByte halfOf( UByte v )
+{
+    return static_cast<UByte>( static_cast<int8_t>( v ) >> 1 );
+}
+
+//========================================================================
+//
+void util::splitChannels( const UByte* interleaved, 
+                          size_t num_pixels,
+                          UByte* c0, 
+                          UByte* c1, 
+                          UByte* c2 )
+{
+    size_t p = 0;
+
+#ifdef IMC_HAVE_SSE2
+    for( ; p + 16 <= num_pixels; p += 16 )
+    {
+        __m128i v0, v1, v2;
+        simd::deinterleave3( interleaved + p * 3, v0, v1, v2 );
+
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( c0 + p ), v0 );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( c1 + p ), v1 );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( c2 + p ), v2 );
+    }
+#endif
+
+    for( ; p < num_pixels; ++p )
+    {
+        c0[p] = interleaved[p * 3];
+        c1[p] = interleaved[p * 3 + 1];
+        c2[p] = interleaved[p * 3 + 2];
+    }
+}
+
+//========================================================================
+//
+void util::mergeChannels( const UByte* c0, 
+                          const UByte* c1, 
+                          const UByte* c2,
+                          size_t num_pixels,
+                          UByte* interleaved )
+{
+    size_t p = 0;
+
+#ifdef IMC_HAVE_SSE2
+    for( ; p + 16 <= num_pixels; p += 16 )
+    {
+        simd::interleave3( interleaved + p * 3,
+                           _mm_loadu_si128( reinterpret_cast<const __m128i*>( c0 + p ) ),
+                           _mm_loadu_si128( reinterpret_cast<const __m128i*>( c1 + p ) ),
+                           _mm_loadu_si128( reinterpret_cast<const __m128i*>( c2 + p ) ) );
+    }
+#endif
+
+    for( ; p < num_pixels; ++p )
+    {
+        interleaved[p * 3]     = c0[p];
+        interleaved[p * 3 + 1] = c1[p];
+        interleaved[p * 3 + 2] = c2[p];
+    }
+}
+
+//========================================================================
+//
+void util::splitChannels4( const UByte* interleaved, 
+                           size_t num_pixels,
+                           UByte* c0, 
+                           UByte* c1, 
+                           UByte* c2,
+                           UByte* c3 )
+{
+    size_t p = 0;
+
+#ifdef IMC_HAVE_SSE2
+    // Each 32-bit lane holds one pixel, so every channel can be masked
+    // out of its lane and the lanes packed down to bytes.
+    const __m128i low_byte = _mm_set1_epi32( 0xff );
+
+    auto packLanes = []( __m128i a, __m128i b, __m128i c, __m128i d )
+    {
+        return _mm_packus_epi16( _mm_packs_epi32( a, b ), _mm_packs_epi32( c, d ) );
+    };
+
+    for( ; p + 16 <= num_pixels; p += 16 )
+    {
+        const __m128i* src = reinterpret_cast<const __m128i*>( interleaved + p * 4 );
+
+        const __m128i v0 = _mm_loadu_si128( src );
+        const __m128i v1 = _mm_loadu_si128( src + 1 );
+        const __m128i v2 = _mm_loadu_si128( src + 2 );
+        const __m128i v3 = _mm_loadu_si128( src + 3 );
+
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( c0 + p ),
+                          packLanes( _mm_and_si128( v0, low_byte ), _mm_and_si128( v1, low_byte ),
+                                     _mm_and_si128( v2, low_byte ), _mm_and_si128( v3, low_byte ) ) );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( c1 + p ),
+                          packLanes( _mm_and_si128( _mm_srli_epi32( v0, 8 ), low_byte ), _mm_and_si128( _mm_srli_epi32( v1, 8 ), low_byte ),
+                                     _mm_and_si128( _mm_srli_epi32( v2, 8 ), low_byte ), _mm_and_si128( _mm_srli_epi32( v3, 8 ), low_byte ) ) );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( c2 + p ),
+                          packLanes( _mm_and_si128( _mm_srli_epi32( v0, 16 ), low_byte ), _mm_and_si128( _mm_srli_epi32( v1, 16 ), low_byte ),
+                                     _mm_and_si128( _mm_srli_epi32( v2, 16 ), low_byte ), _mm_and_si128( _mm_srli_epi32( v3, 16 ), low_byte ) ) );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( c3 + p ),
+                          packLanes( _mm_srli_epi32( v0, 24 ), _mm_srli_epi32( v1, 24 ),
+                                     _mm_srli_epi32( v2, 24 ), _mm_srli_epi32( v3, 24 ) ) );
+    }
+#endif
+
+    for( ; p < num_pixels; ++p )
+    {
+        c0[p] = interleaved[p * 4];
+        c1[p] = interleaved[p * 4 + 1];
+        c2[p] = interleaved[p * 4 + 2];
+        c3[p] = interleaved[p * 4 + 3];
+    }
+}
+
+//========================================================================
+//
+void util::mergeChannels4( const UByte* c0, 
+                           const UByte* c1, 
+                           const UByte* c2,
+                           const UByte* c3,
+                           size_t num_pixels,
+                           UByte* interleaved )
+{
+    size_t p = 0;
+
+#ifdef IMC_HAVE_SSE2
+    for( ; p + 16 <= num_pixels; p += 16 )
+    {
+        const __m128i v0 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( c0 + p ) );
+        const __m128i v1 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( c1 + p ) );
+        const __m128i v2 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( c2 + p ) );
+        const __m128i v3 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( c3 + p ) );
+
+        // Pair up channels 0, 1 and 2, 3, then the pairs into pixels.
+        const __m128i lo01 = _mm_unpacklo_epi8( v0, v1 );
+        const __m128i hi01 = _mm_unpackhi_epi8( v0, v1 );
+        const __m128i lo23 = _mm_unpacklo_epi8( v2, v3 );
+        const __m128i hi23 = _mm_unpackhi_epi8( v2, v3 );
+
+        __m128i* dst = reinterpret_cast<__m128i*>( interleaved + p * 4 );
+
+        _mm_storeu_si128( dst,     _mm_unpacklo_epi16( lo01, lo23 ) );
+        _mm_storeu_si128( dst + 1, _mm_unpackhi_epi16( lo01, lo23 ) );
+        _mm_storeu_si128( dst + 2, _mm_unpacklo_epi16( hi01, hi23 ) );
+        _mm_storeu_si128( dst + 3, _mm_unpackhi_epi16( hi01, hi23 ) );
+    }
+#endif
+
+    for( ; p < num_pixels; ++p )
+    {
+        interleaved[p * 4]     = c0[p];
+        interleaved[p * 4 + 1] = c1[p];
+        interleaved[p * 4 + 2] = c2[p];
+        interleaved[p * 4 + 3] = c3[p];
+    }
+}
+
+//========================================================================
+//
+void util::forwardYCoCgR( UByte* b, UByte* g, UByte* r, size_t num_pixels )
+{
+    size_t p = 0;
+
+#ifdef IMC_HAVE_SSE2
+    for( ; p + 16 <= num_pixels; p += 16 )
+    {
+        __m128i vb = _mm_loadu_si128( reinterpret_cast<const __m128i*>( b + p ) );
+        __m128i vg = _mm_loadu_si128( reinterpret_cast<const __m128i*>( g + p ) );
+        __m128i vr = _mm_loadu_si128( reinterpret_cast<const __m128i*>( r + p ) );
+
+        __m128i co = _mm_sub_epi8( vr, vb );
+        __m128i t  = _mm_add_epi8( vb, simd::srai8By1( co ) );
+        __m128i cg = _mm_sub_epi8( vg, t );
+        __m128i y  = _mm_add_epi8( t, simd::srai8By1( cg ) );
+
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( b + p ), y );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( g + p ), co );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( r + p ), cg );
+    }
+#endif
+
+    for( ; p < num_pixels; ++p )
+    {
+        const UByte co = r[p] - b[p];
+        const UByte t  = b[p] + halfOf( co );
+        const UByte cg = g[p] - t;
+
+        b[p] = t + halfOf( cg );
+        g[p] = co;
+        r[p] = cg;
+    }
+}
+
+//========================================================================
+//
+void util::inverseYCoCgR( UByte* y, UByte* co, UByte* cg, size_t num_pixels )
+{
+    size_t p = 0;
+
+#ifdef IMC_HAVE_SSE2
+    for( ; p + 16 <= num_pixels; p += 16 )
+    {
+        __m128i vy  = _mm_loadu_si128( reinterpret_cast<const __m128i*>( y + p ) );
+        __m128i vco = _mm_loadu_si128( reinterpret_cast<const __m128i*>( co + p ) );
+        __m128i vcg = _mm_loadu_si128( reinterpret_cast<const __m128i*>( cg + p ) );
+
+        __m128i t  = _mm_sub_epi8( vy, simd::srai8By1( vcg ) );
+        __m128i vg = _mm_add_epi8( vcg, t );
+        __m128i vb = _mm_sub_epi8( t, simd::srai8By1( vco ) );
+        __m128i vr = _mm_add_epi8( vb, vco );
+
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( y + p ), vb );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( co + p ), vg );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( cg + p ), vr );
+    }
+#endif
+
+    for( ; p < num_pixels; ++p )
+    {
+        const UByte t  = y[p] - halfOf( cg[p] );
+        const UByte vg = cg[p] + t;
+        const UByte vb = t - halfOf( co[p] );
+        const UByte vr = vb + co[p];
+
+        y[p]  = vb;
+        co[p] = vg;
+        cg[p] = vr;
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Util.h"
+
+namespace util
+{
+//--------------------------------------------------------------
+// Splits num_pixels interleaved 3-byte pixels into three planes.
+void splitChannels( const UByte* interleaved, 
+                    size_t num_pixels,
+                    UByte* c0, 
+                    UByte* c1, 
+                    UByte* c2 );
+
+//--------------------------------------------------------------
+// Inverse of splitChannels().
+void mergeChannels( const UByte* c0, 
+                    const UByte* c1, 
+                    const UByte* c2,
+                    size_t num_pixels,
+                    UByte* interleaved );
+
+//--------------------------------------------------------------
+// As splitChannels(), for 4-byte pixels.
+void splitChannels4( const UByte* interleaved, 
+                     size_t num_pixels,
+                     UByte* c0, 
+                     UByte* c1, 
+                     UByte* c2,
+                     UByte* c3 );
+
+//--------------------------------------------------------------
+// Inverse of splitChannels4().
+void mergeChannels4( const UByte* c0, 
+                     const UByte* c1, 
+                     const UByte* c2,
+                     const UByte* c3,
+                     size_t num_pixels,
+                     UByte* interleaved );
+
+//--------------------------------------------------------------
+// Integer-reversible YCoCg-R colour transform, computed modulo 256
+// so that every component still fits in a byte. Operates in place
+// on num_pixels pixels held as B, G and R planes, replacing them 
+// with Y, Co and Cg. The inverse restores the exact input bytes.
+void forwardYCoCgR( UByte* b, UByte* g, UByte* r, size_t num_pixels );
+
+//--------------------------------------------------------------
+//
+void inverseYCoCgR( UByte* y, UByte* co, UByte* cg, size_t num_pixels );
+
+};
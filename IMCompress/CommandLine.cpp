@@ -0,0 +1,556 @@
+#include "stdafx.h"
+
+#include "BatchConverter.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+//========================================================================
+// Headless counterpart of main.cpp, for converting files in bulk
+// without a display:
+//
+//   imcompress encode|decode|verify [options] file-or-directory...
+//
+// Directories are searched for the files the action applies to, and
+// their files are converted in parallel through BatchConverter.
+
+//========================================================================
+// Matches the interactive tool.
+static const double kDEFAULT_COMPRESSION_FACTOR = 2.0;
+
+//========================================================================
+//
+#ifdef _WIN32
+static const char kSEPARATOR = '\\';
+#else
+static const char kSEPARATOR = '/';
+#endif
+
+//========================================================================
+//
+struct CommandLineOptions
+{
+    BatchOptions batch_;
+
+    // Outputs go next to their inputs unless this is set. Files found
+    // under a directory keep their place below it.
+    std::string output_dir_;
+
+    // Threads of the shared pool the coders split each file over, 0
+    // being one per hardware thread.
+    size_t num_threads_ = 0;
+
+    bool recursive_ = false;
+    bool force_     = false;
+
+    std::vector<std::string> inputs_;
+};
+
+//========================================================================
+//
+static void printUsage()
+{
+    std::cout <<
+        "Usage: imcompress encode|decode|verify [options] file-or-directory...\n"
+        "\n"
+        "  encode   .bmp to .in3 or .im3, and .wav to .au3 or .am3\n"
+        "  decode   .in3 and .im3 to .bmp, and .au3 and .am3 to .wav\n"
+        "  verify   check coded files decode, and that .bmp and .wav files\n"
+        "           survive a round trip, writing nothing\n"
+        "\n"
+        "Options:\n"
+        "  -o, --output DIR      write outputs under DIR instead of next to\n"
+        "                        their inputs\n"
+        "  -r, --recursive       search directories recursively\n"
+        "  -j, --jobs N          threads to convert with: files converted at\n"
+        "                        once, and threads each file is split over\n"
+        "                        (default: one per hardware thread)\n"
+        "  -l, --lossy           encode to .im3 and .am3 (default: .in3 and .au3)\n"
+        "  -f, --format FMT      in3, im3, au3 or am3, for the images or the\n"
+        "                        audio that FMT applies to\n"
+        "  -q, --quality F       compression factor of .im3 and .am3, higher\n"
+        "                        being smaller (default: 2). .im3 files must\n"
+        "                        be decoded with the factor they were encoded\n"
+        "                        with\n"
+        "      --tile N          .im3 tile size, 0 for none\n"
+        "      --effort E        .in3 effort: fast, default or max\n"
+        "      --ycocg           .in3 colour transform\n"
+        "      --lz77            .in3 LZ77 back end instead of Huffman\n"
+        "      --drop-alpha      do not store .in3 alpha\n"
+        "      --force           overwrite existing outputs\n"
+        "  -h, --help            show this message\n";
+}
+
+//========================================================================
+//
+static bool parseSize( const char* text, size_t& value )
+{
+    char* end = nullptr;
+    const unsigned long long parsed = std::strtoull( text, &end, 10 );
+
+    if( end == text || *end != '\0' || text[0] == '-' ) return false;
+
+    value = static_cast<size_t>( parsed );
+    return true;
+}
+
+//========================================================================
+// Returns false, having said why, if the arguments are not usable.
+static bool parseArguments( int argc,
+                            char** argv,
+                            CommandLineOptions& options )
+{
+    if( argc < 2 ) return false;
+
+    const std::string action = argv[1];
+
+    if( action == "encode" )      options.batch_.action_ = BatchAction::ENCODE;
+    else if( action == "decode" ) options.batch_.action_ = BatchAction::DECODE;
+    else if( action == "verify" ) options.batch_.action_ = BatchAction::VERIFY;
+    else
+    {
+        std::cout << "Unknown action: " << action << std::endl;
+        return false;
+    }
+
+    options.batch_.compression_factor_ = kDEFAULT_COMPRESSION_FACTOR;
+    options.batch_.num_encoders_       = std::max<size_t>( 1, std::thread::hardware_concurrency() );
+
+    for( int i = 2; i < argc; ++i )
+    {
+        const std::string arg = argv[i];
+
+        // Options that take a value.
+        const bool has_value = i + 1 < argc;
+        const char* value    = has_value ? argv[i + 1] : "";
+
+        if( arg == "-o" || arg == "--output" || arg == "-j" || arg == "--jobs" || arg == "-f" || arg == "--format" ||
+            arg == "-q" || arg == "--quality" || arg == "--tile" || arg == "--effort" )
+        {
+            if( !has_value )
+            {
+                std::cout << arg << " needs a value." << std::endl;
+                return false;
+            }
+            ++i;
+        }
+
+        if( arg == "-o" || arg == "--output" )
+        {
+            options.output_dir_ = value;
+        }
+        else if( arg == "-j" || arg == "--jobs" )
+        {
+            size_t jobs = 0;
+            if( !parseSize( value, jobs ) || jobs == 0 )
+            {
+                std::cout << "Bad job count: " << value << std::endl;
+                return false;
+            }
+
+            // The readers and writers are mostly waiting on the disk, so
+            // a couple of each keep up with any number of encoders.
+            options.num_threads_         = jobs;
+            options.batch_.num_encoders_ = jobs;
+            options.batch_.num_readers_  = std::min<size_t>( jobs, 2 );
+            options.batch_.num_writers_  = std::min<size_t>( jobs, 2 );
+        }
+        else if( arg == "-f" || arg == "--format" )
+        {
+            const std::string format = value;
+
+            if( format == "in3" )      options.batch_.image_format_ = BatchFormat::IN3;
+            else if( format == "im3" ) options.batch_.image_format_ = BatchFormat::IM3;
+            else if( format == "au3" ) options.batch_.audio_format_ = BatchFormat::AU3;
+            else if( format == "am3" ) options.batch_.audio_format_ = BatchFormat::AM3;
+            else
+            {
+                std::cout << "Unknown format: " << format << std::endl;
+                return false;
+            }
+        }
+        else if( arg == "-q" || arg == "--quality" )
+        {
+            char* end = nullptr;
+            options.batch_.compression_factor_ = std::strtod( value, &end );
+
+            if( end == value || *end != '\0' || !( options.batch_.compression_factor_ > 0.0 ) )
+            {
+                std::cout << "The compression factor must be a number above 0." << std::endl;
+                return false;
+            }
+        }
+        else if( arg == "--tile" )
+        {
+            size_t tile_size = 0;
+            if( !parseSize( value, tile_size ) || tile_size > 0xffffffff )
+            {
+                std::cout << "Bad tile size: " << value << std::endl;
+                return false;
+            }
+            options.batch_.tile_size_ = static_cast<uint32_t>( tile_size );
+        }
+        else if( arg == "--effort" )
+        {
+            const std::string effort = value;
+
+            if( effort == "fast" )         options.batch_.effort_ = IN3Effort::FAST;
+            else if( effort == "default" ) options.batch_.effort_ = IN3Effort::DEFAULT;
+            else if( effort == "max" )     options.batch_.effort_ = IN3Effort::MAX;
+            else
+            {
+                std::cout << "Unknown effort: " << effort << std::endl;
+                return false;
+            }
+        }
+        else if( arg == "-l" || arg == "--lossy" )
+        {
+            options.batch_.image_format_ = BatchFormat::IM3;
+            options.batch_.audio_format_ = BatchFormat::AM3;
+        }
+        else if( arg == "-r" || arg == "--recursive" ) options.recursive_ = true;
+        else if( arg == "--ycocg" )                    options.batch_.colour_transform_ = IN3ColourTransform::YCOCG_R;
+        else if( arg == "--lz77" )                     options.batch_.backend_ = IN3Backend::LZ77;
+        else if( arg == "--drop-alpha" )               options.batch_.alpha_ = IN3Alpha::DROP;
+        else if( arg == "--force" )                    options.force_ = true;
+        else if( arg.size() > 1 && arg[0] == '-' )
+        {
+            std::cout << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+        else
+        {
+            options.inputs_.push_back( arg );
+        }
+    }
+
+    if( options.inputs_.empty() )
+    {
+        std::cout << "No files given." << std::endl;
+        return false;
+    }
+
+    // .am3 stores the factor in thousandths.
+    if( options.batch_.action_ != BatchAction::DECODE && options.batch_.audio_format_ == BatchFormat::AM3 &&
+        options.batch_.compression_factor_ < 0.001 )
+    {
+        std::cout << "The .am3 compression factor must be at least 0.001." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+//========================================================================
+//
+static bool isDirectory( const std::string& path )
+{
+#ifdef _WIN32
+    const DWORD attributes = GetFileAttributesA( path.c_str() );
+    return attributes != INVALID_FILE_ATTRIBUTES && ( attributes & FILE_ATTRIBUTE_DIRECTORY );
+#else
+    struct stat info;
+    return stat( path.c_str(), &info ) == 0 && S_ISDIR( info.st_mode );
+#endif
+}
+
+//========================================================================
+//
+static bool pathExists( const std::string& path )
+{
+#ifdef _WIN32
+    return GetFileAttributesA( path.c_str() ) != INVALID_FILE_ATTRIBUTES;
+#else
+    struct stat info;
+    return stat( path.c_str(), &info ) == 0;
+#endif
+}
+
+//========================================================================
+// Creates the directory at path and any missing parents.
+static bool makeDirectories( const std::string& path )
+{
+    if( path.empty() || isDirectory( path ) ) return true;
+
+    const size_t parent_end = path.find_last_of( "/\\", path.size() - 2 );
+    if( parent_end != std::string::npos && !makeDirectories( path.substr( 0, parent_end + 1 ) ) ) return false;
+
+#ifdef _WIN32
+    CreateDirectoryA( path.c_str(), nullptr );
+#else
+    mkdir( path.c_str(), 0777 );
+#endif
+
+    // What matters is whether the directory is there now, whatever the
+    // call returned.
+    return isDirectory( path );
+}
+
+//========================================================================
+// The names of the entries of dir, sorted so that runs are repeatable.
+static std::vector<std::string> listDirectory( const std::string& dir )
+{
+    std::vector<std::string> names;
+
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA( ( dir + "\\*" ).c_str(), &entry );
+
+    if( find != INVALID_HANDLE_VALUE )
+    {
+        do
+        {
+            names.push_back( entry.cFileName );
+        }
+        while( FindNextFileA( find, &entry ) );
+
+        FindClose( find );
+    }
+#else
+    DIR* handle = opendir( dir.c_str() );
+
+    if( handle != nullptr )
+    {
+        while( const dirent* entry = readdir( handle ) )
+        {
+            names.push_back( entry->d_name );
+        }
+
+        closedir( handle );
+    }
+#endif
+
+    names.erase( std::remove_if( names.begin(), names.end(), []( const std::string& name )
+    {
+        return name == "." || name == "..";
+    } ), names.end() );
+
+    std::sort( names.begin(), names.end() );
+    return names;
+}
+
+//========================================================================
+// What a file of the given type becomes, or "" if the action does not
+// apply to it or writes nothing.
+static std::string outputExtension( util::FILE_TYPE type,
+                                    const BatchOptions& options )
+{
+    const bool image = type == util::FILE_TYPE::BMP || type == util::FILE_TYPE::IM3 || type == util::FILE_TYPE::IN3;
+    const bool coded = type != util::FILE_TYPE::BMP && type != util::FILE_TYPE::WAV;
+
+    switch( options.action_ )
+    {
+    case BatchAction::ENCODE:
+        if( coded ) return "";
+        if( image ) return options.image_format_ == BatchFormat::IM3 ? ".im3" : ".in3";
+        return options.audio_format_ == BatchFormat::AM3 ? ".am3" : ".au3";
+
+    case BatchAction::DECODE:
+        if( !coded ) return "";
+        return image ? ".bmp" : ".wav";
+
+    default:
+        return "";
+    }
+}
+
+//========================================================================
+// Adds a job for the file at input_path, to be written under
+// output_dir. Returns false if the file was not added; quiet is set
+// for files found in directories, which are skipped silently if the
+// action does not apply to them.
+static bool addJob( const std::string& input_path,
+                    const std::string& output_dir,
+                    const CommandLineOptions& options,
+                    bool quiet,
+                    std::vector<BatchJob>& jobs )
+{
+    util::FILE_TYPE type;
+
+    if( util::determineFileType( input_path, type ) )
+    {
+        if( !quiet ) std::cout << "Not a supported file type: " << input_path << std::endl;
+        return quiet;
+    }
+
+    BatchJob job;
+    job.input_path_ = input_path;
+
+    if( options.batch_.action_ != BatchAction::VERIFY )
+    {
+        const std::string extension = outputExtension( type, options.batch_ );
+
+        if( extension.empty() )
+        {
+            if( !quiet ) std::cout << "Cannot " << ( options.batch_.action_ == BatchAction::ENCODE ? "encode " : "decode " ) << input_path << std::endl;
+            return quiet;
+        }
+
+        job.output_path_ = output_dir + util::getFileName( input_path ) + extension;
+
+        if( !options.force_ && pathExists( job.output_path_ ) )
+        {
+            std::cout << "Not overwriting " << job.output_path_ << " (use --force)." << std::endl;
+            return false;
+        }
+
+        if( !makeDirectories( output_dir ) )
+        {
+            std::cout << "Cannot create " << output_dir << std::endl;
+            return false;
+        }
+    }
+
+    jobs.push_back( job );
+    return true;
+}
+
+//========================================================================
+// Adds the files under dir, relative_dir being its path below the
+// directory named on the command line. Returns the number of files
+// that could not be added.
+static size_t addDirectory( const std::string& dir,
+                            const std::string& output_root,
+                            const std::string& relative_dir,
+                            const CommandLineOptions& options,
+                            std::vector<BatchJob>& jobs )
+{
+    size_t failures = 0;
+
+    for( const std::string& name : listDirectory( dir ) )
+    {
+        const std::string path = dir + kSEPARATOR + name;
+
+        if( isDirectory( path ) )
+        {
+            if( options.recursive_ ) failures += addDirectory( path, output_root, relative_dir + name + kSEPARATOR, options, jobs );
+            continue;
+        }
+
+        if( !addJob( path, output_root + relative_dir, options, true, jobs ) ) ++failures;
+    }
+
+    return failures;
+}
+
+//========================================================================
+//
+int main( int argc, char** argv )
+{
+    if( argc >= 2 && ( std::strcmp( argv[1], "-h" ) == 0 || std::strcmp( argv[1], "--help" ) == 0 ) )
+    {
+        printUsage();
+        return 0;
+    }
+
+    CommandLineOptions options;
+
+    if( !parseArguments( argc, argv, options ) )
+    {
+        printUsage();
+        return 2;
+    }
+
+    // Before anything codes, as the shared pool is sized when first used.
+    ThreadPool::configureShared( options.num_threads_ );
+
+    std::string output_dir = options.output_dir_;
+    if( !output_dir.empty() && output_dir.back() != '/' && output_dir.back() != '\\' ) output_dir += kSEPARATOR;
+
+    // Gather the jobs.
+    std::vector<BatchJob> jobs;
+    size_t failures = 0;
+
+    for( std::string input : options.inputs_ )
+    {
+        while( input.size() > 1 && ( input.back() == '/' || input.back() == '\\' ) ) input.pop_back();
+
+        if( isDirectory( input ) )
+        {
+            failures += addDirectory( input, output_dir.empty() ? input + kSEPARATOR : output_dir, "", options, jobs );
+            continue;
+        }
+
+        if( !pathExists( input ) )
+        {
+            std::cout << "No such file: " << input << std::endl;
+            ++failures;
+            continue;
+        }
+
+        const size_t dir_end = input.find_last_of( "/\\" );
+        const std::string input_dir = dir_end == std::string::npos ? "" : input.substr( 0, dir_end + 1 );
+
+        if( !addJob( input, output_dir.empty() ? input_dir : output_dir, options, false, jobs ) ) ++failures;
+    }
+
+    // Convert them.
+    const auto time_before = std::chrono::steady_clock::now();
+
+    std::vector<BatchResult> results;
+    BatchConverter converter( options.batch_ );
+    converter.run( jobs, results );
+
+    const double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - time_before ).count();
+
+    // Report.
+    size_t   succeeded = 0;
+    uint64_t total_in  = 0;
+    uint64_t total_out = 0;
+
+    for( size_t j = 0; j < jobs.size(); ++j )
+    {
+        const BatchJob&    job    = jobs[j];
+        const BatchResult& result = results[j];
+
+        if( result.status_ )
+        {
+            std::cout << "FAILED  " << job.input_path_ << std::endl;
+            ++failures;
+            continue;
+        }
+
+        ++succeeded;
+        total_in  += result.input_size_;
+        total_out += result.output_size_;
+
+        std::cout << "ok      " << job.input_path_;
+
+        if( !job.output_path_.empty() ) std::cout << " -> " << job.output_path_;
+
+        if( result.output_size_ > 0 )
+        {
+            std::cout << "  " << result.input_size_ << " -> " << result.output_size_ << " bytes";
+
+            if( options.batch_.action_ != BatchAction::DECODE )
+            {
+                std::cout << " (" << std::fixed << std::setprecision( 2 ) << static_cast<double>( result.input_size_ ) / result.output_size_ << "x)";
+            }
+        }
+
+        if( result.quality_db_ != 0.0 ) std::cout << "  " << std::fixed << std::setprecision( 1 ) << result.quality_db_ << " dB";
+
+        std::cout << std::endl;
+    }
+
+    std::cout << succeeded << " succeeded, " << failures << " failed, "
+              << total_in << " bytes in, " << total_out << " bytes out, "
+              << std::fixed << std::setprecision( 2 ) << seconds << " seconds" << std::endl;
+
+    return failures == 0 ? 0 : 1;
+}
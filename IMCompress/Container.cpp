@@ -0,0 +1,277 @@
+#include "stdafx.h"
+#include "Container.h"
+
+#include "Checksum.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+//========================================================================
+// First four bytes of every chunked file.
+static const UByte kMAGIC[4] = { 'I', 'M', 'C', 'K' };
+
+//========================================================================
+// CRC-32C of a chunk type, where every chunk's CRC starts.
+static uint32_t typeCrc( uint32_t type )
+{
+    const UByte bytes[4] = { static_cast<UByte>( type >> 24 ), 
+                             static_cast<UByte>( type >> 16 ),
+                             static_cast<UByte>( type >> 8 ), 
+                             static_cast<UByte>( type ) };
+
+    return util::crc32c( bytes, 4 );
+}
+
+//========================================================================
+//
+ChunkWriter::ChunkWriter( OutputSink& sink, ContainerFormat format )
+    : sink_( sink )
+    , remaining_( 0 )
+    , crc_( 0 )
+    , status_( STATUS_OKAY )
+{
+    put( kMAGIC, 4 );
+
+    const UByte head[2] = { kCONTAINER_VERSION, static_cast<UByte>( format ) };
+    writeChunk( kCHUNK_HEAD, head, 2 );
+}
+
+//========================================================================
+//
+void ChunkWriter::beginChunk( uint32_t type, uint64_t length )
+{
+    remaining_ = length;
+    crc_       = typeCrc( type );
+
+    std::vector<UByte> header;
+    header.reserve( kCHUNK_HEADER_SIZE );
+
+    util::appendBigEndian( header, type, 4 );
+    util::appendBigEndian( header, length, 8 );
+
+    put( header.data(), header.size() );
+}
+
+//========================================================================
+//
+void ChunkWriter::append( const UByte* data, size_t size )
+{
+    if( size > remaining_ && !status_ ) status_ = printMsg( BAD_DATA );
+
+    remaining_ -= std::min<uint64_t>( size, remaining_ );
+    crc_        = util::crc32c( data, size, crc_ );
+
+    put( data, size );
+}
+
+//========================================================================
+//
+void ChunkWriter::endChunk()
+{
+    if( remaining_ != 0 && !status_ ) status_ = printMsg( BAD_DATA );
+
+    std::vector<UByte> trailer;
+    trailer.reserve( kCHUNK_TRAILER_SIZE );
+
+    util::appendBigEndian( trailer, crc_, 4 );
+
+    put( trailer.data(), trailer.size() );
+}
+
+//========================================================================
+//
+void ChunkWriter::writeChunk( uint32_t type, const UByte* data, size_t size )
+{
+    beginChunk( type, size );
+    append( data, size );
+    endChunk();
+}
+
+//========================================================================
+//
+MsgNum ChunkWriter::finish()
+{
+    writeChunk( kCHUNK_END, nullptr, 0 );
+
+    if( !status_ ) status_ = sink_.flush();
+
+    return status_;
+}
+
+//========================================================================
+//
+uint64_t ChunkWriter::containerSize( uint64_t payload_size, size_t num_chunks )
+{
+    // Magic, HEAD, the chunks and END.
+    const uint64_t framing = kCHUNK_HEADER_SIZE + kCHUNK_TRAILER_SIZE;
+
+    return 4 + ( framing + 2 ) + payload_size + ( num_chunks + 1 ) * framing;
+}
+
+//========================================================================
+// Once the sink has failed nothing more is written.
+void ChunkWriter::put( const UByte* data, size_t size )
+{
+    if( !status_ ) status_ = sink_.write( data, size );
+}
+
+//========================================================================
+//
+bool ChunkReader::isChunked( const UByte* data, size_t size )
+{
+    return size >= 4 && std::equal( kMAGIC, kMAGIC + 4, data );
+}
+
+//========================================================================
+//
+MsgNum ChunkReader::readHead( const UByte* data, 
+                              size_t size, 
+                              ContainerFormat format,
+                              size_t& pos )
+{
+    if( !isChunked( data, size ) ) return printMsg( BAD_DATA );
+
+    pos = 4;
+
+    uint32_t     type;
+    const UByte* head;
+    size_t       head_size;
+
+    MsgNum err = readChunk( data, size, pos, type, head, head_size );
+    if( err ) return err;
+
+    if( type != kCHUNK_HEAD || head_size < 2 || head[0] != kCONTAINER_VERSION || head[1] != static_cast<UByte>( format ) )
+    {
+        return printMsg( BAD_DATA );
+    }
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum ChunkReader::readChunk( const UByte* data, 
+                               size_t size, 
+                               size_t& pos,
+                               uint32_t& type,
+                               const UByte*& chunk_data,
+                               size_t& chunk_size )
+{
+    if( pos > size || size - pos < kCHUNK_HEADER_SIZE + kCHUNK_TRAILER_SIZE ) return printMsg( BAD_DATA );
+
+    type = static_cast<uint32_t>( util::readBigEndian( data, pos, 4 ) );
+
+    const uint64_t length = util::readBigEndian( data, pos, 8 );
+    if( length > size - pos - kCHUNK_TRAILER_SIZE ) return printMsg( BAD_DATA );
+
+    chunk_data = data + pos;
+    chunk_size = static_cast<size_t>( length );
+    pos       += chunk_size;
+
+    const uint32_t crc = static_cast<uint32_t>( util::readBigEndian( data, pos, 4 ) );
+    if( util::crc32c( chunk_data, chunk_size, typeCrc( type ) ) != crc ) return printMsg( BAD_DATA );
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum ChunkReader::verify( const UByte* data, 
+                            size_t size, 
+                            ContainerFormat format,
+                            std::vector<ChunkSpan>& chunks )
+{
+    size_t pos = 0;
+
+    MsgNum err = readHead( data, size, format, pos );
+    if( err ) return err;
+
+    // Walk the chunk headers first, then check the chunks together.
+    struct Chunk
+    {
+        uint32_t type_;
+        size_t   src_;
+        size_t   size_;
+    };
+
+    std::vector<Chunk> all;
+    uint64_t           payload_size = 0;
+    bool               ended        = false;
+
+    chunks.clear();
+
+    while( !ended )
+    {
+        if( pos > size || size - pos < kCHUNK_HEADER_SIZE + kCHUNK_TRAILER_SIZE ) return printMsg( BAD_DATA );
+
+        Chunk chunk;
+        chunk.type_ = static_cast<uint32_t>( util::readBigEndian( data, pos, 4 ) );
+
+        const uint64_t length = util::readBigEndian( data, pos, 8 );
+        if( length > size - pos - kCHUNK_TRAILER_SIZE ) return printMsg( BAD_DATA );
+
+        chunk.src_  = pos;
+        chunk.size_ = static_cast<size_t>( length );
+
+        // One table chunk, then data chunks, then the end.
+        const bool expected = all.empty() ? chunk.type_ == kCHUNK_TABL 
+                                          : chunk.type_ == kCHUNK_DATA || chunk.type_ == kCHUNK_END;
+        if( !expected ) return printMsg( BAD_DATA );
+
+        ended = chunk.type_ == kCHUNK_END;
+        if( !ended )
+        {
+            chunks.push_back( { data + chunk.src_, chunk.size_, payload_size } );
+            payload_size += chunk.size_;
+        }
+
+        all.push_back( chunk );
+        pos += chunk.size_ + kCHUNK_TRAILER_SIZE;
+    }
+
+    if( pos != size ) return printMsg( BAD_DATA );
+
+    std::vector<UByte> ok( all.size(), 0 );
+
+    ThreadPool::shared().parallelFor( all.size(), [&]( size_t c )
+    {
+        const Chunk& chunk = all[c];
+
+        size_t         crc_pos = chunk.src_ + chunk.size_;
+        const uint32_t crc     = static_cast<uint32_t>( util::readBigEndian( data, crc_pos, 4 ) );
+
+        ok[c] = util::crc32c( data + chunk.src_, chunk.size_, typeCrc( chunk.type_ ) ) == crc;
+    } );
+
+    for( size_t c = 0; c < ok.size(); ++c )
+    {
+        if( !ok[c] ) return printMsg( BAD_DATA );
+    }
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+const UByte* ChunkReader::locate( const std::vector<ChunkSpan>& chunks,
+                                  uint64_t offset,
+                                  size_t size )
+{
+    // The last chunk starting at or before offset.
+    auto chunk = std::upper_bound( chunks.begin(), chunks.end(), offset, 
+                                   []( uint64_t value, const ChunkSpan& span ) { return value < span.offset_; } );
+    if( chunk == chunks.begin() ) return nullptr;
+    --chunk;
+
+    const uint64_t start = offset - chunk->offset_;
+    if( start > chunk->size_ || size > chunk->size_ - start ) return nullptr;
+
+    return chunk->data_ + start;
+}
+
+//========================================================================
+//
+uint64_t ChunkReader::payloadSize( const std::vector<ChunkSpan>& chunks )
+{
+    return chunks.empty() ? 0 : chunks.back().offset_ + chunks.back().size_;
+}
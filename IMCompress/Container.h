@@ -0,0 +1,151 @@
+#pragma once
+
+#include "Util.h"
+#include "Errors.h"
+#include "OutputSink.h"
+
+#include <vector>
+
+//========================================================================
+// Which coder's data a chunked container holds.
+enum class ContainerFormat : UByte
+{
+    IM3 = 1,
+    IN3 = 2,
+    AU3 = 3,
+    AM3 = 4
+};
+
+//========================================================================
+// Chunk types, four ASCII characters read big endian.
+static const uint32_t kCHUNK_HEAD = 0x48454144;  // "HEAD"
+static const uint32_t kCHUNK_TABL = 0x5441424c;  // "TABL"
+static const uint32_t kCHUNK_DATA = 0x44415441;  // "DATA"
+static const uint32_t kCHUNK_END  = 0x454e4420;  // "END "
+
+//========================================================================
+// Layout of a chunked .im3 or .in3 file:
+//
+//     | I M C K | HEAD | TABL | DATA ... | END |
+//
+// Every chunk is | type (4) | length (8) | data | CRC-32C (4) |, the
+// CRC covering the type and the data. HEAD holds the container 
+// version and the format; TABL the coder's own header and tables;
+// the DATA chunks its coded segments; END is empty and marks a 
+// complete file. Joined in order, TABL and DATA give back the coder's
+// plain output.
+static const size_t kCHUNK_HEADER_SIZE  = 12;
+static const size_t kCHUNK_TRAILER_SIZE = 4;
+static const UByte  kCONTAINER_VERSION  = 1;
+
+//========================================================================
+// Writes a chunked container to a sink, checksumming each chunk as it
+// is appended. Chunk lengths are given up front, so every byte goes 
+// to the sink as soon as it is written and nothing is patched later.
+class ChunkWriter
+{
+public:
+
+    //--------------------------------------------------------------
+    // Writes the magic and HEAD chunk.
+    ChunkWriter( OutputSink& sink, ContainerFormat format );
+
+    //--------------------------------------------------------------
+    // Starts a chunk of length bytes. Its data is then added with 
+    // append().
+    void beginChunk( uint32_t type, uint64_t length );
+
+    //--------------------------------------------------------------
+    //
+    void append( const UByte* data, size_t size );
+
+    //--------------------------------------------------------------
+    // Writes the CRC of the current chunk, which must have had exactly
+    // its length appended.
+    void endChunk();
+
+    //--------------------------------------------------------------
+    // Writes a whole chunk at once.
+    void writeChunk( uint32_t type, const UByte* data, size_t size );
+
+    //--------------------------------------------------------------
+    // Writes the END chunk and flushes the sink. Returns the first
+    // error met while writing.
+    MsgNum finish();
+
+    //--------------------------------------------------------------
+    // Bytes taken by the chunks, with the magic and HEAD, of a file
+    // whose chunks hold payload_size bytes between them.
+    static uint64_t containerSize( uint64_t payload_size, size_t num_chunks );
+
+private:
+
+    //--------------------------------------------------------------
+    //
+    void put( const UByte* data, size_t size );
+
+    OutputSink& sink_;
+    uint64_t    remaining_;
+    uint32_t    crc_;
+    MsgNum      status_;
+};
+
+//========================================================================
+// Where the data of one chunk lies in the file, and where it starts
+// in the coder's plain output.
+struct ChunkSpan
+{
+    const UByte* data_;
+    size_t       size_;
+    uint64_t     offset_;
+};
+
+//========================================================================
+// Reads a chunked container, rejecting it before anything is decoded
+// if any chunk is damaged or missing.
+class ChunkReader
+{
+public:
+
+    //--------------------------------------------------------------
+    // Whether data starts with the container magic.
+    static bool isChunked( const UByte* data, size_t size );
+
+    //--------------------------------------------------------------
+    // Checks the HEAD chunk against format and the CRC of every chunk
+    // up to END, in parallel, and lists where the TABL and DATA chunks
+    // sit in data. Nothing is copied: the coder reads its table and 
+    // segments in place through the spans.
+    static MsgNum verify( const UByte* data, 
+                          size_t size, 
+                          ContainerFormat format,
+                          std::vector<ChunkSpan>& chunks );
+
+    //--------------------------------------------------------------
+    // Finds size bytes at offset in the payload the chunks make up 
+    // when joined. Returns null if they are not all within one chunk.
+    static const UByte* locate( const std::vector<ChunkSpan>& chunks,
+                                uint64_t offset,
+                                size_t size );
+
+    //--------------------------------------------------------------
+    // Total size of the chunks' data.
+    static uint64_t payloadSize( const std::vector<ChunkSpan>& chunks );
+
+    //--------------------------------------------------------------
+    // Reads the chunk at pos, checking its CRC, and moves pos past it.
+    // For random access to single chunks.
+    static MsgNum readChunk( const UByte* data, 
+                             size_t size, 
+                             size_t& pos,
+                             uint32_t& type,
+                             const UByte*& chunk_data,
+                             size_t& chunk_size );
+
+    //--------------------------------------------------------------
+    // Checks the magic and HEAD chunk, leaving pos at the TABL chunk.
+    static MsgNum readHead( const UByte* data, 
+                            size_t size, 
+                            ContainerFormat format,
+                            size_t& pos );
+};
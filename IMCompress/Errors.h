@@ -30,7 +30,8 @@ enum MsgNum
     BMP_DATA_OUT_RANGE   = 5,
     BAD_DATA             = 6,
     BAD_WAV_BIT_DEPTH    = 7,
-    HUFFMAN_ERROR        = 8
+    HUFFMAN_ERROR        = 8,
+    FAILURE_WRITING_FILE = 9
 };
 
 //--------------------------------------------------------------
@@ -71,6 +72,10 @@ inline MsgNum printMsg( MsgNum err )
         std::cout << "Error: Encountered a problem while performing Huffman encoding/decoding. Exiting. " << std::endl;
         break;
 
+    case FAILURE_WRITING_FILE:
+        std::cout << "Error: Failure to write output. Exiting." << std::endl;
+        break;
+
     default:
         break;
     }
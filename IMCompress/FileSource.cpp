@@ -0,0 +1,181 @@
+#include "stdafx.h"
+#include "FileSource.h"
+
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//========================================================================
+// Smallest page size of the platforms we map files on.
+static const size_t kPAGE_SIZE = 4096;
+
+//========================================================================
+//
+FileSource::FileSource()
+    : data_( nullptr )
+    , size_( 0 )
+    , mapping_( nullptr )
+{
+
+}
+
+//========================================================================
+//
+FileSource::~FileSource()
+{
+    close();
+}
+
+//========================================================================
+//
+MsgNum FileSource::open( const std::string& file_path )
+{
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA( file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr );
+    if( file == INVALID_HANDLE_VALUE ) return printMsg( FAILURE_READING_FILE );
+
+    LARGE_INTEGER file_size;
+    if( !GetFileSizeEx( file, &file_size ) )
+    {
+        CloseHandle( file );
+        return printMsg( FAILURE_READING_FILE );
+    }
+
+    // Zero length files cannot be mapped, and have nothing to map.
+    if( file_size.QuadPart == 0 )
+    {
+        CloseHandle( file );
+        return STATUS_OKAY;
+    }
+
+    HANDLE mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+    CloseHandle( file );
+
+    if( mapping == nullptr ) return readWhole( file_path );
+
+    // The view keeps the mapping object alive.
+    mapping_ = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+    CloseHandle( mapping );
+
+    if( mapping_ == nullptr ) return readWhole( file_path );
+
+    size_ = static_cast<size_t>( file_size.QuadPart );
+#else
+    const int fd = ::open( file_path.c_str(), O_RDONLY );
+    if( fd < 0 ) return printMsg( FAILURE_READING_FILE );
+
+    struct stat file_stat;
+    if( fstat( fd, &file_stat ) != 0 )
+    {
+        ::close( fd );
+        return printMsg( FAILURE_READING_FILE );
+    }
+
+    // Zero length files cannot be mapped, and have nothing to map.
+    // Pipes and other special files are read instead.
+    if( !S_ISREG( file_stat.st_mode ) )
+    {
+        ::close( fd );
+        return readWhole( file_path );
+    }
+
+    if( file_stat.st_size == 0 )
+    {
+        ::close( fd );
+        return STATUS_OKAY;
+    }
+
+    void* mapping = mmap( nullptr, static_cast<size_t>( file_stat.st_size ), PROT_READ, MAP_PRIVATE, fd, 0 );
+    ::close( fd );
+
+    if( mapping == MAP_FAILED ) return readWhole( file_path );
+
+    // Every decoder reads its input front to back, so let the kernel
+    // read ahead aggressively and drop pages behind us.
+    madvise( mapping, static_cast<size_t>( file_stat.st_size ), MADV_SEQUENTIAL );
+
+    mapping_ = mapping;
+    size_    = static_cast<size_t>( file_stat.st_size );
+#endif
+
+    data_ = static_cast<const UByte*>( mapping_ );
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+void FileSource::prefetch() const
+{
+    if( mapping_ == nullptr ) return;
+
+#ifndef _WIN32
+    madvise( mapping_, size_, MADV_WILLNEED );
+#endif
+
+    // Touch every page, so the reads happen on this thread whether or
+    // not the hint was taken.
+    volatile UByte touched = 0;
+    for( size_t i = 0; i < size_; i += kPAGE_SIZE )
+    {
+        touched ^= data_[i];
+    }
+}
+
+//========================================================================
+//
+void FileSource::close()
+{
+    if( mapping_ != nullptr )
+    {
+#ifdef _WIN32
+        UnmapViewOfFile( mapping_ );
+#else
+        munmap( mapping_, size_ );
+#endif
+    }
+
+    mapping_ = nullptr;
+    data_    = nullptr;
+    size_    = 0;
+
+    buffer_.clear();
+    buffer_.shrink_to_fit();
+}
+
+//========================================================================
+//
+MsgNum FileSource::readWhole( const std::string& file_path )
+{
+    std::ifstream file( file_path, std::ifstream::binary );
+    if( !file.is_open() ) return printMsg( FAILURE_READING_FILE );
+
+    // Read in blocks, as the size of a pipe is not known up front.
+    static const size_t kBLOCK_SIZE = 1 << 20;
+
+    while( file )
+    {
+        const size_t old_size = buffer_.size();
+        buffer_.resize( old_size + kBLOCK_SIZE );
+
+        file.read( reinterpret_cast<char*>( buffer_.data() + old_size ), kBLOCK_SIZE );
+        buffer_.resize( old_size + static_cast<size_t>( file.gcount() ) );
+    }
+
+    if( file.bad() ) return printMsg( FAILURE_READING_FILE );
+
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+
+    return STATUS_OKAY;
+}
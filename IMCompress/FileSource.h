@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Util.h"
+#include "Errors.h"
+
+#include <string>
+#include <vector>
+
+//========================================================================
+// Read-only view of a whole input file. The file is memory mapped where
+// the platform allows, so decoders can read it in place without it
+// being copied out of the page cache; otherwise it is read into memory.
+// The view stays valid until the source is closed or destroyed.
+class FileSource
+{
+public:
+
+    //--------------------------------------------------------------
+    //
+    FileSource();
+
+    //--------------------------------------------------------------
+    //
+    ~FileSource();
+
+    //--------------------------------------------------------------
+    // Maps the file at file_path, replacing any file already open.
+    MsgNum open( const std::string& file_path );
+
+    //--------------------------------------------------------------
+    // Unmaps the file. Called by the destructor.
+    void close();
+
+    //--------------------------------------------------------------
+    //
+    const UByte* data() const { return data_; }
+
+    //--------------------------------------------------------------
+    //
+    size_t size() const { return size_; }
+
+    //--------------------------------------------------------------
+    // Brings a mapped file into memory now, so that the thread that 
+    // later decodes it does not stall on disk reads.
+    void prefetch() const;
+
+    //--------------------------------------------------------------
+    //
+    bool isMapped() const { return mapping_ != nullptr; }
+
+private:
+
+    //--------------------------------------------------------------
+    // A mapping cannot be shared, so neither can the source.
+    FileSource( const FileSource& ) = delete;
+    FileSource& operator=( const FileSource& ) = delete;
+
+    //--------------------------------------------------------------
+    // Fallback for files that cannot be mapped.
+    MsgNum readWhole( const std::string& file_path );
+
+    const UByte*        data_;
+    size_t              size_;
+
+    // Start of the mapped view, or nullptr if the file was read into
+    // buffer_ instead.
+    void*               mapping_;
+    std::vector<UByte>  buffer_;
+};
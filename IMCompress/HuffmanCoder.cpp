@@ -6,6 +6,10 @@
 #include <array>
 #include <algorithm>
 
+//========================================================================
+//
+const Uint HuffmanCoder::kMAX_CODE_LENGTH;
+
 //========================================================================
 //
 template<typename Sym>
@@ -16,6 +20,14 @@ HuffmanTree<Sym>::HuffmanTree()
 
 }
 
+//========================================================================
+//
+template<typename Sym>
+HuffmanTree<Sym>::~HuffmanTree()
+{
+    delete root_;
+}
+
 //========================================================================
 //
 template<typename Sym>
@@ -28,15 +40,10 @@ MsgNum HuffmanTree<Sym>::constructSymbolTable()
         return STATUS_OKAY;
     }
 
-    // Assume we have at least two symbols.
+    // Assume we have at least two symbols. The depth may exceed what
+    // can be stored; HuffmanCoder::buildCode() limits it.
     traverse( root_, "" );
 
-    if( max_depth_ >= 32 )
-    {
-        std::cout << "Table depth (max cw len) is too large.. We cannot accurately store the information." << std::endl;
-        return HUFFMAN_ERROR;
-    }
-
     return STATUS_OKAY;
 }
 
@@ -94,13 +101,14 @@ Sym HuffmanTree<Sym>::str2bin( const std::string& binStr )
 
 //========================================================================
 //
-BitReader::BitReader( const std::vector<UByte>& bit_stream )
+BitReader::BitReader( const UByte* bit_stream, size_t size )
     : stream_( bit_stream )
+    , size_( size )
     , curr_byte_( 0 )
     , byte_index_( 0 )
     , bit_index_ ( 0 )
 {
-    if( bit_stream.size() > 0 )
+    if( size > 0 )
     {
         curr_byte_ = bit_stream[0];
     }
@@ -111,6 +119,14 @@ BitReader::BitReader( const std::vector<UByte>& bit_stream )
     }
 }
 
+//========================================================================
+//
+BitReader::BitReader( const std::vector<UByte>& bit_stream )
+    : BitReader( bit_stream.data(), bit_stream.size() )
+{
+
+}
+
 //========================================================================
 //
 uint64_t BitReader::read_bits( Uint numBits, bool& success )
@@ -118,11 +134,12 @@ uint64_t BitReader::read_bits( Uint numBits, bool& success )
     success       = true;
     uint64_t bits = 0;
 
-    for( size_t i = 0; i < numBits; ++i )
+    // Take as many bits as possible from the current byte at a time.
+    while( numBits > 0 )
     {
         if( bit_index_ == 8 )
         {
-            if( byte_index_ >= stream_.size() - 1 )
+            if( byte_index_ + 1 >= size_ )
             {
                 success    = false;
                 curr_byte_ = 0;
@@ -135,14 +152,38 @@ uint64_t BitReader::read_bits( Uint numBits, bool& success )
             bit_index_ = 0;
         }
 
-        UByte newbit = (curr_byte_ >> (7 - bit_index_)) & 0x1;
-        bits = ( bits << 1 ) | newbit;
-        ++bit_index_;
+        const Uint  take  = std::min( numBits, 8 - bit_index_ );
+        const UByte chunk = ( curr_byte_ >> ( 8 - bit_index_ - take ) ) & ( ( 1 << take ) - 1 );
+
+        bits        = ( bits << take ) | chunk;
+        bit_index_ += take;
+        numBits    -= take;
     }
 
     return bits;
 }
 
+//========================================================================
+//
+BitWriter::BitWriter( std::vector<UByte>& bit_stream )
+    : stream_( bit_stream )
+    , acc_( 0 )
+    , acc_bits_( 0 )
+{
+
+}
+
+//========================================================================
+//
+void BitWriter::flush()
+{
+    if( acc_bits_ != 0 )
+    {
+        stream_.push_back( static_cast<UByte>( acc_ << ( 8 - acc_bits_ ) ) );
+        acc_bits_ = 0;
+    }
+}
+
 //========================================================================
 //
 HuffmanCoder::HuffmanCoder()
@@ -154,7 +195,7 @@ HuffmanCoder::HuffmanCoder()
 //
 HuffmanCoder::~HuffmanCoder()
 {
-    // ADD DESTRUCTOR TO WIPE THE TREE!
+
 }
 
 //========================================================================
@@ -164,22 +205,45 @@ MsgNum HuffmanCoder::encodePerByte( const std::vector<UByte>& inData,
                                     DecoderParameters& dec_params )
 {
     // First get the distribution of symbols.
-    std::unordered_map<UByte, int64_t> symbol_count;
+    std::array<uint64_t, 256> frequencies = {};
 
     for( auto byte : inData )
     {
-        auto found = symbol_count.find( byte );
+        ++frequencies[byte];
+    }
 
-        if( found == symbol_count.end() )
-        {
-            symbol_count.insert( { byte, 1 } );
-        }
-        else
+    HuffmanCode code;
+
+    MsgNum err = buildCode( frequencies, code );
+    if( err ) return err;
+
+    return encodeWithCode( inData, code, outData, dec_params );
+}
+
+//========================================================================
+//
+MsgNum HuffmanCoder::buildCode( const std::array<uint64_t, 256>& frequencies,
+                                HuffmanCode& code )
+{
+    // Ordered, so that equal frequencies always tie-break the same way
+    // and a given table yields the same code on every platform.
+    std::map<UByte, uint64_t> symbol_count;
+
+    for( uint16_t b = 0; b < 256; ++b )
+    {
+        if( frequencies[b] != 0 )
         {
-            ++( found->second );
+            symbol_count.insert( { static_cast<UByte>( b ), frequencies[b] } );
         }
     }
 
+    // A tree with a single leaf would give that symbol an empty codeword,
+    // so pair it with an unused symbol to get a one bit code instead.
+    if( symbol_count.size() == 1 )
+    {
+        symbol_count.insert( { static_cast<UByte>( symbol_count.begin()->first ^ 0x1 ), 0 } );
+    }
+
     // Now construct the sorted list according to symbol frequency
     std::multimap<uint64_t, Node<UByte>*> symbols_by_freq;
     for( auto symbol : symbol_count )
@@ -225,38 +289,76 @@ MsgNum HuffmanCoder::encodePerByte( const std::vector<UByte>& inData,
     MsgNum err = hTree.constructSymbolTable();
     if( err ) return err;
 
-    // This keeps track of (old_sym, new_sym, new_sym_length) in a sorted array. This is needed 
-    // for decoding, and so is written out in the header of the compressed file.
-    std::vector<DecoderLUTEntry> decoder_lookup_table;
+    // The codeword lengths the tree gives, limited so that the
+    // decoder's lookup table stays small.
+    std::array<Uint, 256> lengths = {};
 
-    // Expect no more than 256 symbols.
-    for( uint16_t b = 0; b < 256; ++b)
+    for( const auto& entry : hTree.sym_table_ )
     {
-        const auto& found = hTree.sym_table_.find( static_cast<UByte>(b) );
+        lengths[entry.first] = entry.second.sym_len_;
+    }
+
+    code.codes_.fill( 0 );
+    code.lengths_.fill( 0 );
 
-        if( found != hTree.sym_table_.end() )
+    if( limitLengths( lengths ) )
+    {
+        // The tree's codewords no longer fit, so assign canonical ones:
+        // symbols in order of length, then value, each taking the
+        // previous codeword plus one, extended with zero bits as the
+        // length grows.
+        std::vector<UByte> symbols;
+
+        for( uint16_t b = 0; b < 256; ++b )
         {
-            const std::string& cw   = found->second.sym_str_;
-            uint64_t new_sym_as_num = 0;
-            Uint bit_index          = 0;
+            if( lengths[b] != 0 ) symbols.push_back( static_cast<UByte>( b ) );
+        }
 
-            for( auto bit : cw )
-            {
-                new_sym_as_num = new_sym_as_num << 1;
-                if( bit == '1' ) new_sym_as_num |= 0x1;
+        std::stable_sort( symbols.begin(), symbols.end(), [&lengths]( UByte a, UByte b ) {
+            return lengths[a] < lengths[b];
+        } );
 
-                ++bit_index;
-            }
+        uint32_t codeword = 0;
+        Uint     length   = lengths[symbols.front()];
+
+        for( auto sym : symbols )
+        {
+            codeword <<= lengths[sym] - length;
+            length     = lengths[sym];
 
-            // Now we need to make the magnitude of the numbers make sense for
-            // later when we construct the table lookup method during decoding.
-            // All we need to do is shift left the result by the difference
-            // between the max cw length and the length of the current cw (as
-            // binary strings).
-            new_sym_as_num = new_sym_as_num << ( hTree.max_depth_ - cw.length() );
-            decoder_lookup_table.push_back( { static_cast<UByte>(b), new_sym_as_num, static_cast<UByte>(cw.length()) } );
+            code.codes_[sym]   = codeword;
+            code.lengths_[sym] = static_cast<UByte>( length );
+            ++codeword;
         }
     }
+    else
+    {
+        // Flatten the tree's codewords into a table indexed by symbol,
+        // so that writing each one is a lookup and a shift.
+        for( const auto& entry : hTree.sym_table_ )
+        {
+            for( auto bit : entry.second.sym_str_ )
+            {
+                code.codes_[entry.first] = ( code.codes_[entry.first] << 1 ) | ( bit == '1' ? 1 : 0 );
+            }
+            code.lengths_[entry.first] = static_cast<UByte>( entry.second.sym_str_.length() );
+        }
+    }
+
+    const Uint max_len = *std::max_element( code.lengths_.begin(), code.lengths_.end() );
+
+    // This keeps track of (old_sym, new_sym, new_sym_length) in a sorted array. This is needed 
+    // for decoding, and so is written out in the header of the compressed file. new_sym is
+    // the codeword shifted left to max_len bits, which is the form the decoder's table takes.
+    std::vector<DecoderLUTEntry> decoder_lookup_table;
+
+    for( uint16_t b = 0; b < 256; ++b )
+    {
+        if( code.lengths_[b] == 0 ) continue;
+
+        const uint64_t new_sym = uint64_t( code.codes_[b] ) << ( max_len - code.lengths_[b] );
+        decoder_lookup_table.push_back( { static_cast<UByte>( b ), new_sym, code.lengths_[b] } );
+    }
 
     // Now sort the lookup table by new_sym size.
     auto sort_fn = []( DecoderLUTEntry a, DecoderLUTEntry b ) {
@@ -264,55 +366,296 @@ MsgNum HuffmanCoder::encodePerByte( const std::vector<UByte>& inData,
     };
     std::sort( decoder_lookup_table.begin(), decoder_lookup_table.end(), sort_fn );
 
-    // Then build the output stream.
-    outData.clear();
-    Uint bit_index = 0;
-    UByte curr_byte = 0;
-    for( auto sym : inData )
+    code.dec_params_.decoder_LUT_ = std::move( decoder_lookup_table );
+    code.dec_params_.max_cw_len_  = static_cast<uint16_t>( max_len );
+    code.dec_params_.num_bytes_   = 0;
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+bool HuffmanCoder::limitLengths( std::array<Uint, 256>& lengths )
+{
+    // Codewords per length. A tree of 256 symbols is under 256 deep.
+    std::array<Uint, 256> count = {};
+    Uint max_len = 0;
+
+    for( auto length : lengths )
     {
-        const auto& found = hTree.sym_table_.find( sym );
-        if( found != hTree.sym_table_.end() )
+        if( length == 0 ) continue;
+
+        ++count[length];
+        max_len = std::max( max_len, length );
+    }
+
+    if( max_len <= kMAX_CODE_LENGTH ) return false;
+
+    // As in JPEG (ITU-T T.81, K.3): take two of the longest codewords.
+    // One moves up to their parent, and the other joins a shorter
+    // codeword as its sibling, one level below it. The code stays
+    // complete.
+    for( Uint i = max_len; i > kMAX_CODE_LENGTH; --i )
+    {
+        while( count[i] > 0 )
         {
-            const std::string& cw = found->second.sym_str_;
+            Uint j = i - 2;
+            while( count[j] == 0 ) --j;
 
-            // Write the codeword to the ouptut buffer.
-            for( auto bit : cw )
-            {
-                if( bit_index == 8 )
-                {
-                    outData.push_back( curr_byte );
-                    curr_byte = 0;
-                    bit_index = 0;
-                }
+            count[i]     -= 2;
+            count[i - 1] += 1;
+            count[j + 1] += 2;
+            count[j]     -= 1;
+        }
+    }
 
-                curr_byte = curr_byte << 1;
-                if( bit == '1' ) curr_byte |= 0x1;
+    // Hand the new lengths out shortest first, in the order of the old.
+    std::vector<UByte> symbols;
 
-                ++bit_index;
-            }
+    for( uint16_t b = 0; b < 256; ++b )
+    {
+        if( lengths[b] != 0 ) symbols.push_back( static_cast<UByte>( b ) );
+    }
+
+    std::stable_sort( symbols.begin(), symbols.end(), [&lengths]( UByte a, UByte b ) {
+        return lengths[a] < lengths[b];
+    } );
+
+    Uint length = 1;
+
+    for( auto sym : symbols )
+    {
+        while( count[length] == 0 ) ++length;
+
+        lengths[sym] = length;
+        --count[length];
+    }
+
+    return true;
+}
+
+//========================================================================
+//
+MsgNum HuffmanCoder::encodeWithCode( const std::vector<UByte>& inData,
+                                     const HuffmanCode& code,
+                                     std::vector<UByte>& outData,
+                                     DecoderParameters& dec_params )
+{
+    const auto& codes   = code.codes_;
+    const auto& lengths = code.lengths_;
+
+    // Then build the output stream, most significant bit first. Bits 
+    // collect in an accumulator and are flushed 32 at a time; 
+    // codewords are under 32 bits, so it never overflows.
+    // The output is sized for the worst case up front and trimmed 
+    // afterwards.
+    outData.resize( ( inData.size() * code.dec_params_.max_cw_len_ + 7 ) / 8 );
+
+    UByte*   out      = outData.data();
+    uint64_t acc      = 0;
+    Uint     acc_bits = 0;
+
+    for( auto sym : inData )
+    {
+        acc       = ( acc << lengths[sym] ) | codes[sym];
+        acc_bits += lengths[sym];
+
+        if( acc_bits >= 32 )
+        {
+            acc_bits -= 32;
+            const uint32_t word = static_cast<uint32_t>( acc >> acc_bits );
+            *out++ = static_cast<UByte>( word >> 24 );
+            *out++ = static_cast<UByte>( word >> 16 );
+            *out++ = static_cast<UByte>( word >> 8 );
+            *out++ = static_cast<UByte>( word );
         }
     }
 
-    // Ensure that the last (possibly incomplete) byte of data gets added 
-    // to the encoded data stream.
-    if( bit_index != 0 )
+    // Ensure that the remaining (possibly incomplete) bytes of data get
+    // added to the encoded data stream.
+    while( acc_bits >= 8 )
     {
-        curr_byte = curr_byte << ( 8 - bit_index );
-        outData.push_back( curr_byte );
+        acc_bits -= 8;
+        *out++ = static_cast<UByte>( acc >> acc_bits );
     }
 
-    dec_params.decoder_LUT_ = std::move( decoder_lookup_table );
-    dec_params.max_cw_len_  = hTree.max_depth_;
-    dec_params.num_bytes_   = inData.size();
+    if( acc_bits != 0 )
+    {
+        *out++ = static_cast<UByte>( acc << ( 8 - acc_bits ) );
+    }
+
+    outData.resize( out - outData.data() );
+
+    dec_params            = code.dec_params_;
+    dec_params.num_bytes_ = inData.size();
 
     return STATUS_OKAY;
 }
 
+//========================================================================
+//
+MsgNum HuffmanCoder::encodeSegment( const std::vector<UByte>& inData,
+                                    std::vector<UByte>& segment,
+                                    const HuffmanCode* code )
+{
+    segment.clear();
+
+    // Nothing to store for empty input.
+    if( inData.empty() ) return STATUS_OKAY;
+
+    DecoderParameters  dec_params;
+    std::vector<UByte> encoded_body;
+
+    MsgNum err = code != nullptr
+               ? encodeWithCode( inData, *code, encoded_body, dec_params )
+               : encodePerByte( inData, encoded_body, dec_params );
+    if( err ) return err;
+
+    // Store the Huffman coding related information needed for
+    // decoding.
+    // 2 bytes : Max cw length
+    util::appendBigEndian( segment, dec_params.max_cw_len_, 2 );
+
+    // 8 bytes : Num bytes of input.
+    util::appendBigEndian( segment, dec_params.num_bytes_, 8 );
+
+    // Now we need the decoder symbol LUT created by the Huffman encoder.
+    // Put the size in first - 2 bytes. A code given by the caller is 
+    // not stored, and is marked by a size of zero.
+    if( code != nullptr )
+    {
+        dec_params.decoder_LUT_.clear();
+    }
+
+    util::appendBigEndian( segment, dec_params.decoder_LUT_.size(), 2 );
+
+    // Encoding format per entry is
+    // | old_sym | new_sym_length | new_sym |
+    for( auto entry : dec_params.decoder_LUT_ )
+    {
+        segment.push_back( entry.old_sym_ );
+        segment.push_back( entry.new_sym_len_ );
+        util::appendBigEndian( segment, entry.new_sym_, 4 );
+    }
+
+    // Finally, append the compressed data.
+    segment.insert( segment.end(), encoded_body.begin(), encoded_body.end() );
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+bool HuffmanCoder::isValidTable( const DecoderParameters& params )
+{
+    const Uint max_len = params.max_cw_len_;
+
+    if( max_len == 0 || max_len > kMAX_CODE_LENGTH || params.decoder_LUT_.size() < 2 ) return false;
+
+    // The codewords, left aligned to max_len bits, must be in order 
+    // and tile the lookup table exactly.
+    uint64_t next = 0;
+
+    for( const auto& entry : params.decoder_LUT_ )
+    {
+        if( entry.new_sym_len_ == 0 || entry.new_sym_len_ > max_len || entry.new_sym_ != next )
+        {
+            return false;
+        }
+
+        next += uint64_t( 1 ) << ( max_len - entry.new_sym_len_ );
+    }
+
+    return next == uint64_t( 1 ) << max_len;
+}
+
+//========================================================================
+//
+MsgNum HuffmanCoder::decodeSegment( const UByte* segment,
+                                    size_t segment_size,
+                                    size_t max_size,
+                                    std::vector<UByte>& outData,
+                                    const HuffmanCode* code )
+{
+    outData.clear();
+
+    // An empty segment is empty data.
+    if( segment_size == 0 ) return STATUS_OKAY;
+
+    size_t pos = 0;
+
+    if( segment_size < 12 ) return printMsg( BAD_DATA );
+
+    // Extract and rebuild the decoder parameters struct.
+    DecoderParameters dec_params;
+    dec_params.max_cw_len_ = static_cast<uint16_t>( util::readBigEndian( segment, pos, 2 ) );
+    dec_params.num_bytes_  = util::readBigEndian( segment, pos, 8 );
+
+    const size_t table_size = static_cast<size_t>( util::readBigEndian( segment, pos, 2 ) );
+    const size_t num_bytes  = static_cast<size_t>( dec_params.num_bytes_ );
+
+    if( num_bytes > max_size || pos + table_size * 6 > segment_size )
+    {
+        return printMsg( BAD_DATA );
+    }
+
+    // The lookup table data.
+    for( size_t i = 0; i < table_size; ++i )
+    {
+        UByte old_sym     = segment[pos++];
+        UByte new_sym_len = segment[pos++];
+        uint64_t new_sym  = util::readBigEndian( segment, pos, 4 );
+
+        dec_params.decoder_LUT_.push_back( DecoderLUTEntry( old_sym, new_sym, new_sym_len ) );
+    }
+
+    // No table means the caller's code.
+    if( table_size == 0 )
+    {
+        if( code == nullptr ) return printMsg( BAD_DATA );
+
+        dec_params            = code->dec_params_;
+        dec_params.num_bytes_ = num_bytes;
+    }
+    else if( !isValidTable( dec_params ) )
+    {
+        return printMsg( BAD_DATA );
+    }
+
+    if( pos >= segment_size ) return printMsg( BAD_DATA );
+
+    // Decompress the data portion in place, directly into the output.
+    outData.resize( num_bytes );
+
+    return decode( segment + pos, segment_size - pos, outData.data(), dec_params );
+}
+
 //========================================================================
 //
 MsgNum HuffmanCoder::decode( const std::vector<UByte>& inData, 
                              std::vector<UByte>& outData, 
                              const DecoderParameters& params )
+{
+    outData.resize( params.num_bytes_ );
+
+    return decode( inData, outData.data(), params );
+}
+
+//========================================================================
+//
+MsgNum HuffmanCoder::decode( const std::vector<UByte>& inData, 
+                             UByte* outData, 
+                             const DecoderParameters& params )
+{
+    return decode( inData.data(), inData.size(), outData, params );
+}
+
+//========================================================================
+//
+MsgNum HuffmanCoder::decode( const UByte* inData, 
+                             size_t size,
+                             UByte* outData, 
+                             const DecoderParameters& params )
 {
     // First we need to construct the lookup table. Length of the new table should be
     // Equal to 2^(max symbol length)
@@ -355,7 +698,7 @@ MsgNum HuffmanCoder::decode( const std::vector<UByte>& inData,
         reconstructed_table[output_table_ind] = currPair;
     }
 
-    BitReader bit_reader( inData );
+    BitReader bit_reader( inData, size );
     bool rd_bits_success = false;
     uint64_t x = bit_reader.read_bits( params.max_cw_len_, rd_bits_success );
     uint64_t k = 0;
@@ -363,11 +706,9 @@ MsgNum HuffmanCoder::decode( const std::vector<UByte>& inData,
     uint64_t word_len_mask = ( 1 << params.max_cw_len_ ) - 1;
 
     // Now write to the uncompressed data to the output buffer.
-    outData.clear();
-
     for( size_t i = 0; i < params.num_bytes_; ++i )
     {
-        outData.push_back( reconstructed_table[x].old_sym_ );
+        outData[i] = reconstructed_table[x].old_sym_;
         uint64_t len = reconstructed_table[x].new_sym_len_;
 
         x = x << len;
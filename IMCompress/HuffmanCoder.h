@@ -2,6 +2,7 @@
 
 #include "Util.h"
 #include <vector>
+#include <array>
 #include <unordered_map>
 
 //--------------------------------------------------------------
@@ -20,7 +21,7 @@ template<typename Sym>
 using SymbolTable = std::unordered_map<Sym, CompressedSymbol<Sym>>;
 
 //--------------------------------------------------------------
-//
+// A node owns its children.
 template<typename Sym>
 struct Node 
 {
@@ -31,17 +32,30 @@ struct Node
         child_[1] = nullptr;
     }
 
+    ~Node()
+    {
+        delete child_[0];
+        delete child_[1];
+    }
+
     Node* child_[2];
     Sym   symbol_;
+
+private:
+
+    Node( const Node& ) = delete;
+    Node& operator=( const Node& ) = delete;
 };
 
 //--------------------------------------------------------------
-//
+// The tree owns its nodes, which are freed with it.
 template<typename Sym>
 struct HuffmanTree
 {
     HuffmanTree();
 
+    ~HuffmanTree();
+
     MsgNum constructSymbolTable();
 
     Node<Sym>*       root_;
@@ -54,6 +68,9 @@ private:
                    const std::string& currBinStr );
 
     Sym str2bin( const std::string& binStr );
+
+    HuffmanTree( const HuffmanTree& ) = delete;
+    HuffmanTree& operator=( const HuffmanTree& ) = delete;
 };
 
 //--------------------------------------------------------------
@@ -83,6 +100,10 @@ class BitReader
 {
 public:
 
+    //--------------------------------------------------------------
+    // Reads size bytes in place, which must outlive the reader.
+    BitReader( const UByte* bit_stream, size_t size );
+
     //--------------------------------------------------------------
     //
     BitReader( const std::vector<UByte>& bit_stream );
@@ -93,18 +114,56 @@ public:
 
 private:
 
-    const std::vector<UByte>& stream_;
-    UByte                     curr_byte_;
-    Uint                      byte_index_;
-    Uint                      bit_index_;
+    const UByte* stream_;
+    size_t       size_;
+    UByte        curr_byte_;
+    size_t       byte_index_;
+    Uint         bit_index_;
 };  
 
+//--------------------------------------------------------------
+// Counterpart of BitReader: appends bits to a byte stream, most
+// significant bit first. Bits collect in a 64-bit accumulator and 
+// are flushed a byte at a time.
+class BitWriter
+{
+public:
+
+    //--------------------------------------------------------------
+    //
+    BitWriter( std::vector<UByte>& bit_stream );
+
+    //--------------------------------------------------------------
+    // Writes the low numBits bits of bits. numBits is at most 32.
+    void write_bits( uint32_t bits, Uint numBits )
+    {
+        acc_       = ( acc_ << numBits ) | ( bits & ( ( uint64_t( 1 ) << numBits ) - 1 ) );
+        acc_bits_ += numBits;
+
+        while( acc_bits_ >= 8 )
+        {
+            acc_bits_ -= 8;
+            stream_.push_back( static_cast<UByte>( acc_ >> acc_bits_ ) );
+        }
+    }
+
+    //--------------------------------------------------------------
+    // Writes out any incomplete last byte, padded with zero bits.
+    void flush();
+
+private:
+
+    std::vector<UByte>& stream_;
+    uint64_t            acc_;
+    Uint                acc_bits_;
+};
+
 //--------------------------------------------------------------
 //
 struct DecoderParameters
 {
-    // Maximum codeword length, which is equal to the height
-    // of the Huffman tree.
+    // Maximum codeword length, at most
+    // HuffmanCoder::kMAX_CODE_LENGTH.
     uint16_t                     max_cw_len_;
 
     // Number of bytes (the length) of the supplied input.
@@ -115,6 +174,19 @@ struct DecoderParameters
     std::vector<DecoderLUTEntry> decoder_LUT_;
 };
 
+//--------------------------------------------------------------
+// A per-byte code ready to encode with, indexed by symbol. Building
+// one is far more work than a short encode, so a code can be built
+// once and reused.
+struct HuffmanCode
+{
+    std::array<uint32_t, 256> codes_;
+    std::array<UByte, 256>    lengths_;
+
+    // Everything but num_bytes_, which is left at zero.
+    DecoderParameters         dec_params_;
+};
+
 //--------------------------------------------------------------
 //
 class HuffmanCoder
@@ -138,9 +210,77 @@ public:
                           std::vector<UByte>& outData,
                           DecoderParameters& params );
 
+    //--------------------------------------------------------------
+    // Builds the Huffman code for the given symbol frequencies. 
+    // Symbols with a frequency of zero get no codeword. Codewords are
+    // limited to kMAX_CODE_LENGTH bits. Codes that had to be limited
+    // are canonical: ordered by length, then by symbol.
+    MsgNum buildCode( const std::array<uint64_t, 256>& frequencies,
+                      HuffmanCode& code );
+
+    //--------------------------------------------------------------
+    // As encodePerByte(), but with a code built up front, which 
+    // saves counting the symbols when the distribution is known. 
+    // Every byte value in inData must have a codeword.
+    MsgNum encodeWithCode( const std::vector<UByte>& inData,
+                           const HuffmanCode& code,
+                           std::vector<UByte>& outData,
+                           DecoderParameters& params );
+
+    //--------------------------------------------------------------
+    // Codes inData into a self-contained segment: the decoder 
+    // parameters, then the coded bits. With a code given, that code 
+    // is used and its table is left out, so decodeSegment() needs the
+    // same code. Empty input gives an empty segment.
+    MsgNum encodeSegment( const std::vector<UByte>& inData,
+                          std::vector<UByte>& segment,
+                          const HuffmanCode* code = nullptr );
+
+    //--------------------------------------------------------------
+    // Inverse of encodeSegment(). Fails if the segment would decode
+    // to more than max_size bytes.
+    MsgNum decodeSegment( const UByte* segment,
+                          size_t segment_size,
+                          size_t max_size,
+                          std::vector<UByte>& outData,
+                          const HuffmanCode* code = nullptr );
+
     //--------------------------------------------------------------
     //
     MsgNum decode( const std::vector<UByte>& inData,
                    std::vector<UByte>& outData,
                    const DecoderParameters& dec_params );
+
+    //--------------------------------------------------------------
+    // As above, but writes the dec_params.num_bytes_ decoded bytes to
+    // a buffer supplied by the caller.
+    MsgNum decode( const std::vector<UByte>& inData,
+                   UByte* outData,
+                   const DecoderParameters& dec_params );
+
+    //--------------------------------------------------------------
+    // As above, reading size bytes of coded data in place, e.g. the
+    // body of a segment.
+    MsgNum decode( const UByte* inData,
+                   size_t size,
+                   UByte* outData,
+                   const DecoderParameters& dec_params );
+
+    // Longest codeword. Bounds the decoder's lookup table, which has
+    // an entry per value of this many bits.
+    static const Uint kMAX_CODE_LENGTH = 15;
+
+private:
+
+    //--------------------------------------------------------------
+    // Shortens the codewords of a complete prefix code, given by
+    // lengths indexed by symbol, to at most kMAX_CODE_LENGTH bits,
+    // keeping it complete. Longer codewords stay with the symbols
+    // that had them. Returns false if none needed shortening.
+    static bool limitLengths( std::array<Uint, 256>& lengths );
+
+    //--------------------------------------------------------------
+    // Checks that a table read from a segment forms a complete prefix
+    // code that decode() can safely expand.
+    static bool isValidTable( const DecoderParameters& dec_params );
 };
@@ -2,8 +2,12 @@
 #include "IM3Coder.h"
 
 #include "HuffmanCoder.h"
+#include "Checksum.h"
+#include "Container.h"
+#include "ThreadPool.h"
 
 #include <array>
+#include <limits>
 
 //========================================================================
 //
@@ -97,8 +101,9 @@ void DCT::dequantize( Matrix& block )
 
 //========================================================================
 //
-IM3Coder::IM3Coder( double compressionRatio )
+IM3Coder::IM3Coder( double compressionRatio, uint32_t tile_size )
     : compression_factor_( compressionRatio )
+    , tile_size_( tile_size )
 {
 
 }
@@ -115,164 +120,452 @@ IM3Coder::~IM3Coder()
 MsgNum IM3Coder::encode( const BmpData& inData,
                          std::vector<UByte>& outData )
 {
+    outData.clear();
+
+    MemorySink sink( outData );
+
+    return encode( inData, sink );
+}
+
+//========================================================================
+//
+MsgNum IM3Coder::encode( const BmpData& inData,
+                         OutputSink& sink )
+{
+    if( tile_size_ > 0 ) return encodeTiled( inData, sink );
+
     // We can write width and height now.
     IM3CoderParameters coder_params;
     coder_params.imgW = inData.width_;
     coder_params.imgH = inData.height_;
 
     std::vector<UByte> encoded_data;
-    lossyEncode( coder_params, inData.body_, encoded_data );
+
+    if( inData.format_ == BmpPixelFormat::BGR24 && !inData.top_down_ )
+    {
+        lossyEncode( coder_params, inData.bodyData(), inData.bodySize(), encoded_data );
+    }
+    else
+    {
+        // Other formats are brought to packed BGR first, bottom row 
+        // first like a 24-bit body. Alpha is not coded.
+        std::vector<Color256> pixels( inData.numRows() * inData.width_ );
+
+        MsgNum err = BmpDecoder::toPixels( inData, pixels.data() );
+        if( err ) return printMsg( err );
+
+        std::vector<UByte> bgr;
+        bgr.reserve( pixels.size() * 3 );
+
+        for( const auto& pixel : pixels )
+        {
+            bgr.push_back( pixel.b );
+            bgr.push_back( pixel.g );
+            bgr.push_back( pixel.r );
+        }
+
+        lossyEncode( coder_params, bgr.data(), bgr.size(), encoded_data );
+    }
 
     // Now assemble the compressed output file:
-    // First we encode the 8-byte header: | 0 I M 3 | imgw | imgH |
-    // The "0 I M 3" is 4 bytes, and the width/height are 2-byte unsigned 
-    // integers.
-    outData.clear();
-    outData.push_back( '0' );
-    outData.push_back( 'I' );
-    outData.push_back( 'M' );
-    outData.push_back( '3' );
-    
-    outData.push_back( ( coder_params.imgW >> 8 ) & 0xff );
-    outData.push_back( coder_params.imgW & 0xff );
-    outData.push_back( ( coder_params.imgH >> 8 ) & 0xff );
-    outData.push_back( coder_params.imgH & 0xff );
+    // First we encode the 12-byte header: | 1 I M 3 | imgW | imgH |
+    // The leading character is the header version. Version 1 stores
+    // the width/height as 4-byte unsigned integers; version 0 files, 
+    // with 2-byte dimensions, can still be decoded.
+    std::vector<UByte> header = { '1', 'I', 'M', '3' };
 
+    util::appendBigEndian( header, coder_params.imgW, 4 );
+    util::appendBigEndian( header, coder_params.imgH, 4 );
 
     // -------------------------------------------------------------
-    // Perform lossless Huffman encoding on the image body.
+    // Perform lossless Huffman encoding on the image body, as one
+    // segment carrying its own code table.
     HuffmanCoder       huffCoder;
-    DecoderParameters  dec_params;
-
     std::vector<UByte> huffman_encoded;
 
-    MsgNum err = huffCoder.encodePerByte( encoded_data, huffman_encoded, dec_params );
+    MsgNum err = huffCoder.encodeSegment( encoded_data, huffman_encoded );
     if( err ) return err;
 
-    // Assemble the output file.
+    // The header is the table chunk of the container, the segment its
+    // single data chunk.
+    sink.reserve( static_cast<size_t>( ChunkWriter::containerSize( header.size() + huffman_encoded.size(), 2 ) ) );
 
-    // Store the Huffman coding related information needed for
-    // decoding.
-    // 2 bytes : Max cw length
-    outData.push_back( ( dec_params.max_cw_len_ >> 8 ) & 0xff );
-    outData.push_back( dec_params.max_cw_len_ & 0xff );
+    ChunkWriter writer( sink, ContainerFormat::IM3 );
+    writer.writeChunk( kCHUNK_TABL, header.data(), header.size() );
+    writer.writeChunk( kCHUNK_DATA, huffman_encoded.data(), huffman_encoded.size() );
 
-    // 8 bytes : Num bytes of pixel data in input file.
-    for( Uint i = 7; i < 8; --i )
+    return writer.finish();
+}
+
+//========================================================================
+//
+MsgNum IM3Coder::decode( const std::vector<UByte>& inData,
+                         BmpData& outData )
+{
+    return decode( inData.data(), inData.size(), outData );
+}
+
+//========================================================================
+//
+MsgNum IM3Coder::decode( const UByte* inData,
+                         size_t size,
+                         BmpData& outData )
+{
+    // Files in the chunked container are checked whole before any of
+    // them is decoded. The header and body are then read in place, 
+    // from the chunks they were written to; a plain file is a single
+    // chunk holding both.
+    std::vector<ChunkSpan> chunks;
+
+    if( ChunkReader::isChunked( inData, size ) )
+    {
+        MsgNum err = ChunkReader::verify( inData, size, ContainerFormat::IM3, chunks );
+        if( err ) return err;
+    }
+    else
     {
-        outData.push_back( ( dec_params.num_bytes_ >> ( i * 8 ) ) & 0xff );
+        chunks.push_back( { inData, size, 0 } );
     }
 
-    // Now we need the decoder symbol LUT created by the Huffman encoder.
-    // Put the size in first - 2 bytes.
-    uint16_t tableSize = dec_params.decoder_LUT_.size();
-    outData.push_back( ( tableSize >> 8 ) & 0xff );
-    outData.push_back( tableSize & 0xff );
+    const UByte* header       = chunks[0].data_;
+    const size_t header_size  = chunks[0].size_;
+    const size_t payload_size = static_cast<size_t>( ChunkReader::payloadSize( chunks ) );
 
-    // Encoding format per entry is
-    // | old_sym | new_sym | new_sym_length |
-    for( auto entry : dec_params.decoder_LUT_ )
-    {
-        outData.push_back( entry.old_sym_ );
-        outData.push_back( entry.new_sym_len_ );
+    if( header_size < 8 || header[1] != 'I' || header[2] != 'M' || header[3] != '3' ) return printMsg( BAD_DATA );
 
-        for( Uint i = 3; i < 4; --i )
-        {
-            outData.push_back( ( entry.new_sym_ >> ( i * 8 ) ) & 0xff );
-        }
-    }
+    // Tiled files find their tiles through the directory.
+    if( header[0] == '2' ) return decodeTiled( inData, size, outData );
 
-    // -------------------------------------------------------------
-    // Now write the actual encoded data to the binary output.
-    for( auto b : huffman_encoded )
+    // First we must construct the decoder parameters to pass to the
+    // decoder. This only includes the width and height of the image,
+    // whose size depends on the header version.
+    IM3CoderParameters coder_params;
+
+    size_t pos = 4;
+
+    if( header[0] == '0' )
+    {
+        coder_params.imgW = static_cast<uint32_t>( util::readBigEndian( header, pos, 2 ) );
+        coder_params.imgH = static_cast<uint32_t>( util::readBigEndian( header, pos, 2 ) );
+    }
+    else if( header[0] == '1' && header_size >= 12 )
+    {
+        coder_params.imgW = static_cast<uint32_t>( util::readBigEndian( header, pos, 4 ) );
+        coder_params.imgH = static_cast<uint32_t>( util::readBigEndian( header, pos, 4 ) );
+    }
+    else
     {
-        outData.push_back( b );
+        return printMsg( BAD_DATA );
     }
 
+    std::vector<UByte> decoded_data;
+
+    // -------------------------------------------------------------
+    // Decode the Huffman-encoded body, which is a single segment
+    // read in place after the dimensions.
+    const UByte* body = ChunkReader::locate( chunks, pos, payload_size - pos );
+    if( !body ) return printMsg( BAD_DATA );
+
+    HuffmanCoder huffCoder;
+    std::vector<UByte> huffman_decoded;
+    MsgNum err = huffCoder.decodeSegment( body, payload_size - pos, std::numeric_limits<size_t>::max(), huffman_decoded );
+    if( err ) return err;
+
+    // -------------------------------------------------------------
+    // Decode the pixel data.
+    err = lossyDecode( coder_params, huffman_decoded, decoded_data );
+    if( err ) return err;
+    
+    // Allocate the data into the struct.
+
+    outData.header_view_ = nullptr;
+    outData.body_view_   = nullptr;
+    outData.height_      = coder_params.imgH;
+    outData.width_  = coder_params.imgW;
+    outData.pixels_ = std::move( util::RGB2Color256( decoded_data ) );
+
     return STATUS_OKAY;
 }
 
 //========================================================================
 //
-MsgNum IM3Coder::decode( const std::vector<UByte>& inData,
-                         BmpData& outData )
+MsgNum IM3Coder::encodeTiled( const BmpData& inData,
+                              OutputSink& sink )
 {
-    // First we must construct the decoder parameters to pass to the
-    // decoder. This only includes the width and height of the image.
-    IM3CoderParameters coder_params;
+    IM3TileDirectory directory;
+    directory.imgW_      = inData.width_;
+    directory.imgH_      = inData.height_;
+    directory.tile_size_ = std::max<uint32_t>( 16, tile_size_ - tile_size_ % 16 );
+    directory.tiles_x_   = ( directory.imgW_ + directory.tile_size_ - 1 ) / directory.tile_size_;
+    directory.tiles_y_   = ( directory.imgH_ + directory.tile_size_ - 1 ) / directory.tile_size_;
 
-    coder_params.imgW = ( ( inData[4] << 8 ) | inData[5] ) & 0xffff;
-    coder_params.imgH = ( ( inData[6] << 8 ) | inData[7] ) & 0xffff;
+    const size_t num_tiles = directory.tiles_x_ * directory.tiles_y_;
+    const size_t num_rows  = inData.numRows();
 
-    std::vector<UByte> decoded_data;
+    // Tiles read 24-bit rows straight from the pixel data. Any other
+    // layout is converted to pixels once up front.
+    const bool direct = inData.format_ == BmpPixelFormat::BGR24 && !inData.top_down_;
+
+    std::vector<Color256> pixels;
 
-    // Copy the remaining data to a new buffer that we can directly 
-    // pass to lossyDecode().
-    std::vector<UByte> data_to_decode;
-    for( Uint i = 8; i < inData.size(); ++i )
+    if( !direct )
     {
-        data_to_decode.push_back( inData[i] );
+        pixels.resize( num_rows * inData.width_ );
+
+        MsgNum err = BmpDecoder::toPixels( inData, pixels.data() );
+        if( err ) return printMsg( err );
     }
 
-    // -------------------------------------------------------------
-    // Decode the Huffman-encoded body.
-    // Extract and rebuild the decoder parameters struct.
-    // Max cw length.
-    Uint pos = 0;
-    DecoderParameters dec_params = { 0 };
-    dec_params.max_cw_len_ |= data_to_decode[pos++] << 8;
-    dec_params.max_cw_len_ |= data_to_decode[pos++];
+    // Code every tile on its own. Rows missing from a short file are
+    // coded as black.
+    std::vector<std::vector<UByte>> payloads( num_tiles );
+    std::vector<MsgNum>             results( num_tiles, STATUS_OKAY );
+
+    ThreadPool::shared().parallelFor( num_tiles, [&]( size_t t )
+    {
+        const size_t tile_x = directory.tileX( t );
+        const size_t tile_y = directory.tileY( t );
+        const size_t tile_w = directory.tileWidth( t );
+        const size_t tile_h = directory.tileHeight( t );
+
+        std::vector<UByte> bgr( tile_w * tile_h * 3, 0 );
+
+        for( size_t y = 0; y < tile_h && tile_y + y < num_rows; ++y )
+        {
+            UByte* dst = bgr.data() + y * tile_w * 3;
+
+            if( direct )
+            {
+                const UByte* src = inData.row( tile_y + y ) + tile_x * 3;
+                std::copy( src, src + tile_w * 3, dst );
+                continue;
+            }
+
+            const Color256* src = pixels.data() + ( tile_y + y ) * inData.width_ + tile_x;
+
+            for( size_t x = 0; x < tile_w; ++x )
+            {
+                *dst++ = src[x].b;
+                *dst++ = src[x].g;
+                *dst++ = src[x].r;
+            }
+        }
+
+        IM3CoderParameters coder_params;
+        coder_params.imgW = static_cast<uint32_t>( tile_w );
+        coder_params.imgH = static_cast<uint32_t>( tile_h );
+
+        std::vector<UByte> encoded_data;
+        results[t] = lossyEncode( coder_params, bgr.data(), bgr.size(), encoded_data );
+        if( results[t] ) return;
+
+        HuffmanCoder huffCoder;
+        results[t] = huffCoder.encodeSegment( encoded_data, payloads[t] );
+    } );
 
-    // Number of bytes in compressed data portion.
-    for( Uint i = 0; i < 8; ++i )
+    for( auto err : results )
     {
-        dec_params.num_bytes_ = dec_params.num_bytes_ << 8 | data_to_decode[pos++];
+        if( err ) return err;
     }
 
-    // Decoder lookup table size.
-    uint16_t table_size = ( data_to_decode[pos++] << 8 );
-    table_size |= data_to_decode[pos++];
+    // Header: | 2 I M 3 | imgW | imgH | tile size |, 4 bytes each.
+    std::vector<UByte> table = { '2', 'I', 'M', '3' };
 
-    //std::cout << table_size;
+    util::appendBigEndian( table, directory.imgW_, 4 );
+    util::appendBigEndian( table, directory.imgH_, 4 );
+    util::appendBigEndian( table, directory.tile_size_, 4 );
 
-    // The lookup table data.
-    for( Uint i = 0; i < table_size; ++i )
+    // Tile directory: 8 bytes offset from the end of the directory,
+    // 8 bytes size and 4 bytes CRC-32C per tile.
+    uint64_t offset = 0;
+    for( const auto& payload : payloads )
     {
-        UByte old_sym = data_to_decode[pos++];
-        UByte new_sym_len = data_to_decode[pos++];
+        util::appendBigEndian( table, offset, 8 );
+        util::appendBigEndian( table, payload.size(), 8 );
+        util::appendBigEndian( table, util::crc32c( payload.data(), payload.size() ), 4 );
+        offset += payload.size();
+    }
+
+    // Header and directory form the table chunk, and every tile gets a
+    // data chunk, so tiles stay at predictable places in the file.
+    sink.reserve( static_cast<size_t>( ChunkWriter::containerSize( table.size() + offset, num_tiles + 1 ) ) );
+
+    ChunkWriter writer( sink, ContainerFormat::IM3 );
+    writer.writeChunk( kCHUNK_TABL, table.data(), table.size() );
+
+    for( const auto& payload : payloads )
+    {
+        writer.writeChunk( kCHUNK_DATA, payload.data(), payload.size() );
+    }
+
+    return writer.finish();
+}
+
+//========================================================================
+//
+MsgNum IM3Coder::decodeTiled( const UByte* inData,
+                              size_t size,
+                              BmpData& outData )
+{
+    IM3TileDirectory directory;
+
+    MsgNum err = readTileDirectory( inData, size, directory );
+    if( err ) return err;
+
+    // Every payload must lie within the file.
+    for( size_t t = 0; t < directory.tiles_.size(); ++t )
+    {
+        const IM3TileEntry& entry = directory.tiles_[t];
+
+        if( entry.offset_ > size || entry.size_ > size || directory.payloadOffset( t ) > size - entry.size_ )
+        {
+            return printMsg( BAD_DATA );
+        }
+    }
+
+    outData.header_view_ = nullptr;
+    outData.body_view_   = nullptr;
+    outData.width_       = directory.imgW_;
+    outData.height_      = directory.imgH_;
+    outData.pixels_.assign( static_cast<size_t>( directory.imgW_ ) * directory.imgH_, Color256() );
+
+    // Decode the tiles in parallel, each straight into its place.
+    std::vector<MsgNum> results( directory.tiles_.size(), STATUS_OKAY );
+
+    ThreadPool::shared().parallelFor( directory.tiles_.size(), [&]( size_t t )
+    {
+        const IM3TileEntry& entry = directory.tiles_[t];
+
+        std::vector<Color256> tile_pixels;
+        results[t] = decodeTile( directory, t, 
+                                 inData + directory.payloadOffset( t ), 
+                                 static_cast<size_t>( entry.size_ ), 
+                                 tile_pixels );
+        if( results[t] ) return;
 
-        uint64_t new_sym = 0;
+        const size_t tile_w = directory.tileWidth( t );
 
-        for( Uint i = 0; i < 4; ++i )
+        for( size_t y = 0; y < directory.tileHeight( t ); ++y )
         {
-            new_sym = ( new_sym << 8 ) | data_to_decode[pos++];
+            const auto src = tile_pixels.begin() + y * tile_w;
+            std::copy( src, src + tile_w, outData.pixels_.begin() + ( directory.tileY( t ) + y ) * directory.imgW_ + directory.tileX( t ) );
         }
+    } );
 
-        dec_params.decoder_LUT_.push_back( DecoderLUTEntry( old_sym, new_sym, new_sym_len ) );
+    for( auto result : results )
+    {
+        if( result ) return result;
+    }
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum IM3Coder::readTileDirectory( const UByte* inData,
+                                    size_t size,
+                                    IM3TileDirectory& directory )
+{
+    // In the chunked container the header and directory are the table
+    // chunk, and each payload sits inside a data chunk.
+    if( ChunkReader::isChunked( inData, size ) )
+    {
+        size_t pos = 0;
+
+        MsgNum err = ChunkReader::readHead( inData, size, ContainerFormat::IM3, pos );
+        if( err ) return err;
+
+        uint32_t     type;
+        const UByte* table;
+        size_t       table_size;
+
+        err = ChunkReader::readChunk( inData, size, pos, type, table, table_size );
+        if( err ) return err;
+
+        if( type != kCHUNK_TABL ) return printMsg( BAD_DATA );
+
+        err = readTileDirectory( table, table_size, directory );
+        if( err ) return err;
+
+        directory.data_offset_ = pos;
+        directory.chunked_     = true;
+
+        return STATUS_OKAY;
     }
 
-    std::vector<UByte> compressed_data_block;
+    directory.chunked_ = false;
 
-    for( ; pos < data_to_decode.size(); ++pos )
+    if( size < 16 || inData[0] != '2' || inData[1] != 'I' || inData[2] != 'M' || inData[3] != '3' )
     {
-        compressed_data_block.push_back( data_to_decode[pos] );
+        return printMsg( BAD_DATA );
     }
 
-    // Decompress the data portion.
-    HuffmanCoder huffCoder;
+    size_t pos = 4;
+    directory.imgW_      = static_cast<uint32_t>( util::readBigEndian( inData, pos, 4 ) );
+    directory.imgH_      = static_cast<uint32_t>( util::readBigEndian( inData, pos, 4 ) );
+    directory.tile_size_ = static_cast<uint32_t>( util::readBigEndian( inData, pos, 4 ) );
+
+    if( directory.tile_size_ == 0 ) return printMsg( BAD_DATA );
+
+    directory.tiles_x_ = ( static_cast<size_t>( directory.imgW_ ) + directory.tile_size_ - 1 ) / directory.tile_size_;
+    directory.tiles_y_ = ( static_cast<size_t>( directory.imgH_ ) + directory.tile_size_ - 1 ) / directory.tile_size_;
+
+    // 20 bytes per directory entry.
+    const size_t num_tiles = directory.tiles_x_ * directory.tiles_y_;
+    if( ( size - pos ) / 20 < num_tiles ) return printMsg( BAD_DATA );
+
+    directory.tiles_.resize( num_tiles );
+    for( auto& entry : directory.tiles_ )
+    {
+        entry.offset_   = util::readBigEndian( inData, pos, 8 );
+        entry.size_     = util::readBigEndian( inData, pos, 8 );
+        entry.checksum_ = static_cast<uint32_t>( util::readBigEndian( inData, pos, 4 ) );
+    }
+
+    directory.data_offset_ = pos;
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum IM3Coder::decodeTile( const IM3TileDirectory& directory,
+                             size_t tile,
+                             const UByte* payload,
+                             size_t payload_size,
+                             std::vector<Color256>& pixels )
+{
+    if( tile >= directory.tiles_.size() ) return printMsg( BAD_DATA );
+
+    const IM3TileEntry& entry = directory.tiles_[tile];
+
+    if( payload_size != entry.size_ || util::crc32c( payload, payload_size ) != entry.checksum_ )
+    {
+        return printMsg( BAD_DATA );
+    }
+
+    IM3CoderParameters coder_params;
+    coder_params.imgW = static_cast<uint32_t>( directory.tileWidth( tile ) );
+    coder_params.imgH = static_cast<uint32_t>( directory.tileHeight( tile ) );
+
+    // A tile too small to hold a single block has an empty payload.
     std::vector<UByte> huffman_decoded;
-    MsgNum err = huffCoder.decode( compressed_data_block, huffman_decoded, dec_params );
 
+    if( payload_size > 0 )
+    {
+        HuffmanCoder huffCoder;
+        MsgNum err = huffCoder.decodeSegment( payload, payload_size, std::numeric_limits<size_t>::max(), huffman_decoded );
+        if( err ) return err;
+    }
 
-    // -------------------------------------------------------------
-    // Decode the pixel data.
-    lossyDecode( coder_params, huffman_decoded, decoded_data );
-    
-    // Allocate the data into the struct.
+    std::vector<UByte> decoded_data;
 
-    outData.height_ = coder_params.imgH;
-    outData.width_  = coder_params.imgW;
-    outData.pixels_ = std::move( util::RGB2Color256( decoded_data ) );
+    MsgNum err = lossyDecode( coder_params, huffman_decoded, decoded_data );
+    if( err ) return err;
+
+    pixels = util::RGB2Color256( decoded_data );
+
+    if( pixels.size() != directory.tileWidth( tile ) * directory.tileHeight( tile ) ) return printMsg( BAD_DATA );
 
     return STATUS_OKAY;
 }
@@ -282,6 +575,16 @@ MsgNum IM3Coder::decode( const std::vector<UByte>& inData,
 MsgNum IM3Coder::lossyEncode( IM3CoderParameters& params, 
                               const std::vector<UByte>& inData,
                               std::vector<UByte>& outData )
+{
+    return lossyEncode( params, inData.data(), inData.size(), outData );
+}
+
+//========================================================================
+//
+MsgNum IM3Coder::lossyEncode( IM3CoderParameters& params, 
+                              const UByte* inData,
+                              size_t size,
+                              std::vector<UByte>& outData )
 {
     // Pass in the quality scale as the second argument. Higher 
     // means lower quality. Must be strictly greater than 0.
@@ -290,7 +593,7 @@ MsgNum IM3Coder::lossyEncode( IM3CoderParameters& params,
     // First convert to YUV space. In the raw bytestream, the 
     // componenets are encoded as BGR, so rgb2yuv will account for 
     // this and flip it back to RGB.
-    std::vector<int16_t> as_yuv = util::rgb2yuv( inData );
+    std::vector<int16_t> as_yuv = util::rgb2yuv( inData, size );
 
     // Split into corresponding YUV components.
     std::array<std::vector<int16_t>, 3> yuv_components;
@@ -300,15 +603,9 @@ MsgNum IM3Coder::lossyEncode( IM3CoderParameters& params,
     util::extractYUVComponents( as_yuv, yuv_components[0], yuv_components[1], yuv_components[2] );
 
 
-    bool downsample_yuv = false;
-    if( params.imgW % 16 == 0 && params.imgH % 16 == 0 )
-    {
-        downsample_yuv = true;
-    }
-    else
-    {
-        std::cout << "Skipping downsampling of U,V channels." << std::endl;
-    }
+    // U and V are only downsampled when the image, or tile, is a
+    // whole number of macroblocks. Otherwise they go at full size.
+    const bool downsample_yuv = params.imgW % 16 == 0 && params.imgH % 16 == 0;
 
     if( downsample_yuv )
     {
@@ -319,11 +616,11 @@ MsgNum IM3Coder::lossyEncode( IM3CoderParameters& params,
     
     // Integer division.. We should assume the height and width are 
     // multiples of 8, however.
-    Uint num_horiz_blocks = params.imgW / 8;
-    Uint num_vert_blocks  = params.imgH / 8;
+    size_t num_horiz_blocks = params.imgW / 8;
+    size_t num_vert_blocks  = params.imgH / 8;
     
     // This has to change when we encode downsampled U, V channels.
-    Uint curr_img_width   = params.imgW;
+    size_t curr_img_width   = params.imgW;
 
     Uint channel_index = 0;
     std::array<std::vector<std::vector<UByte>>, 3> RLE_blocks;
@@ -331,8 +628,8 @@ MsgNum IM3Coder::lossyEncode( IM3CoderParameters& params,
     // Perform the transform on each block of the image and quantize.
     for( auto channel : yuv_components )
     {
-        Uint X = 0;
-        Uint Y = 0;
+        size_t X = 0;
+        size_t Y = 0;
 
         // This is for when we encode the U, V channels, we must 
         // halve the number of blocks in both x, y directions
@@ -343,11 +640,11 @@ MsgNum IM3Coder::lossyEncode( IM3CoderParameters& params,
             curr_img_width   = curr_img_width / 2;
         }
 
-        for( Uint y = 0; y < num_vert_blocks; ++y )
+        for( size_t y = 0; y < num_vert_blocks; ++y )
         {
             Y = y * 8;
 
-            for( Uint x = 0; x < num_horiz_blocks; ++x )
+            for( size_t x = 0; x < num_horiz_blocks; ++x )
             {
                 X = x * 8;
 
@@ -399,8 +696,8 @@ MsgNum IM3Coder::lossyDecode( const IM3CoderParameters& params,
 {
     DCT dct( 8, compression_factor_ );
 
-    Uint num_horiz_blocks = params.imgW / 8;
-    Uint num_vert_blocks = params.imgH / 8;
+    size_t num_horiz_blocks = params.imgW / 8;
+    size_t num_vert_blocks  = params.imgH / 8;
 
     bool upsample_yuv = false;
     if( params.imgW % 16 == 0 && params.imgH % 16 == 0 )
@@ -410,20 +707,29 @@ MsgNum IM3Coder::lossyDecode( const IM3CoderParameters& params,
 
     // Now try to decode the data and reconstruct the image.
     std::array<std::vector<int16_t>, 3> yuv;
-    yuv[0].resize( params.imgW * params.imgH );
-    upsample_yuv ? yuv[1].resize( params.imgW * params.imgH / 4 ) : yuv[1].resize( params.imgW * params.imgH );
-    upsample_yuv ? yuv[2].resize( params.imgW * params.imgH / 4 ) : yuv[2].resize( params.imgW * params.imgH );
+    const size_t num_pixels = static_cast<size_t>( params.imgW ) * params.imgH;
+
+    yuv[0].resize( num_pixels );
+    upsample_yuv ? yuv[1].resize( num_pixels / 4 ) : yuv[1].resize( num_pixels );
+    upsample_yuv ? yuv[2].resize( num_pixels / 4 ) : yuv[2].resize( num_pixels );
 
     // This has to change when we encode downsampled U, V channels...
-    uint16_t curr_img_width = params.imgW;
+    size_t curr_img_width = params.imgW;
 
     // Get the RLE blocks seperated for further processing.
     std::array<std::vector<std::vector<UByte>>, 3> RLE_blocks  =  extractRLEBlocks( inData, num_horiz_blocks  * num_vert_blocks, upsample_yuv );
+
+    // Truncated data gives fewer blocks than the image needs.
+    for( size_t c = 0; c < 3; ++c )
+    {
+        const size_t expected = num_horiz_blocks * num_vert_blocks / ( c > 0 && upsample_yuv ? 4 : 1 );
+        if( RLE_blocks[c].size() != expected ) return printMsg( BAD_DATA );
+    }
     Uint channel_index = 0;
     for( auto channel : RLE_blocks )
     {
-        Uint X = 0;
-        Uint Y = 0;
+        size_t X = 0;
+        size_t Y = 0;
 
         // This is for when we decode the U, V channels, must halve the 
         // number of blocks in both x, y directions
@@ -434,11 +740,11 @@ MsgNum IM3Coder::lossyDecode( const IM3CoderParameters& params,
             curr_img_width = curr_img_width / 2;
         }
 
-        for( Uint y = 0; y < num_vert_blocks; ++y )
+        for( size_t y = 0; y < num_vert_blocks; ++y )
         {
             Y = y * 8;
 
-            for( Uint x = 0; x < num_horiz_blocks; ++x )
+            for( size_t x = 0; x < num_horiz_blocks; ++x )
             {
                 // First decode the linearly compressed zig-zag data
                 // and write it into a block.
@@ -680,12 +986,12 @@ void IM3Coder::decompressVectorBlock( const std::vector<UByte>& src, std::vector
 
 //========================================================================
 //
-std::array<std::vector<std::vector<UByte>>, 3> IM3Coder::extractRLEBlocks( const std::vector<UByte> raw_data, Uint blocksPerChannel, bool upsample )
+std::array<std::vector<std::vector<UByte>>, 3> IM3Coder::extractRLEBlocks( const std::vector<UByte> raw_data, size_t blocksPerChannel, bool upsample )
 {
     std::array<std::vector<std::vector<UByte>>, 3> encoded_blocks;
 
 
-    Uint raw_data_ind = 0;
+    size_t raw_data_ind = 0;
     Uint chan = 0;
 
     while( chan < 3 )
@@ -695,13 +1001,17 @@ std::array<std::vector<std::vector<UByte>>, 3> IM3Coder::extractRLEBlocks( const
             blocksPerChannel = blocksPerChannel / 4;
         }
 
-        Uint b = 0;
+        size_t b = 0;
 
         while( b < blocksPerChannel )
         {
             encoded_blocks[chan].emplace_back();
 
-            while( raw_data[raw_data_ind] != 0 || raw_data[raw_data_ind + 1] != 0 || raw_data[raw_data_ind + 2] != 0 )
+            // Truncated data ends the blocks early, dropping the 
+            // unfinished one.
+            auto atEnd = [&]() { return raw_data_ind + 2 >= raw_data.size(); };
+
+            while( !atEnd() && ( raw_data[raw_data_ind] != 0 || raw_data[raw_data_ind + 1] != 0 || raw_data[raw_data_ind + 2] != 0 ) )
             {
                 encoded_blocks[chan][b].push_back( raw_data[raw_data_ind] );
                 encoded_blocks[chan][b].push_back( raw_data[raw_data_ind + 1] );
@@ -709,6 +1019,12 @@ std::array<std::vector<std::vector<UByte>>, 3> IM3Coder::extractRLEBlocks( const
                 raw_data_ind += 3;
             }
 
+            if( atEnd() )
+            {
+                encoded_blocks[chan].pop_back();
+                return encoded_blocks;
+            }
+
             encoded_blocks[chan][b].push_back( 0 );
             encoded_blocks[chan][b].push_back( 0 );
             encoded_blocks[chan][b].push_back( 0 );
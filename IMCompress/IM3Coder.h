@@ -2,6 +2,8 @@
 
 #include "Util.h"
 #include "BmpDecoder.h"
+#include "Container.h"
+#include "OutputSink.h"
 #include "Matrix.h"
 
 #include <vector>
@@ -39,8 +41,52 @@ struct IM3CoderParameters
         , imgH( 0 )
     { }
 
-    uint16_t imgW;
-    uint16_t imgH;
+    uint32_t imgW;
+    uint32_t imgH;
+};
+
+//--------------------------------------------------------------
+// Where the payload of one tile of a tiled .im3 file sits, relative 
+// to the end of the tile directory, and its CRC-32C.
+struct IM3TileEntry
+{
+    uint64_t offset_;
+    uint64_t size_;
+    uint32_t checksum_;
+};
+
+//--------------------------------------------------------------
+// The tile grid and directory of a tiled .im3 file. Tiles are 
+// tile_size_ pixels square, except along the right and top edges,
+// and are numbered row by row starting from the first row of 
+// BmpData::pixels_, which is the bottom of the image.
+struct IM3TileDirectory
+{
+    size_t tileX( size_t tile ) const      { return ( tile % tiles_x_ ) * tile_size_; }
+    size_t tileY( size_t tile ) const      { return ( tile / tiles_x_ ) * tile_size_; }
+    size_t tileWidth( size_t tile ) const  { return std::min<size_t>( tile_size_, imgW_ - tileX( tile ) ); }
+    size_t tileHeight( size_t tile ) const { return std::min<size_t>( tile_size_, imgH_ - tileY( tile ) ); }
+
+    // Where the tile's payload starts in the file.
+    size_t payloadOffset( size_t tile ) const
+    {
+        const size_t framing = chunked_ ? tile * ( kCHUNK_HEADER_SIZE + kCHUNK_TRAILER_SIZE ) + kCHUNK_HEADER_SIZE : 0;
+
+        return data_offset_ + static_cast<size_t>( tiles_[tile].offset_ ) + framing;
+    }
+
+    uint32_t imgW_      = 0;
+    uint32_t imgH_      = 0;
+    uint32_t tile_size_ = 0;
+    size_t   tiles_x_   = 0;
+    size_t   tiles_y_   = 0;
+
+    // File offset just past the directory, and whether the payloads
+    // are framed as container chunks.
+    size_t   data_offset_ = 0;
+    bool     chunked_     = false;
+
+    std::vector<IM3TileEntry> tiles_;
 };
 
 //--------------------------------------------------------------
@@ -50,8 +96,10 @@ class IM3Coder
 public:
 
     //--------------------------------------------------------------
-    //
-    IM3Coder( double compressionRatio );
+    // A non-zero tile_size codes the image as independent square 
+    // tiles of that size, rounded down to a multiple of 16, which can
+    // be coded in parallel and decoded one at a time.
+    IM3Coder( double compressionRatio, uint32_t tile_size = 0 );
 
     //--------------------------------------------------------------
     //
@@ -62,19 +110,65 @@ public:
     MsgNum encode( const BmpData& inData,
                    std::vector<UByte>& outData );
 
+    //--------------------------------------------------------------
+    // As above, writing the .im3 file to a sink, e.g. a FileSink.
+    MsgNum encode( const BmpData& inData,
+                   OutputSink& sink );
+
     //--------------------------------------------------------------
     //
     MsgNum decode( const std::vector<UByte>& inData,
                    BmpData& outData );
 
+    //--------------------------------------------------------------
+    // As above, reading the data in place, e.g. from a FileSource.
+    MsgNum decode( const UByte* inData,
+                   size_t size,
+                   BmpData& outData );
+
+    //--------------------------------------------------------------
+    // Reads the tile directory of a tiled .im3 file. size need only 
+    // cover the header and the directory, so a viewer can fetch those
+    // first and then just the payloads of the tiles it needs.
+    static MsgNum readTileDirectory( const UByte* inData,
+                                     size_t size,
+                                     IM3TileDirectory& directory );
+
+    //--------------------------------------------------------------
+    // Decodes one tile into tileWidth() * tileHeight() pixels, bottom
+    // row first. payload holds just that tile's bytes, found at 
+    // payloadOffset() in the file, and is checked against the 
+    // directory's checksum before it is decoded.
+    MsgNum decodeTile( const IM3TileDirectory& directory,
+                       size_t tile,
+                       const UByte* payload,
+                       size_t payload_size,
+                       std::vector<Color256>& pixels );
+
     //--------------------------------------------------------------
     //
     MsgNum lossyEncode( IM3CoderParameters& params,
                         const std::vector<UByte>& inData,
                         std::vector<UByte>& outData );
 
+    //--------------------------------------------------------------
+    //
+    MsgNum lossyEncode( IM3CoderParameters& params,
+                        const UByte* inData,
+                        size_t size,
+                        std::vector<UByte>& outData );
+
 private:
 
+    //--------------------------------------------------------------
+    // Tiled versions of encode() and decode().
+    MsgNum encodeTiled( const BmpData& inData,
+                        OutputSink& sink );
+
+    MsgNum decodeTiled( const UByte* inData,
+                        size_t size,
+                        BmpData& outData );
+
     //--------------------------------------------------------------
     //
     MsgNum lossyDecode( const IM3CoderParameters& params, 
@@ -103,12 +197,13 @@ private:
     //--------------------------------------------------------------
     //
     std::array<std::vector<std::vector<UByte>>, 3> extractRLEBlocks( const std::vector<UByte> raw_data, 
-                                                                     Uint blocksPerChannel,
+                                                                     size_t blocksPerChannel,
                                                                      bool upsample );
 
     //--------------------------------------------------------------
     //
-    BmpData compressed_image_;
-    double  compression_factor_;
+    BmpData  compressed_image_;
+    double   compression_factor_;
+    uint32_t tile_size_;
 };
 
@@ -1,56 +1,210 @@
 #include "stdafx.h"
 #include "IN3Coder.h"
 
-#include <array>
-
 #include "HuffmanCoder.h"
+#include "LZ77Coder.h"
 #include "BmpDecoder.h"
+#include "ColourTransform.h"
+#include "Prediction.h"
+#include "ThreadPool.h"
+#include "Container.h"
+
+#include <algorithm>
+#include <cmath>
 
 //========================================================================
-//
-UByte BitExtractor::get_bit()
+// Number of image rows per independently coded stripe.
+static const Uint kSTRIPE_ROWS = 64;
+
+//========================================================================
+// Roughly how much pixel data the row-streaming encoder reads at once.
+static const size_t kSTREAM_BATCH_BYTES = 64 << 20;
+
+//========================================================================
+// Index of the padding stream within IN3StripeStreams. The channel
+// streams come first.
+static const size_t kEXTRA_STREAM = 3;
+
+//========================================================================
+// Index of the run stream within IN3StripeStreams.
+static const size_t kRUN_STREAM = 4;
+
+//========================================================================
+// Shortest run of flat pixels worth taking out of the channel streams.
+// Each pixel left in costs at least 3 bits, a run roughly 2 bytes.
+static const size_t kMIN_RUN = 8;
+
+//========================================================================
+// The fixed Huffman code of IN3Effort::FAST, built on first use.
+// Residuals cluster around zero (modulo 256), so the symbol weights 
+// fall off as |d|^-1.5 with the signed distance d from zero. Every 
+// symbol keeps a non-zero weight, and the longest codeword stays at
+// 12 bits.
+static const HuffmanCode& fixedCode()
+{
+    static const HuffmanCode code = []()
+    {
+        std::array<uint64_t, 256> frequencies;
+
+        for( size_t b = 0; b < 256; ++b )
+        {
+            const size_t d = std::min( b, 256 - b );
+            frequencies[b] = static_cast<uint64_t>( 8192.0 / std::pow( d + 1.0, 1.5 ) ) + 1;
+        }
+
+        HuffmanCode  fixed;
+        HuffmanCoder huffCoder;
+        huffCoder.buildCode( frequencies, fixed );
+
+        return fixed;
+    }();
+
+    return code;
+}
+
+//========================================================================
+// Zeroth-order entropy of the data in bits, used to compare candidate
+// predictions without actually coding them.
+static double entropyBits( const std::vector<UByte>& data )
 {
-    if( bit_index_ < 0 )
+    std::array<uint64_t, 256> counts = {};
+
+    for( auto byte : data )
+    {
+        ++counts[byte];
+    }
+
+    const double total = static_cast<double>( data.size() );
+    double       bits  = 0.0;
+
+    for( auto count : counts )
     {
-        ++byte_index;
-        bit_index_ = 7;
+        if( count != 0 )
+        {
+            bits += count * std::log2( total / count );
+        }
     }
 
-    UByte b = ( stream_[byte_index] >> bit_index_ ) & 0x1;
-    --bit_index_;
+    return bits;
+}
 
-    return b;
+//========================================================================
+// The LZ77 match finder level for each effort.
+static LZ77Level lz77Level( IN3Effort effort )
+{
+    switch( effort )
+    {
+    case IN3Effort::FAST: return LZ77Level::FAST;
+    case IN3Effort::MAX:  return LZ77Level::MAX;
+    default:              return LZ77Level::DEFAULT;
+    }
 }
 
 //========================================================================
 //
-void BitEncoder::append_bit( std::vector<UByte>& arr, UByte bit )
+IN3Layout::IN3Layout( const BmpData& data, size_t body_size, size_t stripe_rows, IN3Alpha alpha )
+    : width_( 0 )
+    , bytes_per_pixel_( 0 )
+    , num_colour_planes_( 0 )
+    , has_alpha_( false )
+    , keep_alpha_( false )
+    , row_stride_( 0 )
+    , num_rows_( 0 )
+    , body_size_( body_size )
+    , stripe_rows_( std::max<size_t>( 1, stripe_rows ) )
+    , num_stripes_( 1 )
 {
-    if( bit_index_ == 0 )
+    // Pixels of any other format are not split into planes, and are
+    // kept entirely in the padding stream.
+    switch( data.format_ )
     {
-        UByte b = curr_byte_ | bit;
-        arr.push_back( b );
-        bit_index_ = 7;
-        curr_byte_ = 0;
+    case BmpPixelFormat::BGR24:
+        bytes_per_pixel_   = 3;
+        num_colour_planes_ = 3;
+        break;
+
+    case BmpPixelFormat::BGRA32:
+        bytes_per_pixel_   = 4;
+        num_colour_planes_ = 3;
+        has_alpha_         = true;
+        keep_alpha_        = alpha == IN3Alpha::KEEP;
+        break;
+
+    case BmpPixelFormat::PAL8:
+        bytes_per_pixel_   = 1;
+        num_colour_planes_ = 1;
+        break;
+
+    default:
+        break;
     }
-    else
+
+    if( bytes_per_pixel_ > 0 && data.width_ > 0 )
+    {
+        width_      = data.width_;
+        row_stride_ = BmpDecoder::rowStride( data );
+        num_rows_   = std::min<size_t>( data.height_, body_size / row_stride_ );
+    }
+
+    num_stripes_ = std::max<size_t>( 1, ( num_rows_ + stripe_rows_ - 1 ) / stripe_rows_ );
+}
+
+//========================================================================
+//
+size_t IN3Layout::firstRow( size_t stripe ) const
+{
+    return stripe * stripe_rows_;
+}
+
+//========================================================================
+//
+size_t IN3Layout::numRows( size_t stripe ) const
+{
+    const size_t first = firstRow( stripe );
+
+    return first < num_rows_ ? std::min( stripe_rows_, num_rows_ - first ) : 0;
+}
+
+//========================================================================
+//
+size_t IN3Layout::extraSize( size_t stripe ) const
+{
+    size_t size = numRows( stripe ) * ( row_stride_ - width_ * bytes_per_pixel_ );
+
+    if( stripe + 1 == num_stripes_ )
     {
-        curr_byte_ = curr_byte_ | ( bit << bit_index_ );
-        --bit_index_;
+        size += body_size_ - num_rows_ * row_stride_;
     }
+
+    return size;
+}
+
+//========================================================================
+//
+uint64_t IN3Layout::stripeOffset( size_t stripe ) const
+{
+    return static_cast<uint64_t>( firstRow( stripe ) ) * row_stride_;
 }
 
 //========================================================================
 //
-void BitEncoder::getLastByte( std::vector<UByte>& arr )
+size_t IN3Layout::stripeSize( size_t stripe ) const
 {
-    arr.push_back( curr_byte_ );
-    curr_byte_ = 0;
+    if( stripe + 1 == num_stripes_ )
+    {
+        return static_cast<size_t>( body_size_ - stripeOffset( stripe ) );
+    }
+
+    return numRows( stripe ) * row_stride_;
 }
 
 //========================================================================
 //
-IN3Coder::IN3Coder()
+IN3Coder::IN3Coder( IN3ColourTransform colour_transform, IN3Effort effort, IN3Backend backend, IN3Alpha alpha )
+    : colour_transform_( colour_transform )
+    , effort_( effort )
+    , backend_( backend )
+    , alpha_( alpha )
 {
 
 }
@@ -67,122 +221,340 @@ IN3Coder::~IN3Coder()
 MsgNum IN3Coder::encode( const BmpData& inData,
                          std::vector<UByte>& outData )
 {
-    // First perform delta encoding on the body (pixel data) of the file.
-    // Here we assume there is no padding in the source file, ie. the 
-    // width/height is always some multiple of 4.
-    std::vector<UByte> delta_encoded;
-    std::vector<UByte> symbol_sign;
+    outData.clear();
+
+    MemorySink sink( outData );
+
+    return encode( inData, sink );
+}
+
+//========================================================================
+//
+MsgNum IN3Coder::encode( BmpRowReader& reader,
+                         std::vector<UByte>& outData )
+{
+    outData.clear();
+
+    MemorySink sink( outData );
+
+    return encode( reader, sink );
+}
+
+//========================================================================
+//
+MsgNum IN3Coder::encode( const BmpData& inData,
+                         OutputSink& sink )
+{
+    // Split the body into stripes of whole rows, and each stripe into
+    // planar streams. Every stream is entropy coded on its own, so they
+    // can all be coded at the same time.
+    const IN3Layout layout( inData, inData.bodySize(), kSTRIPE_ROWS, alpha_ );
+
+    std::vector<std::vector<UByte>> segments( layout.num_stripes_ * kIN3_STREAMS_PER_STRIPE );
+    std::vector<IN3StripeMode>      modes( layout.num_stripes_ );
+
+    MsgNum err = encodeStripes( layout, inData.bodyData(), 0, layout.num_stripes_, segments, modes );
+    if( err ) return err;
+
+    return assemble( inData, layout, segments, modes, sink );
+}
+
+//========================================================================
+//
+MsgNum IN3Coder::encode( BmpRowReader& reader,
+                         OutputSink& sink )
+{
+    const BmpData&  header = reader.getData();
+    const IN3Layout layout( header, static_cast<size_t>( reader.bodySize() ), kSTRIPE_ROWS, alpha_ );
 
-    delta_encoded.push_back( inData.body_[0] );
-    delta_encoded.push_back( inData.body_[1] );
-    delta_encoded.push_back( inData.body_[2] );
+    std::vector<std::vector<UByte>> segments( layout.num_stripes_ * kIN3_STREAMS_PER_STRIPE );
+    std::vector<IN3StripeMode>      modes( layout.num_stripes_ );
 
-    std::array<int16_t, 3> next_val;
-    BitEncoder bit_encoder;
+    // Stripes are coded independently, so read as many as fit in a 
+    // batch, code them, and only keep their segments.
+    const size_t stripe_bytes = std::max<size_t>( 1, layout.stripe_rows_ * layout.row_stride_ );
+    const size_t batch        = std::max<size_t>( 1, kSTREAM_BATCH_BYTES / stripe_bytes );
 
-    for( Uint i = 3; i + 2 < inData.body_.size(); i += 3 )
+    std::vector<UByte> data;
+
+    for( size_t first = 0; first < layout.num_stripes_; first += batch )
     {
-        // Need to keep track of +ve and -ve. see your paper.
-        next_val[0] = (int16_t)inData.body_[i] - (int16_t)inData.body_[i - 3];
-        next_val[1] = (int16_t)inData.body_[i + 1] - (int16_t)inData.body_[i - 2];
-        next_val[2] = (int16_t)inData.body_[i + 2] - (int16_t)inData.body_[i - 1];
+        const size_t   count  = std::min( batch, layout.num_stripes_ - first );
+        const uint64_t offset = layout.stripeOffset( first );
+        const uint64_t end    = layout.stripeOffset( first + count - 1 ) + layout.stripeSize( first + count - 1 );
+
+        data.resize( static_cast<size_t>( end - offset ) );
 
-        delta_encoded.push_back( std::abs( next_val[0] ) );
-        delta_encoded.push_back( std::abs( next_val[1] ) );
-        delta_encoded.push_back( std::abs( next_val[2] ) );
+        MsgNum err = reader.readBody( offset, data.size(), data.data() );
+        if( err ) return err;
 
-        // Encode the sign of the value: 0 is +ve, 1 is -ve
-        next_val[0] < 0 ? bit_encoder.append_bit( symbol_sign, 1 ) : bit_encoder.append_bit( symbol_sign, 0 );
-        next_val[1] < 0 ? bit_encoder.append_bit( symbol_sign, 1 ) : bit_encoder.append_bit( symbol_sign, 0 );
-        next_val[2] < 0 ? bit_encoder.append_bit( symbol_sign, 1 ) : bit_encoder.append_bit( symbol_sign, 0 );
+        err = encodeStripes( layout, data.data(), first, count, segments, modes );
+        if( err ) return err;
     }
 
-    bit_encoder.getLastByte( symbol_sign );
+    return assemble( header, layout, segments, modes, sink );
+}
+
+//========================================================================
+//
+MsgNum IN3Coder::encodeStripes( const IN3Layout& layout,
+                                const UByte* data,
+                                size_t first_stripe,
+                                size_t num_stripes,
+                                std::vector<std::vector<UByte>>& segments,
+                                std::vector<IN3StripeMode>& modes ) const
+{
+    const uint64_t data_offset = layout.stripeOffset( first_stripe );
+    const size_t   num_streams = num_stripes * kIN3_STREAMS_PER_STRIPE;
+
+    std::vector<IN3StripeStreams> stripes( num_stripes );
+
+    ThreadPool::shared().parallelFor( num_stripes, [&]( size_t i )
+    {
+        const size_t s = first_stripe + i;
 
+        splitStripe( layout, data + ( layout.stripeOffset( s ) - data_offset ), s, stripes[i], modes[s] );
+    } );
 
-    HuffmanCoder       huffCoder;
-    DecoderParameters  dec_params;
-    std::vector<UByte> delta_encoded_body;
+    std::vector<MsgNum> results( num_streams, STATUS_OKAY );
 
-    // Insert the delta encoded information in this pattern: 
-    // | num_bytes (uint64_t) | byte_data ... | num_sign_bytes (uint64_t) | sign_data ... |
-    uint64_t sz_bytes = delta_encoded.size();
-    uint64_t sz_signs = symbol_sign.size();
+    ThreadPool::shared().parallelFor( num_streams, [&]( size_t i )
+    {
+        const auto& stream = stripes[i / kIN3_STREAMS_PER_STRIPE][i % kIN3_STREAMS_PER_STRIPE];
+
+        results[i] = encodeStream( stream, segments[first_stripe * kIN3_STREAMS_PER_STRIPE + i] );
+    } );
 
-    for( size_t i = 7; i < 8; --i )
+    for( auto err : results )
     {
-        delta_encoded_body.push_back( ( sz_bytes >> ( i * 8 ) ) & 0xff );
+        if( err ) return err;
     }
-    for( auto b : delta_encoded )
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum IN3Coder::assemble( const BmpData& header,
+                           const IN3Layout& layout,
+                           const std::vector<std::vector<UByte>>& segments,
+                           const std::vector<IN3StripeMode>& modes,
+                           OutputSink& sink ) const
+{
+    // Copy the header. We will not compress the header.
+    std::vector<UByte> table( header.headerData(), header.headerData() + header.headerSize() );
+
+    // 8 bytes : Size of the pixel data. 4 bytes : Rows per stripe.
+    // 4 bytes : Number of stream segments. 1 byte : Entropy backend.
+    // 1 byte : Whether alpha was kept.
+    util::appendBigEndian( table, layout.body_size_, 8 );
+    util::appendBigEndian( table, layout.stripe_rows_, 4 );
+    util::appendBigEndian( table, segments.size(), 4 );
+    table.push_back( static_cast<UByte>( backend_ ) );
+    table.push_back( static_cast<UByte>( alpha_ ) );
+
+    // 2 bytes per stripe : Colour transform and predictor applied.
+    for( const auto& mode : modes )
     {
-        delta_encoded_body.push_back( b );
+        table.push_back( static_cast<UByte>( mode.colour_transform_ ) );
+        table.push_back( static_cast<UByte>( mode.predictor_ ) );
     }
-    for( size_t i = 7; i < 8; --i )
+
+    // 8 bytes per segment : Offset of the segment from the end of this
+    // table. Segments are ordered by stripe, then by stream.
+    uint64_t offset = 0;
+    for( const auto& segment : segments )
     {
-        delta_encoded_body.push_back( ( sz_signs >> ( i * 8 ) ) & 0xff );
+        util::appendBigEndian( table, offset, 8 );
+        offset += segment.size();
     }
-    for( auto b : symbol_sign )
+
+    // The table goes in its own chunk, then the segments of each 
+    // stripe in one data chunk. Every size is known by now, so the
+    // sink can set aside room for the whole file at once.
+    sink.reserve( static_cast<size_t>( ChunkWriter::containerSize( table.size() + offset, modes.size() + 1 ) ) );
+
+    ChunkWriter writer( sink, ContainerFormat::IN3 );
+    writer.writeChunk( kCHUNK_TABL, table.data(), table.size() );
+
+    for( size_t s = 0; s < modes.size(); ++s )
     {
-        delta_encoded_body.push_back( b );
+        const auto first = segments.begin() + s * kIN3_STREAMS_PER_STRIPE;
+
+        uint64_t length = 0;
+        for( auto segment = first; segment != first + kIN3_STREAMS_PER_STRIPE; ++segment )
+        {
+            length += segment->size();
+        }
+
+        writer.beginChunk( kCHUNK_DATA, length );
+
+        for( auto segment = first; segment != first + kIN3_STREAMS_PER_STRIPE; ++segment )
+        {
+            writer.append( segment->data(), segment->size() );
+        }
+
+        writer.endChunk();
     }
 
-    // Perform Huffman coding on the 
-    // result
-    std::vector<UByte> encoded_body;
+    return writer.finish();
+}
 
-    // comment out to test delta encode vs non delta encode performance.
-    //delta_encoded_body = inData.body_;
+//========================================================================
+//
+MsgNum IN3Coder::decode( const std::vector<UByte>& inData,
+                         BmpData& outData )
+{
+    return decode( inData.data(), inData.size(), outData );
+}
+
+//========================================================================
+//
+MsgNum IN3Coder::decode( const UByte* inData,
+                         size_t size,
+                         BmpData& outData )
+{
+    // The file is checked whole before any of it is decoded. The table
+    // and segments are then read in place, from the chunks they were
+    // written to. Plain .in3 files, which predate the stripe layout,
+    // are not read.
+    if( !ChunkReader::isChunked( inData, size ) ) return printMsg( BAD_DATA );
 
-    MsgNum err = huffCoder.encodePerByte( delta_encoded_body, encoded_body, dec_params );
+    std::vector<ChunkSpan> chunks;
+
+    MsgNum err = ChunkReader::verify( inData, size, ContainerFormat::IN3, chunks );
     if( err ) return err;
 
+    const UByte* table        = chunks[0].data_;
+    const size_t table_size   = chunks[0].size_;
+    const size_t payload_size = static_cast<size_t>( ChunkReader::payloadSize( chunks ) );
 
-    // Now assemble the output file.
-    outData.clear();
+    // The original .bmp header is stored uncompressed at the start, and
+    // tells us the image dimensions and its own length.
+    err = BmpDecoder::parseHeader( table, table_size, outData );
+    if( err ) return printMsg( err );
 
-    // Copy the header. We will not compress the header.
-    for( auto byte : inData.header_ )
+    size_t pos = outData.offset_to_data_;
+
+    if( pos > table_size || table_size - pos < 18 ) return printMsg( BAD_DATA );
+
+    // The decoded data owns its header and pixel data.
+    outData.header_.assign( table, table + pos );
+    outData.header_view_ = nullptr;
+    outData.body_view_   = nullptr;
+    outData.pixels_.clear();
+
+    // Stripe layout and the offset table.
+    const size_t body_size   = static_cast<size_t>( util::readBigEndian( table, pos, 8 ) );
+    const size_t stripe_rows = static_cast<size_t>( util::readBigEndian( table, pos, 4 ) );
+    const size_t num_streams = static_cast<size_t>( util::readBigEndian( table, pos, 4 ) );
+    const UByte  backend     = table[pos++];
+    const UByte  alpha       = table[pos++];
+
+    if( alpha > static_cast<UByte>( IN3Alpha::DROP ) ) return printMsg( BAD_DATA );
+
+    const IN3Layout layout( outData, body_size, stripe_rows, static_cast<IN3Alpha>( alpha ) );
+
+    if( num_streams != layout.num_stripes_ * kIN3_STREAMS_PER_STRIPE ||
+        backend > static_cast<UByte>( IN3Backend::LZ77 ) )
+    {
+        return printMsg( BAD_DATA );
+    }
+
+    // The mode and offset table takes 2 + 8 * kIN3_STREAMS_PER_STRIPE
+    // bytes per stripe.
+    if( ( table_size - pos ) / ( 2 + 8 * kIN3_STREAMS_PER_STRIPE ) < layout.num_stripes_ )
+    {
+        return printMsg( BAD_DATA );
+    }
+
+    // How every stripe was predicted.
+    std::vector<IN3StripeMode> modes( layout.num_stripes_ );
+    for( auto& mode : modes )
+    {
+        const UByte colour_transform = table[pos++];
+        const UByte predictor        = table[pos++];
+
+        if( colour_transform > static_cast<UByte>( IN3ColourTransform::YCOCG_R ) || predictor >= kNUM_PREDICTORS )
+        {
+            return printMsg( BAD_DATA );
+        }
+
+        mode.colour_transform_ = static_cast<IN3ColourTransform>( colour_transform );
+        mode.predictor_        = static_cast<Predictor>( predictor );
+    }
+
+    std::vector<size_t> offsets( num_streams + 1 );
+    for( size_t i = 0; i < num_streams; ++i )
     {
-        outData.push_back( byte );
+        offsets[i] = static_cast<size_t>( util::readBigEndian( table, pos, 8 ) );
     }
 
-    // Store the Huffman coding related information needed for
-    // decoding.
-    // 2 bytes : Max cw length
-    outData.push_back( ( dec_params.max_cw_len_ >> 8 ) & 0xff);
-    outData.push_back( dec_params.max_cw_len_ & 0xff );
+    // Make the offsets absolute, with the end of the payload closing 
+    // the last segment. The segments must follow each other in order.
+    for( size_t i = 0; i < num_streams; ++i )
+    {
+        if( offsets[i] > payload_size - pos ) return printMsg( BAD_DATA );
+
+        offsets[i] += pos;
+    }
+    offsets[num_streams] = payload_size;
 
-    // 8 bytes : Num bytes of pixel data in input file.
-    for( Uint i = 7; i < 8; --i )
+    for( size_t i = 0; i < num_streams; ++i )
     {
-        outData.push_back( ( dec_params.num_bytes_ >> ( i * 8 ) ) & 0xff );
+        if( offsets[i] > offsets[i + 1] ) return printMsg( BAD_DATA );
     }
 
-    // Now we need the decoder symbol LUT created by the Huffman encoder.
-    // Put the size in first - 2 bytes.
-    uint16_t tableSize = dec_params.decoder_LUT_.size();
-    outData.push_back( ( tableSize >> 8 ) & 0xff );
-    outData.push_back( tableSize & 0xff );
+    // Entropy decode every stream independently.
+    std::vector<IN3StripeStreams> stripes( layout.num_stripes_ );
+    std::vector<MsgNum>           results( num_streams, STATUS_OKAY );
 
-    
-    // Encoding format per entry is
-    // | old_sym | new_sym | new_sym_length |
-    for( auto entry : dec_params.decoder_LUT_ )
+    ThreadPool::shared().parallelFor( num_streams, [&]( size_t i )
     {
-        outData.push_back( entry.old_sym_ );
-        outData.push_back( entry.new_sym_len_ );
-           
-        for( Uint i = 3; i < 4; --i )
+        const size_t s          = i / kIN3_STREAMS_PER_STRIPE;
+        const size_t c          = i % kIN3_STREAMS_PER_STRIPE;
+        const size_t num_pixels = layout.numRows( s ) * layout.width_;
+
+        // A run takes at most two 10-byte varints per pixel. The extra
+        // stream starts with the alpha plane, if kept.
+        size_t max_size = c < layout.num_colour_planes_ ? num_pixels : 0;
+        if( c == kEXTRA_STREAM ) max_size = layout.extraSize( s ) + ( layout.keep_alpha_ ? num_pixels : 0 );
+        if( c == kRUN_STREAM )   max_size = 20 * ( num_pixels + 1 );
+
+        // A segment never spans two chunks.
+        const size_t segment_size = offsets[i + 1] - offsets[i];
+        const UByte* segment      = ChunkReader::locate( chunks, offsets[i], segment_size );
+        if( !segment )
         {
-            outData.push_back( ( entry.new_sym_ >> ( i * 8 ) ) & 0xff );
+            results[i] = printMsg( BAD_DATA );
+            return;
         }
+
+        results[i] = decodeStream( static_cast<IN3Backend>( backend ),
+                                   segment, segment_size,
+                                   max_size, stripes[s][c] );
+    } );
+
+    for( auto err : results )
+    {
+        if( err ) return err;
     }
-    
 
-    // Finally, append the compressed pixel data.
-    for( auto byte : encoded_body )
+    // Allocate the pixel data once, then interleave every stripe 
+    // straight into its place in it. RGB pixels are left for the caller
+    // to ask for.
+    outData.body_.resize( body_size );
+
+    results.assign( layout.num_stripes_, STATUS_OKAY );
+
+    ThreadPool::shared().parallelFor( layout.num_stripes_, [&]( size_t s )
     {
-        outData.push_back( byte );
+        results[s] = mergeStripe( layout, stripes[s], modes[s], s, outData.body_.data() );
+    } );
+
+    for( auto err : results )
+    {
+        if( err ) return err;
     }
 
     return STATUS_OKAY;
@@ -190,133 +562,337 @@ MsgNum IN3Coder::encode( const BmpData& inData,
 
 //========================================================================
 //
-MsgNum IN3Coder::decode( const std::vector<UByte>& inData,
-                         BmpData& outData )
+void IN3Coder::splitStripe( const IN3Layout& layout,
+                            const UByte* stripe_data,
+                            size_t stripe,
+                            IN3StripeStreams& streams,
+                            IN3StripeMode& mode ) const
 {
-    Uint pos = 0;
+    const size_t num_rows   = layout.numRows( stripe );
+    const size_t num_pixels = num_rows * layout.width_;
+    const size_t num_planes = layout.num_colour_planes_;
+    const size_t row_bytes  = layout.width_ * layout.bytes_per_pixel_;
+
+    std::vector<UByte> planes( num_pixels * num_planes );
+    std::vector<UByte> alpha( layout.has_alpha_ ? num_pixels : 0 );
+    std::vector<UByte> padding;
+    padding.reserve( layout.extraSize( stripe ) );
+
+    UByte* c0 = planes.data();
+    UByte* c1 = c0 + ( num_planes == 3 ? num_pixels : 0 );
+    UByte* c2 = c1 + ( num_planes == 3 ? num_pixels : 0 );
+
+    // Deinterleave the channels of each row, and keep whatever padding
+    // follows the pixels aside.
+    for( size_t y = 0; y < num_rows; ++y )
+    {
+        const UByte* row = stripe_data + y * layout.row_stride_;
+        const size_t p   = y * layout.width_;
+
+        switch( layout.bytes_per_pixel_ )
+        {
+        case 3:  util::splitChannels( row, layout.width_, c0 + p, c1 + p, c2 + p );                      break;
+        case 4:  util::splitChannels4( row, layout.width_, c0 + p, c1 + p, c2 + p, alpha.data() + p ); break;
+        default: std::copy( row, row + row_bytes, c0 + p );                                              break;
+        }
 
-    std::vector<Byte> decodeFromBmp;
+        padding.insert( padding.end(), row + row_bytes, row + layout.row_stride_ );
+    }
+
+    // The final stripe also carries whatever follows the last row.
+    padding.insert( padding.end(), stripe_data + num_rows * layout.row_stride_, stripe_data + layout.stripeSize( stripe ) );
 
-    // Extract the header. assume 54 bytes ( for now )
-    for(; pos < 54; ++pos)
+    // Then predict each plane. The residuals are kept modulo 256 so 
+    // that they still fit in a byte and no separate sign information
+    // is needed. Prediction starts afresh at the top of the stripe, so
+    // the stripe does not depend on the previous one. Palette indices
+    // have no order to predict from, so they are coded as they are.
+    if( effort_ == IN3Effort::MAX && num_pixels > 0 )
     {
-        decodeFromBmp.push_back( inData[pos] );
-        outData.header_.push_back( inData[pos] );
+        chooseStripeMode( layout, planes, num_rows, streams, mode );
     }
+    else if( num_planes == 3 )
+    {
+        mode.colour_transform_ = colour_transform_;
+        mode.predictor_        = Predictor::LEFT;
+
+        if( colour_transform_ == IN3ColourTransform::YCOCG_R )
+        {
+            util::forwardYCoCgR( c0, c1, c2, num_pixels );
+        }
 
-    // Extract and rebuild the decoder parameters struct.
-    // Max cw length.
-    DecoderParameters dec_params = { 0 };
-    dec_params.max_cw_len_ |= inData[pos++] << 8;
-    dec_params.max_cw_len_ |= inData[pos++];
+        const UByte* channels[3] = { c0, c1, c2 };
 
-    // Number of bytes in compressed data portion.
-    for( Uint i = 0; i < 8; ++i )
+        for( size_t c = 0; c < 3; ++c )
+        {
+            streams[c].resize( num_pixels );
+            util::predictEncode( channels[c], streams[c].data(), layout.width_, num_rows, mode.predictor_ );
+        }
+    }
+    else
     {
-        dec_params.num_bytes_ = dec_params.num_bytes_ << 8 | inData[pos++];
+        mode.colour_transform_ = IN3ColourTransform::NONE;
+        mode.predictor_        = Predictor::NONE;
+
+        streams[0].swap( planes );
     }
 
-    // Decoder lookup table size.
-    uint16_t table_size = ( inData[pos++] << 8 );
-    table_size |= inData[pos++];
+    // The alpha plane follows the colour planes' predictor.
+    std::vector<UByte> alpha_residuals;
 
-    // The lookup table data.
-    for( Uint i = 0; i < table_size; ++i )
+    if( layout.keep_alpha_ )
     {
-        UByte old_sym     = inData[pos++];
-        UByte new_sym_len = inData[pos++];
+        alpha_residuals.resize( num_pixels );
+        util::predictEncode( alpha.data(), alpha_residuals.data(), layout.width_, num_rows, mode.predictor_ );
+    }
 
-        uint64_t new_sym  = 0;
+    // Finally take out the flat regions, where all residuals are zero,
+    // and describe them in the run stream instead.
+    size_t num_literals = 0;
 
-        for( Uint i = 0; i < 4; ++i )
+    if( layout.numPlanes() > 0 )
+    {
+        UByte* residuals[kMAX_RUN_PLANES] = {};
+
+        for( size_t c = 0; c < num_planes; ++c )
         {
-            new_sym = ( new_sym << 8 ) | inData[pos++];
+            residuals[c] = streams[c].data();
         }
 
-        dec_params.decoder_LUT_.push_back( DecoderLUTEntry( old_sym, new_sym, new_sym_len ) );
+        if( layout.keep_alpha_ )
+        {
+            residuals[num_planes] = alpha_residuals.data();
+        }
+
+        num_literals = util::extractZeroRuns( residuals, 
+                                              layout.numPlanes(), 
+                                              num_pixels, 
+                                              kMIN_RUN, 
+                                              streams[kRUN_STREAM] );
+    }
+
+    for( size_t c = 0; c < num_planes; ++c )
+    {
+        streams[c].resize( num_literals );
     }
 
-    std::vector<UByte> compressed_data_block;
+    // The extra stream holds the alpha literals, then the padding.
+    std::vector<UByte>& extra = streams[kEXTRA_STREAM];
 
-    for( ; pos < inData.size(); ++pos )
+    if( layout.keep_alpha_ )
     {
-        compressed_data_block.push_back( inData[pos] );
+        extra.reserve( num_literals + padding.size() );
+        extra.assign( alpha_residuals.begin(), alpha_residuals.begin() + num_literals );
+        extra.insert( extra.end(), padding.begin(), padding.end() );
     }
+    else
+    {
+        extra.swap( padding );
+    }
+}
 
-    // Finally, decompress the data portion.
-    HuffmanCoder huffCoder;
-    std::vector<UByte> delta_data;
-    MsgNum err = huffCoder.decode( compressed_data_block, delta_data, dec_params );
+//========================================================================
+//
+void IN3Coder::chooseStripeMode( const IN3Layout& layout,
+                                 const std::vector<UByte>& planes,
+                                 size_t num_rows,
+                                 IN3StripeStreams& streams,
+                                 IN3StripeMode& mode ) const
+{
+    const size_t num_planes = layout.num_colour_planes_;
+    const size_t num_pixels = planes.size() / num_planes;
 
-    if( err ) return err;
+    // Try every colour transform and predictor, and keep the residuals
+    // with the lowest entropy. A single plane has no colour to 
+    // transform.
+    std::vector<IN3ColourTransform> colour_transforms = { IN3ColourTransform::NONE };
+    if( num_planes == 3 ) colour_transforms.push_back( IN3ColourTransform::YCOCG_R );
+
+    std::vector<UByte> transformed( planes.size() );
+    IN3StripeStreams   candidate;
+    double             best_bits = -1.0;
+
+    for( auto colour_transform : colour_transforms )
+    {
+        std::copy( planes.begin(), planes.end(), transformed.begin() );
 
+        if( colour_transform == IN3ColourTransform::YCOCG_R )
+        {
+            UByte* t0 = transformed.data();
+            util::forwardYCoCgR( t0, t0 + num_pixels, t0 + 2 * num_pixels, num_pixels );
+        }
 
-    // Perform delta decoding.
-    uint64_t sz_bytes = 0;
-    uint64_t sz_signs = 0;
+        for( Uint p = 0; p < kNUM_PREDICTORS; ++p )
+        {
+            const Predictor predictor = static_cast<Predictor>( p );
+            double          bits      = 0.0;
+
+            for( size_t c = 0; c < num_planes; ++c )
+            {
+                candidate[c].resize( num_pixels );
+                util::predictEncode( transformed.data() + c * num_pixels, candidate[c].data(), layout.width_, num_rows, predictor );
+                bits += entropyBits( candidate[c] );
+            }
+
+            if( best_bits < 0.0 || bits < best_bits )
+            {
+                best_bits              = bits;
+                mode.colour_transform_ = colour_transform;
+                mode.predictor_        = predictor;
+
+                for( size_t c = 0; c < num_planes; ++c )
+                {
+                    streams[c].swap( candidate[c] );
+                }
+            }
+        }
+    }
+}
 
-    for( size_t i = 0; i < 8; ++i )
+//========================================================================
+//
+MsgNum IN3Coder::mergeStripe( const IN3Layout& layout,
+                              IN3StripeStreams& streams,
+                              const IN3StripeMode& mode,
+                              size_t stripe,
+                              UByte* body ) const
+{
+    const size_t first_row    = layout.firstRow( stripe );
+    const size_t num_rows     = layout.numRows( stripe );
+    const size_t num_pixels   = num_rows * layout.width_;
+    const size_t num_planes   = layout.num_colour_planes_;
+    const size_t row_bytes    = layout.width_ * layout.bytes_per_pixel_;
+    const size_t pad_bytes    = layout.row_stride_ - row_bytes;
+    const size_t num_literals = num_planes > 0 ? streams[0].size() : 0;
+
+    const std::vector<UByte>& runs  = streams[kRUN_STREAM];
+    const std::vector<UByte>& extra = streams[kEXTRA_STREAM];
+
+    // Channel streams the format does not use must be empty.
+    for( size_t c = 0; c < 3; ++c )
     {
-        sz_bytes  = sz_bytes << 8;
-        sz_bytes |= delta_data[i] & 0xff;
+        if( streams[c].size() != ( c < num_planes ? num_literals : 0 ) ) return printMsg( BAD_DATA );
     }
-    for( size_t i = 0; i < 8; ++i )
+
+    const size_t alpha_size = layout.keep_alpha_ ? num_literals : 0;
+
+    if( extra.size() != layout.extraSize( stripe ) + alpha_size )
     {
-        sz_signs  = sz_signs << 8;
-        sz_signs |= delta_data[i + sz_bytes + 8] & 0xff;
+        return printMsg( BAD_DATA );
     }
 
-    std::vector<UByte> delta_encoded;
-    std::vector<UByte> symbol_sign;
+    // Put the flat runs back into full size residual planes, the alpha
+    // plane last.
+    std::vector<UByte> planes( num_pixels * layout.numPlanes() );
 
-    for( size_t i = 8; i < sz_bytes + 8; ++i )
+    if( layout.numPlanes() > 0 )
     {
-        delta_encoded.push_back( delta_data[i] );
+        const UByte* literals[kMAX_RUN_PLANES] = {};
+        UByte*       residuals[kMAX_RUN_PLANES] = {};
+
+        for( size_t c = 0; c < layout.numPlanes(); ++c )
+        {
+            literals[c]  = c < num_planes ? streams[c].data() : extra.data();
+            residuals[c] = planes.data() + c * num_pixels;
+        }
+
+        if( !util::expandZeroRuns( runs.data(), runs.size(),
+                                   literals, num_literals,
+                                   residuals, layout.numPlanes(), num_pixels ) )
+        {
+            return printMsg( BAD_DATA );
+        }
     }
-    for( size_t i = sz_bytes + 16; i < delta_data.size(); ++i )
+    else if( !runs.empty() )
     {
-        symbol_sign.push_back( delta_data[i] );
+        return printMsg( BAD_DATA );
     }
 
-    // And then recover the RGB data fromt the difference data.
-    BitExtractor bit_extractor( symbol_sign );
+    // Undo the prediction, then the colour transform.
+    for( size_t c = 0; c < layout.numPlanes(); ++c )
+    {
+        util::predictDecode( planes.data() + c * num_pixels, layout.width_, num_rows, mode.predictor_ );
+    }
 
-    std::array<UByte, 3> next_val;
-    next_val[0] = delta_encoded[0];
-    next_val[1] = delta_encoded[1];
-    next_val[2] = delta_encoded[2];
+    UByte* c0 = planes.data();
+    UByte* c1 = c0 + ( num_planes == 3 ? num_pixels : 0 );
+    UByte* c2 = c1 + ( num_planes == 3 ? num_pixels : 0 );
 
-    // Write in the first RGB bytes.
-    for( Uint i = 0; i < 3; ++i )
+    if( num_planes == 3 && mode.colour_transform_ == IN3ColourTransform::YCOCG_R )
     {
-        decodeFromBmp.push_back( delta_encoded[i] );
-        outData.body_.push_back( delta_encoded[i] );
+        util::inverseYCoCgR( c0, c1, c2, num_pixels );
     }
 
-    // Extract the rest from their differences.
-    for( Uint i = 3; i + 2 < delta_encoded.size(); i += 3 )
+    // Dropped alpha comes back opaque.
+    std::vector<UByte> opaque( layout.has_alpha_ && !layout.keep_alpha_ ? layout.width_ : 0, 0xFF );
+
+    const UByte* alpha     = layout.keep_alpha_ ? c0 + num_planes * num_pixels : opaque.data();
+    const UByte* extra_pos = extra.data() + alpha_size;
+
+    for( size_t y = 0; y < num_rows; ++y )
     {
-        // Need to keep track of +ve and -ve. see your paper.
-        next_val[0] = static_cast<UByte>( static_cast<int16_t>( outData.body_[i - 3] ) +
-                                          static_cast<int16_t>( delta_encoded[i] ) * ( bit_extractor.get_bit() == 0 ? 1 : -1 ) );
-        next_val[1] = static_cast<UByte>( static_cast<int16_t>( outData.body_[i - 2] ) +
-                                          static_cast<int16_t>( delta_encoded[i + 1] ) * ( bit_extractor.get_bit() == 0 ? 1 : -1 ) );
-        next_val[2] = static_cast<UByte>( static_cast<int16_t>( outData.body_[i - 1] ) +
-                                          static_cast<int16_t>( delta_encoded[i + 2] ) * ( bit_extractor.get_bit() == 0 ? 1 : -1 ) );
+        UByte*       row = body + ( first_row + y ) * layout.row_stride_;
+        const size_t p   = y * layout.width_;
 
-        outData.body_.push_back( next_val[0] );
-        outData.body_.push_back( next_val[1] );
-        outData.body_.push_back( next_val[2] );
+        switch( layout.bytes_per_pixel_ )
+        {
+        case 3:  util::mergeChannels( c0 + p, c1 + p, c2 + p, layout.width_, row ); break;
+        case 4:  util::mergeChannels4( c0 + p, c1 + p, c2 + p, layout.keep_alpha_ ? alpha + p : alpha, layout.width_, row ); break;
+        default: std::copy( c0 + p, c0 + p + row_bytes, row ); break;
+        }
 
-        decodeFromBmp.push_back( next_val[0] );
-        decodeFromBmp.push_back( next_val[1] );
-        decodeFromBmp.push_back( next_val[2] );
+        std::copy( extra_pos, extra_pos + pad_bytes, row + row_bytes );
+        extra_pos += pad_bytes;
     }
 
-    // Decode the stored data and release/return it.
-    BmpDecoder bmp_decoder( decodeFromBmp );
-    bmp_decoder.decode();
-    outData = bmp_decoder.releaseData();
+    if( stripe + 1 == layout.num_stripes_ )
+    {
+        std::copy( extra_pos, extra.data() + extra.size(), body + layout.num_rows_ * layout.row_stride_ );
+    }
 
     return STATUS_OKAY;
 }
+
+//========================================================================
+//
+MsgNum IN3Coder::encodeStream( const std::vector<UByte>& stream,
+                               std::vector<UByte>& segment ) const
+{
+    segment.clear();
+
+    // Nothing to store for an empty stream, e.g. rows with no padding.
+    if( stream.empty() ) return STATUS_OKAY;
+
+    if( backend_ == IN3Backend::LZ77 )
+    {
+        LZ77Coder lz77Coder( lz77Level( effort_ ) );
+        return lz77Coder.encode( stream, segment );
+    }
+
+    HuffmanCoder huffCoder;
+    return huffCoder.encodeSegment( stream, segment, effort_ == IN3Effort::FAST ? &fixedCode() : nullptr );
+}
+
+//========================================================================
+//
+MsgNum IN3Coder::decodeStream( IN3Backend backend,
+                               const UByte* segment,
+                               size_t segment_size,
+                               size_t max_size,
+                               std::vector<UByte>& stream ) const
+{
+    stream.clear();
+
+    // An empty segment is an empty stream.
+    if( segment_size == 0 ) return STATUS_OKAY;
+
+    if( backend == IN3Backend::LZ77 )
+    {
+        LZ77Coder lz77Coder;
+        return lz77Coder.decode( segment, segment_size, stream, max_size );
+    }
+
+    // Segments without a table were coded with the fixed one.
+    HuffmanCoder huffCoder;
+    return huffCoder.decodeSegment( segment, segment_size, max_size, stream, &fixedCode() );
+}
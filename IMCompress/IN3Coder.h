@@ -2,72 +2,143 @@
 
 #include "Util.h"
 #include "BmpDecoder.h"
+#include "BmpRowReader.h"
+#include "OutputSink.h"
+#include "Prediction.h"
 
 #include <vector>
+#include <array>
 
 //--------------------------------------------------------------
+// Optional reversible colour transform applied to the pixel data
+// before prediction. Stored in the file so the decoder can invert it.
+enum class IN3ColourTransform : UByte
+{
+    NONE    = 0,
+    YCOCG_R = 1
+};
+
+//--------------------------------------------------------------
+// Trade-off between encoding speed and compressed size. Decoding 
+// speed is about the same for all of them, and any level decodes 
+// files written by any other.
 //
-class BitExtractor
+// Measured with imcompress -j 1 over image_samples (5.1 MB of 24-bit
+// .bmp), as encode speed / overall ratio:
+//   FAST     255 MB/s / 2.93   (3.28 with YCoCg-R)
+//   DEFAULT  125 MB/s / 3.22   (3.63 with YCoCg-R)
+//   MAX       27 MB/s / 4.50
+// Decoding runs at 65-85 MB/s for every level.
+enum class IN3Effort : UByte
 {
-public:
+    // Left prediction and a fixed Huffman table, so the data is never
+    // histogrammed and no tables are stored.
+    FAST    = 0,
 
-    //--------------------------------------------------------------
-    //
-    BitExtractor( std::vector<UByte>& stream )
-        : bit_index_( 7 )
-        , byte_index( 0 )
-        , stream_( stream )
-    { };
+    // Left prediction and a Huffman table fitted to every stream.
+    DEFAULT = 1,
 
-    //--------------------------------------------------------------
-    //
-    UByte get_bit();
+    // Tries every predictor with and without the colour transform on
+    // each stripe, keeping whichever gives the lowest entropy.
+    MAX     = 2
+};
 
+//--------------------------------------------------------------
+// Entropy coder used for every stream of a file. Stored in the file.
+enum class IN3Backend : UByte
+{
+    // One Huffman table per stream.
+    HUFFMAN = 0,
 
-private:
+    // LZ77Coder, at the level matching the effort. Encodes 3-5 times
+    // slower, and the prediction residuals of photos come out 5-15% 
+    // larger, but it finds the repeats that a per-byte Huffman code
+    // cannot: colour_bands at FAST shrinks from 61 KB to 12 KB.
+    LZ77    = 1
+};
 
-    //--------------------------------------------------------------
-    //
-    int8_t   bit_index_;
-    uint64_t byte_index;
-    const std::vector<UByte>& stream_;
+//--------------------------------------------------------------
+// What to do with the alpha channel of 32-bit images. Stored in the
+// file.
+enum class IN3Alpha : UByte
+{
+    // Coded losslessly alongside the colour channels.
+    KEEP = 0,
+
+    // Not stored. Decoding sets every alpha byte to 255, so the image
+    // only comes back exactly if it was opaque.
+    DROP = 1
 };
 
+//--------------------------------------------------------------
+// How a stripe was predicted. Stored per stripe.
+struct IN3StripeMode
+{
+    IN3ColourTransform colour_transform_;
+    Predictor          predictor_;
+};
 
-class BitEncoder
+//--------------------------------------------------------------
+// How the pixel data of an image is cut into stripes of rows, and 
+// each pixel into planes. This follows from the .bmp header and the
+// size of the pixel data, so only the stripe height is stored.
+//
+// BGR24 and BGRA32 pixels give B, G and R planes, PAL8 pixels a 
+// plane of palette indices. Alpha is a fourth plane when kept. Other
+// formats, including RLE8, have no planes and are kept as they are.
+struct IN3Layout
 {
-public:
+    IN3Layout( const BmpData& data, size_t body_size, size_t stripe_rows, IN3Alpha alpha );
 
-    //--------------------------------------------------------------
-    //
-    BitEncoder()
-        : bit_index_( 7 )
-        , curr_byte_( 0 )
-    { };
+    size_t firstRow( size_t stripe ) const;
+    size_t numRows( size_t stripe ) const;
 
-    //--------------------------------------------------------------
-    //
-    void append_bit( std::vector<UByte>& arr, UByte bit );
+    // Bytes of the stripe that are not part of any pixel: the row 
+    // padding, plus anything after the last row for the final stripe.
+    size_t extraSize( size_t stripe ) const;
 
-    //--------------------------------------------------------------
-    //
-    void getLastByte( std::vector<UByte>& arr );
+    // Where the stripe starts in the pixel data, and how many bytes 
+    // of it the stripe covers, including the tail for the final one.
+    uint64_t stripeOffset( size_t stripe ) const;
+    size_t   stripeSize( size_t stripe ) const;
 
-private:
+    // Colour planes, plus the alpha plane if kept.
+    size_t numPlanes() const { return num_colour_planes_ + ( keep_alpha_ ? 1 : 0 ); }
 
-    //--------------------------------------------------------------
-    //
-    int8_t bit_index_;
-    UByte curr_byte_;
+    size_t width_;
+    size_t bytes_per_pixel_;
+    size_t num_colour_planes_;
+    bool   has_alpha_;
+    bool   keep_alpha_;
+    size_t row_stride_;
+    size_t num_rows_;
+    size_t body_size_;
+    size_t stripe_rows_;
+    size_t num_stripes_;
 };
 
+//--------------------------------------------------------------
+// Each stripe is coded as one planar stream per colour channel 
+// (B, G, R, Y, Co, Cg or palette index; unused channels are empty),
+// one for the alpha channel and padding bytes and one for the runs of
+// flat pixels left out of the other streams, each with its own 
+// entropy coded segment.
+static const size_t kIN3_STREAMS_PER_STRIPE = 5;
+
+using IN3StripeStreams = std::array<std::vector<UByte>, kIN3_STREAMS_PER_STRIPE>;
+
 class IN3Coder
 {
 public:
 
     //--------------------------------------------------------------
     //
-    IN3Coder();
+    // The colour transform is used by the FAST and DEFAULT levels; MAX
+    // picks its own for every stripe.
+    IN3Coder( IN3ColourTransform colour_transform = IN3ColourTransform::NONE,
+              IN3Effort effort = IN3Effort::DEFAULT,
+              IN3Backend backend = IN3Backend::HUFFMAN,
+              IN3Alpha alpha = IN3Alpha::KEEP );
 
     //--------------------------------------------------------------
     //
@@ -78,9 +149,118 @@ public:
     MsgNum encode( const BmpData& inData,
                    std::vector<UByte>& outData );
 
+    //--------------------------------------------------------------
+    // As above, reading the image a few stripes at a time so that only
+    // those and the compressed output are held in memory.
+    MsgNum encode( BmpRowReader& reader,
+                   std::vector<UByte>& outData );
+
+    //--------------------------------------------------------------
+    // As the above, writing the .in3 file to a sink, e.g. a FileSink.
+    // The compressed stripes are held in memory until all are coded,
+    // as the table chunk ahead of them records every stripe's mode,
+    // and are then written chunk by chunk rather than joined into one
+    // buffer first.
+    MsgNum encode( const BmpData& inData,
+                   OutputSink& sink );
+
+    MsgNum encode( BmpRowReader& reader,
+                   OutputSink& sink );
+
     //--------------------------------------------------------------
     //
     MsgNum decode( const std::vector<UByte>& inData,
                    BmpData& outData );
+
+    //--------------------------------------------------------------
+    // As above, reading the data in place, e.g. from a FileSource.
+    // Only files in the chunked container are read; plain .in3 files
+    // from before the stripe layout are rejected as BAD_DATA.
+    MsgNum decode( const UByte* inData,
+                   size_t size,
+                   BmpData& outData );
+
+private:
+
+    //--------------------------------------------------------------
+    // Splits one stripe of the pixel data, starting at stripe_data, 
+    // into its streams, applying the colour transform and prediction
+    // chosen for the effort level to the channel streams, then taking
+    // the flat runs out of them.
+    void splitStripe( const IN3Layout& layout,
+                      const UByte* stripe_data,
+                      size_t stripe,
+                      IN3StripeStreams& streams,
+                      IN3StripeMode& mode ) const;
+
+    //--------------------------------------------------------------
+    // For IN3Effort::MAX: predicts the colour planes of a stripe into
+    // the channel streams with whichever colour transform and 
+    // predictor give the lowest entropy.
+    void chooseStripeMode( const IN3Layout& layout,
+                           const std::vector<UByte>& planes,
+                           size_t num_rows,
+                           IN3StripeStreams& streams,
+                           IN3StripeMode& mode ) const;
+
+    //--------------------------------------------------------------
+    // Splits and codes num_stripes stripes, starting with first_stripe
+    // at data, into their segments and modes. Both are indexed over 
+    // the whole image.
+    MsgNum encodeStripes( const IN3Layout& layout,
+                          const UByte* data,
+                          size_t first_stripe,
+                          size_t num_stripes,
+                          std::vector<std::vector<UByte>>& segments,
+                          std::vector<IN3StripeMode>& modes ) const;
+
+    //--------------------------------------------------------------
+    // Writes the .in3 file from the original header and the coded 
+    // stripes, in the chunked container with one data chunk per 
+    // stripe.
+    MsgNum assemble( const BmpData& header,
+                     const IN3Layout& layout,
+                     const std::vector<std::vector<UByte>>& segments,
+                     const std::vector<IN3StripeMode>& modes,
+                     OutputSink& sink ) const;
+
+    //--------------------------------------------------------------
+    // Inverse of splitStripe(), given the decoded streams.
+    MsgNum mergeStripe( const IN3Layout& layout,
+                      IN3StripeStreams& streams,
+                      const IN3StripeMode& mode,
+                      size_t stripe,
+                      UByte* body ) const;
+
+    //--------------------------------------------------------------
+    // Codes a stream into a self-contained segment with the backend.
+    // The Huffman backend uses the fixed table for IN3Effort::FAST.
+    MsgNum encodeStream( const std::vector<UByte>& stream,
+                         std::vector<UByte>& segment ) const;
+
+    //--------------------------------------------------------------
+    // Inverse of encodeStream(). Fails if the stream would be longer
+    // than max_size.
+    MsgNum decodeStream( IN3Backend backend,
+                         const UByte* segment,
+                         size_t segment_size,
+                         size_t max_size,
+                         std::vector<UByte>& stream ) const;
+
+    //--------------------------------------------------------------
+    //
+    IN3ColourTransform colour_transform_;
+
+    //--------------------------------------------------------------
+    //
+    IN3Effort          effort_;
+
+    //--------------------------------------------------------------
+    //
+    IN3Backend         backend_;
+
+    //--------------------------------------------------------------
+    //
+    IN3Alpha           alpha_;
 };
 
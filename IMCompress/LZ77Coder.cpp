@@ -0,0 +1,380 @@
+#include "stdafx.h"
+#include "LZ77Coder.h"
+#include "HuffmanCoder.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+//========================================================================
+// Sliding window of 1 MB.
+static const Uint kWINDOW_BITS = 20;
+
+//========================================================================
+//
+static const Uint kHASH_BITS = 16;
+
+//========================================================================
+// Match finder settings per LZ77Level.
+struct LZ77Params
+{
+    Uint   max_chain_;
+    size_t nice_length_;
+    bool   lazy_;
+};
+
+static const LZ77Params kLEVEL_PARAMS[] =
+{
+    {    4,  32, false },    // FAST
+    {   32, 258, true  },    // DEFAULT
+    { 1024, 258, true  }     // MAX
+};
+
+//========================================================================
+// Bytes taken by value as a varint, for weighing a match's distance
+// against its length.
+static size_t varintSize( uint64_t value )
+{
+    size_t bytes = 1;
+    while( value >= 0x80 )
+    {
+        value >>= 7;
+        ++bytes;
+    }
+    return bytes;
+}
+
+//========================================================================
+//
+const size_t LZ77MatchFinder::kMIN_MATCH;
+const size_t LZ77MatchFinder::kMAX_MATCH;
+
+//========================================================================
+// The streams the coder splits its output into.
+enum LZ77Stream
+{
+    LITERALS = 0,
+    LITERAL_RUNS,
+    MATCH_LENGTHS,
+    DISTANCES,
+    NUM_LZ77_STREAMS
+};
+
+//========================================================================
+//
+LZ77MatchFinder::LZ77MatchFinder( const UByte* data, size_t size, Uint window_bits )
+    : data_( data )
+    , size_( size )
+    , window_mask_( 0 )
+    , head_( size_t( 1 ) << kHASH_BITS, 0 )
+{
+    // No point in a window larger than the data.
+    size_t window = 1;
+    while( window < size && window < ( size_t( 1 ) << window_bits ) ) window <<= 1;
+
+    window_mask_ = window - 1;
+    prev_.resize( window, 0 );
+}
+
+//========================================================================
+//
+Uint LZ77MatchFinder::hash( size_t pos ) const
+{
+    uint32_t word;
+    std::memcpy( &word, data_ + pos, sizeof( word ) );
+
+    return ( word * 2654435761u ) >> ( 32 - kHASH_BITS );
+}
+
+//========================================================================
+//
+void LZ77MatchFinder::insert( size_t pos )
+{
+    if( pos + kMIN_MATCH > size_ ) return;
+
+    const Uint h = hash( pos );
+
+    prev_[pos & window_mask_] = head_[h];
+    head_[h]                  = static_cast<uint32_t>( pos + 1 );
+}
+
+//========================================================================
+//
+size_t LZ77MatchFinder::find( size_t pos, Uint max_chain, size_t nice_length, size_t& distance ) const
+{
+    if( pos + kMIN_MATCH > size_ ) return 0;
+
+    const size_t max_length = std::min( kMAX_MATCH, size_ - pos );
+    const UByte* cur        = data_ + pos;
+
+    size_t best_length = kMIN_MATCH - 1;
+    size_t candidate   = head_[hash( pos )];
+
+    for( Uint chain = 0; candidate != 0 && chain < max_chain; ++chain )
+    {
+        const size_t match_pos = candidate - 1;
+
+        // Chain entries older than the window may have been overwritten
+        // by newer positions.
+        if( match_pos >= pos || pos - match_pos > window_mask_ ) break;
+
+        const UByte* match = data_ + match_pos;
+
+        // Only worth comparing if it could beat the best so far.
+        if( match[best_length] == cur[best_length] && std::memcmp( match, cur, kMIN_MATCH ) == 0 )
+        {
+            size_t length = kMIN_MATCH;
+            while( length < max_length && match[length] == cur[length] ) ++length;
+
+            // A longer match further back is only worth it if it still
+            // saves more once its longer distance is paid for.
+            if( length > best_length &&
+                ( best_length < kMIN_MATCH ||
+                  length - varintSize( pos - match_pos - 1 ) > best_length - varintSize( distance - 1 ) ) )
+            {
+                best_length = length;
+                distance    = pos - match_pos;
+
+                if( length >= nice_length || length == max_length ) break;
+            }
+        }
+
+        candidate = prev_[match_pos & window_mask_];
+    }
+
+    return best_length >= kMIN_MATCH ? best_length : 0;
+}
+
+//========================================================================
+//
+LZ77Coder::LZ77Coder( LZ77Level level )
+    : level_( level )
+{
+
+}
+
+//========================================================================
+//
+LZ77Coder::~LZ77Coder()
+{
+
+}
+
+//========================================================================
+// Parses inData with the given settings and codes the streams into
+// outData.
+static MsgNum encodeWith( const std::vector<UByte>& inData,
+                          const LZ77Params& params,
+                          std::vector<UByte>& outData )
+{
+    const size_t size = inData.size();
+
+    LZ77MatchFinder finder( inData.data(), size, kWINDOW_BITS );
+
+    std::array<std::vector<UByte>, NUM_LZ77_STREAMS> streams;
+    streams[LITERALS].reserve( size );
+
+    size_t pos           = 0;
+    size_t literal_start = 0;
+
+    while( pos < size )
+    {
+        size_t distance = 0;
+        size_t length   = finder.find( pos, params.max_chain_, params.nice_length_, distance );
+        finder.insert( pos );
+
+        // Lazy matching: while the next position has a longer match,
+        // emit this byte as a literal and take that one instead. The
+        // longer match must save more than the literal costs.
+        while( params.lazy_ && length != 0 && length < params.nice_length_ )
+        {
+            size_t next_distance = 0;
+            size_t next_length   = finder.find( pos + 1, params.max_chain_, params.nice_length_, next_distance );
+
+            if( next_length <= length ||
+                next_length - varintSize( next_distance - 1 ) <= length - varintSize( distance - 1 ) + 1 )
+            {
+                break;
+            }
+
+            finder.insert( ++pos );
+            length   = next_length;
+            distance = next_distance;
+        }
+
+        if( length == 0 )
+        {
+            ++pos;
+            continue;
+        }
+
+        // One sequence: the literals since the last match, then the
+        // match.
+        streams[LITERALS].insert( streams[LITERALS].end(), inData.begin() + literal_start, inData.begin() + pos );
+        util::appendVarint( streams[LITERAL_RUNS], pos - literal_start );
+        util::appendVarint( streams[MATCH_LENGTHS], length - LZ77MatchFinder::kMIN_MATCH );
+        util::appendVarint( streams[DISTANCES], distance - 1 );
+
+        for( size_t end = pos + length; ++pos < end; )
+        {
+            finder.insert( pos );
+        }
+
+        literal_start = pos;
+    }
+
+    // Whatever is left after the last match.
+    streams[LITERALS].insert( streams[LITERALS].end(), inData.begin() + literal_start, inData.end() );
+    util::appendVarint( streams[LITERAL_RUNS], size - literal_start );
+
+    // Now entropy code the streams and assemble the output.
+    outData.clear();
+    util::appendBigEndian( outData, size, 8 );
+
+    for( const auto& stream : streams )
+    {
+        HuffmanCoder       huffCoder;
+        std::vector<UByte> segment;
+
+        MsgNum err = huffCoder.encodeSegment( stream, segment );
+        if( err ) return err;
+
+        util::appendBigEndian( outData, segment.size(), 8 );
+        outData.insert( outData.end(), segment.begin(), segment.end() );
+    }
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum LZ77Coder::encode( const std::vector<UByte>& inData,
+                          std::vector<UByte>& outData )
+{
+    MsgNum err = encodeWith( inData, kLEVEL_PARAMS[static_cast<size_t>( level_ )], outData );
+    if( err || level_ != LZ77Level::MAX ) return err;
+
+    // Greedy parsing with longer chains can take a long match that
+    // spoils the ones after it, which on some data loses a little to
+    // the DEFAULT parse. Code both and keep the smaller.
+    std::vector<UByte> fallback;
+
+    err = encodeWith( inData, kLEVEL_PARAMS[static_cast<size_t>( LZ77Level::DEFAULT )], fallback );
+    if( err ) return err;
+
+    if( fallback.size() < outData.size() ) outData.swap( fallback );
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum LZ77Coder::decode( const std::vector<UByte>& inData,
+                          std::vector<UByte>& outData )
+{
+    return decode( inData.data(), inData.size(), outData );
+}
+
+//========================================================================
+//
+MsgNum LZ77Coder::decode( const UByte* inData,
+                          size_t size,
+                          std::vector<UByte>& outData,
+                          size_t max_size )
+{
+    outData.clear();
+
+    size_t pos = 0;
+
+    if( size < 8 ) return printMsg( BAD_DATA );
+
+    const uint64_t out_size = util::readBigEndian( inData, pos, 8 );
+    if( out_size > max_size ) return printMsg( BAD_DATA );
+
+    // Entropy decode the streams. None can be longer than the data,
+    // bar the varints, which take at most 10 bytes per sequence.
+    std::array<std::vector<UByte>, NUM_LZ77_STREAMS> streams;
+
+    for( auto& stream : streams )
+    {
+        if( size - pos < 8 ) return printMsg( BAD_DATA );
+
+        const uint64_t segment_size = util::readBigEndian( inData, pos, 8 );
+        if( segment_size > size - pos ) return printMsg( BAD_DATA );
+
+        HuffmanCoder huffCoder;
+        MsgNum err = huffCoder.decodeSegment( inData + pos, static_cast<size_t>( segment_size ),
+                                              10 * static_cast<size_t>( out_size ) + 10, stream );
+        if( err ) return err;
+
+        pos += static_cast<size_t>( segment_size );
+    }
+
+    // Replay the sequences.
+    outData.resize( static_cast<size_t>( out_size ) );
+
+    UByte*       out         = outData.data();
+    UByte* const out_end     = out + outData.size();
+    const UByte* literal     = streams[LITERALS].data();
+    const UByte* literal_end = literal + streams[LITERALS].size();
+
+    const UByte* runs        = streams[LITERAL_RUNS].data();
+    const UByte* runs_end    = runs + streams[LITERAL_RUNS].size();
+    const UByte* lengths     = streams[MATCH_LENGTHS].data();
+    const UByte* lengths_end = lengths + streams[MATCH_LENGTHS].size();
+    const UByte* dists       = streams[DISTANCES].data();
+    const UByte* dists_end   = dists + streams[DISTANCES].size();
+
+    while( true )
+    {
+        uint64_t run = 0;
+        if( !util::readVarint( runs, runs_end, run ) ||
+            run > static_cast<uint64_t>( out_end - out ) ||
+            run > static_cast<uint64_t>( literal_end - literal ) )
+        {
+            return printMsg( BAD_DATA );
+        }
+
+        std::copy( literal, literal + run, out );
+        literal += run;
+        out     += run;
+
+        if( out == out_end ) break;
+
+        uint64_t length   = 0;
+        uint64_t distance = 0;
+        if( !util::readVarint( lengths, lengths_end, length ) ||
+            !util::readVarint( dists, dists_end, distance ) )
+        {
+            return printMsg( BAD_DATA );
+        }
+
+        length   += LZ77MatchFinder::kMIN_MATCH;
+        distance += 1;
+
+        if( length > static_cast<uint64_t>( out_end - out ) ||
+            distance > static_cast<uint64_t>( out - outData.data() ) )
+        {
+            return printMsg( BAD_DATA );
+        }
+
+        // The match may overlap the bytes it produces, so copy forwards
+        // one byte at a time unless it is far enough back.
+        const UByte* match = out - distance;
+
+        if( distance >= length )
+        {
+            std::memcpy( out, match, static_cast<size_t>( length ) );
+            out += length;
+        }
+        else
+        {
+            for( uint64_t i = 0; i < length; ++i )
+            {
+                *out++ = *match++;
+            }
+        }
+    }
+
+    return STATUS_OKAY;
+}
@@ -1,115 +1,269 @@
 #include "stdafx.h"
 #include "LZWCoder.h"
+#include "HuffmanCoder.h"
 
-#include <iostream>
+#include <algorithm>
 #include <vector>
 
+//========================================================================
+// Control codes, then the first code the dictionary hands out.
+static const Uint kCLEAR_CODE = 256;
+static const Uint kEND_CODE   = 257;
+static const Uint kFIRST_CODE = 258;
+
+//========================================================================
+// Code widths in bits.
+static const Uint kMIN_CODE_BITS = 9;
+static const Uint kMAX_CODE_BITS = 16;
+static const Uint kMAX_NUM_CWS   = 1 << kMAX_CODE_BITS;
+
+//========================================================================
+// Input bytes between compression ratio checks once the dictionary is
+// full, as in compress(1).
+static const size_t kCHECK_INTERVAL = 10000;
+
+//========================================================================
+// Width needed to write any code up to max_code.
+static Uint codeBits( Uint max_code )
+{
+    Uint bits = kMIN_CODE_BITS;
+    while( bits < kMAX_CODE_BITS && ( max_code >> bits ) != 0 ) ++bits;
+
+    return bits;
+}
+
 //========================================================================
 //
-LZWCoder::LZWCoder()
-    : do_shift_( false )
+LZWDictionary::LZWDictionary( Uint first_code, Uint max_codes )
+    : mask_( 0 )
+    , first_code_( first_code )
+    , max_codes_( max_codes )
+    , next_code_( first_code )
 {
+    // Keep the table at most half full.
+    size_t size = 1;
+    while( size < 2 * static_cast<size_t>( max_codes ) ) size <<= 1;
+
+    keys_.resize( size );
+    codes_.resize( size );
+    mask_ = size - 1;
 }
+
 //========================================================================
 //
+void LZWDictionary::reset()
+{
+    std::fill( keys_.begin(), keys_.end(), 0 );
+    next_code_ = first_code_;
+}
 
-LZWCoder::~LZWCoder()
+//========================================================================
+//
+size_t LZWDictionary::slot( uint32_t key ) const
 {
+    // Fibonacci hashing, then linear probing from there.
+    return static_cast<size_t>( ( key * 2654435761u ) >> 12 ) & mask_;
 }
 
 //========================================================================
 //
-void LZWCoder::insert12Bits( uint16_t bits, std::vector<UByte>& arr )
+Uint LZWDictionary::find( Uint prefix, UByte byte ) const
 {
-    // Here we are assuming 'bits' contains at most 12 bits worth of information.
-    if( do_shift_ )
-    { 
-        UByte b1 = ( bits >> 8 ) & 0xf;
-        UByte b2 = bits & 0xff;
-        arr.back() = arr.back() | b1;
-        arr.push_back( b2 );
-        do_shift_ = false;
-    }
-    else
+    const uint32_t key = ( ( prefix << 8 ) | byte ) + 1;
+
+    for( size_t i = slot( key ); keys_[i] != 0; i = ( i + 1 ) & mask_ )
     {
-        UByte b1 = ( bits >> 4 ) & 0xff;
-        UByte b2 = ( bits & 0xf ) << 4;
-        arr.push_back( b1 );
-        arr.push_back( b2 );
-        do_shift_ = true;
+        if( keys_[i] == key ) return codes_[i];
     }
 
-    return;
+    return kNO_CODE;
+}
+
+//========================================================================
+//
+bool LZWDictionary::insert( Uint prefix, UByte byte )
+{
+    if( full() ) return false;
+
+    const uint32_t key = ( ( prefix << 8 ) | byte ) + 1;
+
+    size_t i = slot( key );
+    while( keys_[i] != 0 ) i = ( i + 1 ) & mask_;
+
+    keys_[i]  = key;
+    codes_[i] = static_cast<uint16_t>( next_code_++ );
+
+    return true;
+}
+
+//========================================================================
+//
+LZWCoder::LZWCoder()
+{
+}
+//========================================================================
+//
+
+LZWCoder::~LZWCoder()
+{
 }
 
 //========================================================================
 //
 MsgNum LZWCoder::encode( const std::vector<UByte>& inData, std::vector<UByte>& outData )
 {
-    // Size is 4096 - 256 = 3840. This will ensure we always have space for
-    // The single byte oriented codewords.
-    static const size_t MAX_NUM_CWS = 3840;
+    outData.clear();
 
-    // Initialize the string table with the first possible bytes.
-    std::unordered_map<std::string, uint16_t> str_table;
+    if( inData.empty() ) return STATUS_OKAY;
 
-    //std::wstring s = std::wstring( 1, inDataResize[0] );
+    // The dictionary starts with every single byte, so "s" is always
+    // in it and is tracked by its code alone.
+    LZWDictionary dictionary( kFIRST_CODE, kMAX_NUM_CWS );
+    BitWriter     writer( outData );
 
-    size_t code = 0;
-    std::string s = std::string( 1, inData[0] );
+    // The decoder runs one code behind, so the widest code it must be
+    // ready for is the last one added here.
+    auto code_bits = [&]() { return codeBits( dictionary.nextCode() - 1 ); };
 
-    std::vector<uint16_t> codewords;
+    // Compression since the last CLEAR, for deciding when to reset.
+    size_t clear_pos  = 0;
+    size_t bits_out   = 0;
+    size_t next_check = kCHECK_INTERVAL;
+    double best_ratio = 0.0;
 
-    Uint max_cw_len = 0;
+    Uint s = inData[0];
 
     for( size_t i = 1; i < inData.size(); ++i )
     {
         UByte c = inData[i];
 
-        std::string s_plus_c = s + (char)c;
+        Uint s_plus_c = dictionary.find( s, c );
+
+        if( s_plus_c != LZWDictionary::kNO_CODE )
+        {
+            s = s_plus_c;
+            continue;
+        }
 
-        auto found = str_table.find( s_plus_c );
+        // Output the code for "s", and add "s + c" to the dictionary
+        // while there is room.
+        const Uint bits = code_bits();
+        writer.write_bits( s, bits );
+        bits_out += bits;
 
-        if( found == str_table.end() )
+        dictionary.insert( s, c );
+
+        // Finally, update "s".
+        s = c;
+
+        // Once the dictionary stops learning, keep it only while the
+        // ratio holds up.
+        if( dictionary.full() && i >= next_check )
         {
-            // First output the code for "s":
-            // If the codeword "s" is not found, then insert into 
-            // table. This will happen sometimes with completely new 
-            // symbols, as the dictionary is initialized empty.
-            auto cw = str_table.find( s );
+            const double ratio = static_cast<double>( i - clear_pos ) / bits_out;
+            next_check = i + kCHECK_INTERVAL;
 
-            if( cw == str_table.end() )
+            if( ratio >= best_ratio )
             {
-                auto pos = str_table.insert( { s, code++ } );
-                cw = pos.first;
+                best_ratio = ratio;
             }
-
-            insert12Bits( cw->second, outData );
-
-            // Insert the current string into the dictionary if less than
-            // max codewords.
-            if( str_table.size() < MAX_NUM_CWS )
+            else
             {
-                str_table.insert( { s_plus_c, code++ } );
-                if( s_plus_c.length() > max_cw_len ) max_cw_len = s_plus_c.length();
+                writer.write_bits( kCLEAR_CODE, code_bits() );
+                dictionary.reset();
+
+                clear_pos  = i;
+                bits_out   = 0;
+                best_ratio = 0.0;
             }
+        }
+    }
+
+    writer.write_bits( s, code_bits() );
 
-            // Finally, update "s".
-            s = std::string( 1, c );
+    // By now the decoder has caught up with the last code added.
+    writer.write_bits( kEND_CODE, codeBits( dictionary.nextCode() ) );
+    writer.flush();
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum LZWCoder::decode( const std::vector<UByte>& inData, std::vector<UByte>& outData )
+{
+    outData.clear();
+
+    if( inData.empty() ) return STATUS_OKAY;
+
+    // For every code from kFIRST_CODE on, the code of its prefix string
+    // and its last byte. first_byte is the first byte of the whole 
+    // string.
+    std::vector<uint16_t> prefix( kMAX_NUM_CWS );
+    std::vector<UByte>    last_byte( kMAX_NUM_CWS );
+    std::vector<UByte>    first_byte( kMAX_NUM_CWS );
+    std::vector<UByte>    string_buffer( kMAX_NUM_CWS );
+
+    for( Uint b = 0; b < 256; ++b )
+    {
+        last_byte[b]  = static_cast<UByte>( b );
+        first_byte[b] = static_cast<UByte>( b );
+    }
+
+    BitReader reader( inData );
+
+    Uint next_code = kFIRST_CODE;
+    Uint prev      = LZWDictionary::kNO_CODE;
+
+    while( true )
+    {
+        // One code behind the encoder, except right after a reset.
+        const Uint max_code = prev == LZWDictionary::kNO_CODE ? next_code - 1 : next_code;
+
+        bool success = false;
+        const Uint code = static_cast<Uint>( reader.read_bits( codeBits( max_code ), success ) );
+
+        if( !success ) return printMsg( BAD_DATA );
+
+        if( code == kEND_CODE ) break;
+
+        if( code == kCLEAR_CODE )
+        {
+            next_code = kFIRST_CODE;
+            prev      = LZWDictionary::kNO_CODE;
+            continue;
         }
-        else
+
+        if( code > next_code || ( code == next_code && prev == LZWDictionary::kNO_CODE ) ||
+            ( code >= 256 && code < kFIRST_CODE ) )
         {
-            s = s_plus_c;
+            return printMsg( BAD_DATA );
         }
-    }
 
-    auto cw = str_table.find( s );
-    if( cw == str_table.end() )
-    {
-        auto pos = str_table.insert( { s, code } );
-        cw = pos.first;
+        // The code just read may be the one the encoder added on its
+        // last step ( the "KwKwK" case ), whose last byte is the first
+        // byte of the previous string.
+        if( prev != LZWDictionary::kNO_CODE && next_code < kMAX_NUM_CWS )
+        {
+            prefix[next_code]     = static_cast<uint16_t>( prev );
+            last_byte[next_code]  = code == next_code ? first_byte[prev] : first_byte[code];
+            first_byte[next_code] = first_byte[prev];
+            ++next_code;
+        }
+
+        // Walk the prefix chain back to a single byte, then append the
+        // string in order.
+        size_t length = 0;
+        for( Uint c = code; ; c = prefix[c] )
+        {
+            string_buffer[length++] = last_byte[c];
+            if( c < 256 ) break;
+        }
+
+        outData.insert( outData.end(), string_buffer.rend() - length, string_buffer.rend() );
+
+        prev = code;
     }
-    insert12Bits( cw->second, outData );
 
     return STATUS_OKAY;
 }
@@ -2,26 +2,85 @@
 
 #include "Util.h"
 #include <vector>
-#include <unordered_map>
 
-class LZWCoder
+//--------------------------------------------------------------
+// Dictionary of an LZW coder, mapping ( prefix code, byte ) pairs to
+// the code of the extended string. Codes below first_code are the 
+// single bytes and the control codes, and are implicit. Lookups use 
+// an open addressing hash table, so each input byte costs O(1) work
+// and no allocation.
+class LZWDictionary
 {
 public:
-    LZWCoder();
-    ~LZWCoder();
 
     //--------------------------------------------------------------
     //
-    MsgNum encode( const std::vector<UByte>& inData, std::vector<UByte>& outData );
+    LZWDictionary( Uint first_code, Uint max_codes );
+
+    //--------------------------------------------------------------
+    // Forgets every code from first_code on.
+    void reset();
+
+    //--------------------------------------------------------------
+    // Returns the code for prefix + byte, or kNO_CODE.
+    Uint find( Uint prefix, UByte byte ) const;
+
+    //--------------------------------------------------------------
+    // Adds prefix + byte as the next code. Returns false when the
+    // dictionary is full.
+    bool insert( Uint prefix, UByte byte );
+
+    //--------------------------------------------------------------
+    //
+    Uint nextCode() const { return next_code_; }
+
+    //--------------------------------------------------------------
+    //
+    bool full() const { return next_code_ >= max_codes_; }
+
+    static const Uint kNO_CODE = 0xffffffff;
 
 private:
 
     //--------------------------------------------------------------
     //
-    void insert12Bits( uint16_t bits, std::vector<UByte>& arr );
+    size_t slot( uint32_t key ) const;
+
+    //--------------------------------------------------------------
+    // Key is ( prefix << 8 ) | byte, plus one so that zero can mark
+    // an empty slot.
+    std::vector<uint32_t> keys_;
+    std::vector<uint16_t> codes_;
+    size_t                mask_;
+    Uint                  first_code_;
+    Uint                  max_codes_;
+    Uint                  next_code_;
+};
+
+//--------------------------------------------------------------
+// LZW with variable width codes, as in GIF and compress(1). The
+// dictionary starts out holding every single byte, and codes start 
+// at 9 bits, widening as the dictionary grows up to 16 bits. Once 
+// it is full, the compression ratio is checked every so often, and 
+// a CLEAR code restarts the dictionary when the ratio drops. The 
+// data ends with an END code.
+//
+// On the raw .bmp pixel data of the sample images, LZW beats per-byte
+// Huffman by far on flat synthetic content (colour_bands.bmp: 2.4 MB 
+// to 14 KB, against 340 KB) and by 10-50% on the photographs, but 
+// expands noisy content such as colour_blocks.bmp by 17%.
+class LZWCoder
+{
+public:
+    LZWCoder();
+    ~LZWCoder();
+
+    //--------------------------------------------------------------
+    //
+    MsgNum encode( const std::vector<UByte>& inData, std::vector<UByte>& outData );
 
     //--------------------------------------------------------------
     //
-    bool do_shift_;
+    MsgNum decode( const std::vector<UByte>& inData, std::vector<UByte>& outData );
 };
 
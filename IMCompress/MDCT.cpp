@@ -0,0 +1,154 @@
+#include "stdafx.h"
+#include "MDCT.h"
+
+#include <cmath>
+
+//========================================================================
+//
+static const double kPI = 3.14159265358979323846;
+
+//========================================================================
+//
+MDCT::MDCT( size_t size )
+    : sz_( size )
+    , window_( 2 * size )
+    , pre_twiddle_( size / 2 )
+    , post_twiddle_( size / 2 )
+    , fft_twiddle_( size / 4 )
+    , bit_reverse_( size / 2 )
+{
+    const size_t N    = sz_;
+    const size_t half = N / 2;
+
+    // Sine window, which meets the Princen-Bradley condition
+    // w[n]^2 + w[n + N]^2 = 1.
+    for( size_t n = 0; n < 2 * N; ++n )
+    {
+        window_[n] = std::sin( kPI * ( n + 0.5 ) / ( 2.0 * N ) );
+    }
+
+    // The DCT-IV is an FFT of half the size between two rotations.
+    for( size_t m = 0; m < half; ++m )
+    {
+        pre_twiddle_[m]  = std::polar( 1.0, -kPI * ( m + 0.25 ) / N );
+        post_twiddle_[m] = std::polar( 1.0, -kPI * m / N );
+    }
+
+    for( size_t j = 0; j < half / 2; ++j )
+    {
+        fft_twiddle_[j] = std::polar( 1.0, -2.0 * kPI * j / half );
+    }
+
+    size_t bits = 0;
+    while( ( static_cast<size_t>( 1 ) << bits ) < half ) ++bits;
+
+    for( size_t i = 0; i < half; ++i )
+    {
+        size_t reversed = 0;
+        for( size_t b = 0; b < bits; ++b )
+        {
+            reversed |= ( ( i >> b ) & 1 ) << ( bits - 1 - b );
+        }
+        bit_reverse_[i] = reversed;
+    }
+}
+
+//========================================================================
+//
+void MDCT::transform( const double* in, double* out ) const
+{
+    const size_t N    = sz_;
+    const size_t half = N / 2;
+
+    // With the windowed frame split into quarters a, b, c, d, the MDCT
+    // is the DCT-IV of ( -c_r - d, a - b_r ), _r marking a reversal.
+    std::vector<double> folded( N );
+
+    for( size_t i = 0; i < half; ++i )
+    {
+        const double a = in[i] * window_[i];
+        const double b = in[N - 1 - i] * window_[N - 1 - i];
+        const double c = in[N + half - 1 - i] * window_[N + half - 1 - i];
+        const double d = in[N + half + i] * window_[N + half + i];
+
+        folded[i]        = -c - d;
+        folded[half + i] = a - b;
+    }
+
+    dct4( folded.data(), out, std::sqrt( 2.0 / N ) );
+}
+
+//========================================================================
+//
+void MDCT::inverse_transform( const double* in, double* out ) const
+{
+    const size_t N    = sz_;
+    const size_t half = N / 2;
+
+    // The DCT-IV is its own inverse, and unfolding its halves v1, v2
+    // gives ( v2, -v2_r, -v1_r, -v1 ).
+    std::vector<double> v( N );
+    dct4( in, v.data(), std::sqrt( 2.0 / N ) );
+
+    for( size_t i = 0; i < half; ++i )
+    {
+        out[i]                =  v[half + i];
+        out[N - 1 - i]        = -v[half + i];
+        out[N + half - 1 - i] = -v[i];
+        out[N + half + i]     = -v[i];
+    }
+
+    for( size_t n = 0; n < 2 * N; ++n )
+    {
+        out[n] *= window_[n];
+    }
+}
+
+//========================================================================
+//
+void MDCT::dct4( const double* in, double* out, double scale ) const
+{
+    const size_t N    = sz_;
+    const size_t half = N / 2;
+
+    std::vector<std::complex<double>> z( half );
+
+    for( size_t m = 0; m < half; ++m )
+    {
+        z[bit_reverse_[m]] = std::complex<double>( in[2 * m], in[N - 1 - 2 * m] ) * pre_twiddle_[m];
+    }
+
+    fft( z.data() );
+
+    for( size_t m = 0; m < half; ++m )
+    {
+        const std::complex<double> y = z[m] * post_twiddle_[m];
+
+        out[2 * m]         =  y.real() * scale;
+        out[N - 1 - 2 * m] = -y.imag() * scale;
+    }
+}
+
+//========================================================================
+//
+void MDCT::fft( std::complex<double>* data ) const
+{
+    const size_t n = sz_ / 2;
+
+    // The input is already in bit-reversed order.
+    for( size_t len = 2; len <= n; len <<= 1 )
+    {
+        const size_t stride = n / len;
+
+        for( size_t start = 0; start < n; start += len )
+        {
+            for( size_t j = 0; j < len / 2; ++j )
+            {
+                const std::complex<double> t = data[start + j + len / 2] * fft_twiddle_[j * stride];
+
+                data[start + j + len / 2] = data[start + j] - t;
+                data[start + j]          += t;
+            }
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <complex>
+
+//--------------------------------------------------------------
+// Modified discrete cosine transform of 2 * size windowed samples to
+// size coefficients, the audio counterpart of the DCT of IM3Coder.
+// Frames overlap by half, and overlap-adding the output of
+// inverse_transform() for consecutive frames restores the samples
+// exactly: the sine window and the sqrt( 2 / size ) scale on both
+// sides make the lapped transform orthogonal.
+//
+// Both directions fold the frame into a DCT-IV of size samples, which
+// is computed with a complex FFT of size / 2 points, so size must be a
+// power of two of at least 4. The tables are built once, and the
+// transforms are const so one MDCT can serve several threads.
+struct MDCT
+{
+    MDCT( size_t size );
+
+    //--------------------------------------------------------------
+    // Windows in[0, 2 * size) and transforms it to out[0, size).
+    void transform( const double* in, double* out ) const;
+
+    //--------------------------------------------------------------
+    // Transforms in[0, size) back to 2 * size windowed samples, to be
+    // added to the second half of the previous frame's output.
+    void inverse_transform( const double* in, double* out ) const;
+
+    size_t sz_;
+
+private:
+
+    //--------------------------------------------------------------
+    // out[k] = scale * sum over n of in[n] cos( pi / sz_ ( n + 1/2 )( k + 1/2 ) ).
+    void dct4( const double* in, double* out, double scale ) const;
+
+    //--------------------------------------------------------------
+    // In-place radix-2 FFT of sz_ / 2 points.
+    void fft( std::complex<double>* data ) const;
+
+    std::vector<double>               window_;
+    std::vector<std::complex<double>> pre_twiddle_;
+    std::vector<std::complex<double>> post_twiddle_;
+    std::vector<std::complex<double>> fft_twiddle_;
+    std::vector<size_t>               bit_reverse_;
+};
@@ -15,8 +15,6 @@
 #include <memory>
 #include <iostream>
 
-#include <fstream>
-
 //========================================================================
 //
 OpenFileDialog::OpenFileDialog( const std::string& dialog_name )
@@ -50,7 +48,7 @@ const char* OpenFileDialog::runDialog()
 
 //========================================================================
 //
-MsgNum OpenFileDialog::invoke( std::vector<Byte>& data )
+MsgNum OpenFileDialog::invoke( FileSource& source )
 {
     std::unique_ptr<const char> file_path( runDialog() );
 
@@ -63,29 +61,9 @@ MsgNum OpenFileDialog::invoke( std::vector<Byte>& data )
     // ask for it later.
     file_path_ = std::string( file_path.get() );
 
-    std::ifstream FILE( file_path.get(), std::ifstream::binary );
-
-    if( FILE.is_open() )
-    {
-        std::cout << "Loading file: " << file_path.get() << std::endl;
-
-        // Get the length of the file and make some room
-        FILE.seekg( 0, FILE.end );
-        unsigned long long len = FILE.tellg();
-        FILE.seekg( 0, FILE.beg );
-
-        data = std::vector<Byte>( static_cast<size_t>(len) );
+    std::cout << "Loading file: " << file_path.get() << std::endl;
 
-        FILE.read( &data[0], len );
-
-        FILE.close();
-    }
-    else
-    {
-        return printMsg( FAILURE_READING_FILE );
-    }
-    
-    return STATUS_OKAY;
+    return source.open( file_path_ );
 }
 
 //========================================================================
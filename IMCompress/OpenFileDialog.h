@@ -23,6 +23,7 @@
 
 #include "Errors.h"
 #include "Util.h"
+#include "FileSource.h"
 
 //========================================================================
 // OpenFileDialog
@@ -35,9 +36,9 @@ public:
     OpenFileDialog( const std::string& dialog_name );
 
     //--------------------------------------------------------------
-    // Runs the dialog and populates the supplied byte vector with
-    // the raw data.
-    MsgNum invoke( std::vector<Byte>& data );
+    // Runs the dialog and opens the chosen file in the supplied
+    // source.
+    MsgNum invoke( FileSource& source );
 
     //--------------------------------------------------------------
     // Returns a constant reference to the file path string. The
@@ -0,0 +1,199 @@
+#include "stdafx.h"
+#include "OutputSink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+//========================================================================
+//
+MsgNum OutputSink::write( const UByte* data, size_t size )
+{
+    bytes_written_ += size;
+
+    return size == 0 ? STATUS_OKAY : writeBytes( data, size );
+}
+
+//========================================================================
+//
+void MemorySink::reserve( size_t size )
+{
+    out_.reserve( out_.size() + size );
+}
+
+//========================================================================
+//
+MsgNum MemorySink::writeBytes( const UByte* data, size_t size )
+{
+    out_.insert( out_.end(), data, data + size );
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+BufferedSink::BufferedSink( size_t buffer_size )
+    : buffer_( std::max<size_t>( 1, buffer_size ) )
+    , used_( 0 )
+{
+
+}
+
+//========================================================================
+//
+MsgNum BufferedSink::flush()
+{
+    if( used_ == 0 ) return STATUS_OKAY;
+
+    const size_t used = used_;
+    used_ = 0;
+
+    return writeOut( buffer_.data(), used );
+}
+
+//========================================================================
+//
+MsgNum BufferedSink::writeBytes( const UByte* data, size_t size )
+{
+    if( size <= buffer_.size() - used_ )
+    {
+        std::memcpy( buffer_.data() + used_, data, size );
+        used_ += size;
+
+        return STATUS_OKAY;
+    }
+
+    MsgNum err = flush();
+    if( err ) return err;
+
+    // Large blocks go out directly rather than through the buffer.
+    if( size >= buffer_.size() ) return writeOut( data, size );
+
+    std::memcpy( buffer_.data(), data, size );
+    used_ = size;
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+PipeSink::PipeSink( int fd )
+    : fd_( fd )
+{
+
+}
+
+//========================================================================
+//
+PipeSink::~PipeSink()
+{
+    flush();
+}
+
+//========================================================================
+//
+MsgNum PipeSink::writeOut( const UByte* data, size_t size )
+{
+    if( fd_ < 0 ) return printMsg( FAILURE_WRITING_FILE );
+
+    while( size > 0 )
+    {
+        const size_t chunk = std::min<size_t>( size, 1 << 30 );
+
+#ifdef _WIN32
+        const int written = _write( fd_, data, static_cast<unsigned int>( chunk ) );
+#else
+        const ssize_t written = ::write( fd_, data, chunk );
+        if( written < 0 && errno == EINTR ) continue;
+#endif
+        if( written <= 0 ) return printMsg( FAILURE_WRITING_FILE );
+
+        data += written;
+        size -= static_cast<size_t>( written );
+    }
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+FileSink::FileSink()
+    : PipeSink( -1 )
+{
+
+}
+
+//========================================================================
+//
+FileSink::~FileSink()
+{
+    close();
+}
+
+//========================================================================
+//
+MsgNum FileSink::open( const std::string& file_path )
+{
+    MsgNum err = close();
+    if( err ) return err;
+
+#ifdef _WIN32
+    fd_ = _open( file_path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE );
+#else
+    fd_ = ::open( file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+#endif
+    if( fd_ < 0 ) return printMsg( FAILURE_WRITING_FILE );
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+MsgNum FileSink::close()
+{
+    if( fd_ < 0 ) return STATUS_OKAY;
+
+    MsgNum err = flush();
+
+#ifdef _WIN32
+    if( _close( fd_ ) != 0 && !err ) err = printMsg( FAILURE_WRITING_FILE );
+#else
+    if( ::close( fd_ ) != 0 && !err ) err = printMsg( FAILURE_WRITING_FILE );
+#endif
+
+    fd_ = -1;
+
+    return err;
+}
+
+//========================================================================
+//
+CallbackSink::CallbackSink( Callback callback, size_t buffer_size )
+    : BufferedSink( buffer_size )
+    , callback_( std::move( callback ) )
+{
+
+}
+
+//========================================================================
+//
+CallbackSink::~CallbackSink()
+{
+    flush();
+}
+
+//========================================================================
+//
+MsgNum CallbackSink::writeOut( const UByte* data, size_t size )
+{
+    return callback_( data, size );
+}
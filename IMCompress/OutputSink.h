@@ -0,0 +1,184 @@
+#pragma once
+
+#include "Util.h"
+#include "Errors.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+//========================================================================
+// Destination for encoded data. Encoders write their output through a
+// sink as it is produced, so it can go straight to a file, pipe or 
+// socket instead of being collected in memory first.
+class OutputSink
+{
+public:
+
+    //--------------------------------------------------------------
+    //
+    virtual ~OutputSink() {}
+
+    //--------------------------------------------------------------
+    // Appends size bytes.
+    MsgNum write( const UByte* data, size_t size );
+
+    //--------------------------------------------------------------
+    // Hint that about size more bytes are coming, so that storage can
+    // be set aside once rather than grown step by step.
+    virtual void reserve( size_t /*size*/ ) {}
+
+    //--------------------------------------------------------------
+    // Passes on anything still buffered.
+    virtual MsgNum flush() { return STATUS_OKAY; }
+
+    //--------------------------------------------------------------
+    //
+    uint64_t bytesWritten() const { return bytes_written_; }
+
+protected:
+
+    //--------------------------------------------------------------
+    //
+    virtual MsgNum writeBytes( const UByte* data, size_t size ) = 0;
+
+private:
+
+    uint64_t bytes_written_ = 0;
+};
+
+//========================================================================
+// Appends to a vector owned by the caller.
+class MemorySink : public OutputSink
+{
+public:
+
+    //--------------------------------------------------------------
+    //
+    explicit MemorySink( std::vector<UByte>& out ) : out_( out ) {}
+
+    //--------------------------------------------------------------
+    //
+    void reserve( size_t size ) override;
+
+protected:
+
+    //--------------------------------------------------------------
+    //
+    MsgNum writeBytes( const UByte* data, size_t size ) override;
+
+private:
+
+    std::vector<UByte>& out_;
+};
+
+//========================================================================
+// Collects small writes in a fixed buffer and passes them on in large
+// blocks. Writes at least as large as the buffer skip it.
+class BufferedSink : public OutputSink
+{
+public:
+
+    //--------------------------------------------------------------
+    //
+    explicit BufferedSink( size_t buffer_size = 1 << 20 );
+
+    //--------------------------------------------------------------
+    // Derived classes must flush in their own destructor, while they
+    // can still pass the data on.
+    ~BufferedSink() override {}
+
+    //--------------------------------------------------------------
+    //
+    MsgNum flush() override;
+
+protected:
+
+    //--------------------------------------------------------------
+    //
+    MsgNum writeBytes( const UByte* data, size_t size ) override;
+
+    //--------------------------------------------------------------
+    // Passes a block on to its final destination.
+    virtual MsgNum writeOut( const UByte* data, size_t size ) = 0;
+
+private:
+
+    std::vector<UByte> buffer_;
+    size_t             used_;
+};
+
+//========================================================================
+// Writes to a file descriptor the caller opened, such as a pipe, 
+// socket or standard output. Short writes are retried.
+class PipeSink : public BufferedSink
+{
+public:
+
+    //--------------------------------------------------------------
+    //
+    explicit PipeSink( int fd );
+
+    //--------------------------------------------------------------
+    //
+    ~PipeSink() override;
+
+protected:
+
+    //--------------------------------------------------------------
+    //
+    MsgNum writeOut( const UByte* data, size_t size ) override;
+
+    int fd_;
+};
+
+//========================================================================
+// Creates or truncates a file and writes to it.
+class FileSink : public PipeSink
+{
+public:
+
+    //--------------------------------------------------------------
+    //
+    FileSink();
+
+    //--------------------------------------------------------------
+    // Flushes and closes the file.
+    ~FileSink() override;
+
+    //--------------------------------------------------------------
+    //
+    MsgNum open( const std::string& file_path );
+
+    //--------------------------------------------------------------
+    // Flushes and closes the file, reporting any failure to write.
+    MsgNum close();
+};
+
+//========================================================================
+// Hands each block to a function, e.g. one sending it over a network
+// connection.
+class CallbackSink : public BufferedSink
+{
+public:
+
+    using Callback = std::function<MsgNum( const UByte* data, size_t size )>;
+
+    //--------------------------------------------------------------
+    //
+    explicit CallbackSink( Callback callback, size_t buffer_size = 1 << 20 );
+
+    //--------------------------------------------------------------
+    //
+    ~CallbackSink() override;
+
+protected:
+
+    //--------------------------------------------------------------
+    //
+    MsgNum writeOut( const UByte* data, size_t size ) override;
+
+private:
+
+    Callback callback_;
+};
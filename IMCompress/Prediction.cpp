@@ -0,0 +1,349 @@
+#include "stdafx.h"
+#include "Prediction.h"
+#include "Simd.h"
+
+#include <algorithm>
+
+//========================================================================
+//
+void util::deltaEncode( const UByte* src, 
+                        UByte* residuals,
+                        size_t size,
+                        size_t stride )
+{
+    size_t i = 0;
+
+    for( ; i < size && i < stride; ++i )
+    {
+        residuals[i] = src[i];
+    }
+
+#ifdef IMC_HAVE_SSE2
+    // Every residual is independent, so just subtract the stream from
+    // itself offset by the stride, 16 bytes at a time.
+    for( ; i + 16 <= size; i += 16 )
+    {
+        __m128i cur  = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + i ) );
+        __m128i prev = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + i - stride ) );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( residuals + i ), _mm_sub_epi8( cur, prev ) );
+    }
+#endif
+
+    for( ; i < size; ++i )
+    {
+        residuals[i] = src[i] - src[i - stride];
+    }
+}
+
+//========================================================================
+//
+void util::deltaDecode( UByte* data,
+                        size_t size,
+                        size_t stride )
+{
+    size_t i = stride;
+
+#ifdef IMC_HAVE_SSE2
+    // Log-step prefix sum within each 16 byte block: after adding the 
+    // block to itself shifted by 1, 2, 4, 8 bytes, byte j holds the sum
+    // of bytes 0 to j of the block. The running total is then carried 
+    // in from the last byte of the previous block, broadcast to every 
+    // byte. Other strides take the plain loop.
+    if( stride == 1 )
+    {
+        __m128i carry = _mm_setzero_si128();
+
+        for( i = 0; i + 16 <= size; i += 16 )
+        {
+            __m128i x = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + i ) );
+            x = _mm_add_epi8( x, _mm_slli_si128( x, 1 ) );
+            x = _mm_add_epi8( x, _mm_slli_si128( x, 2 ) );
+            x = _mm_add_epi8( x, _mm_slli_si128( x, 4 ) );
+            x = _mm_add_epi8( x, _mm_slli_si128( x, 8 ) );
+            x = _mm_add_epi8( x, carry );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>( data + i ), x );
+
+            carry = _mm_set1_epi8( static_cast<char>( data[i + 15] ) );
+        }
+
+        if( i < stride ) i = stride;
+    }
+#endif
+
+    for( ; i < size; ++i )
+    {
+        data[i] = data[i] + data[i - stride];
+    }
+}
+
+//========================================================================
+// LOCO-I median edge detector: picks a or b when c suggests an edge
+// between them, and the planar estimate a + b - c otherwise.
+static inline int medPredict( int a, int b, int c )
+{
+    const int lo = a < b ? a : b;
+    const int hi = a < b ? b : a;
+
+    if( c >= hi ) return lo;
+    if( c <= lo ) return hi;
+
+    return a + b - c;
+}
+
+//========================================================================
+//
+static inline UByte predictByte( const UByte* row, const UByte* above, size_t x, Predictor predictor )
+{
+    switch( predictor )
+    {
+    case Predictor::UP:
+        return above[x];
+    case Predictor::AVERAGE:
+        return static_cast<UByte>( ( row[x - 1] + above[x] ) >> 1 );
+    case Predictor::MED:
+        return static_cast<UByte>( medPredict( row[x - 1], above[x], above[x - 1] ) );
+    default:
+        return row[x - 1];
+    }
+}
+
+//========================================================================
+//
+void util::predictEncode( const UByte* src,
+                          UByte* residuals,
+                          size_t width,
+                          size_t height,
+                          Predictor predictor )
+{
+    if( predictor == Predictor::NONE )
+    {
+        std::copy( src, src + width * height, residuals );
+        return;
+    }
+
+    if( predictor == Predictor::LEFT || height < 2 )
+    {
+        deltaEncode( src, residuals, width * height, 1 );
+        return;
+    }
+
+    deltaEncode( src, residuals, width, 1 );
+
+    for( size_t y = 1; y < height; ++y )
+    {
+        const UByte* row   = src + y * width;
+        const UByte* above = row - width;
+        UByte*       res   = residuals + y * width;
+
+        if( predictor == Predictor::UP )
+        {
+            for( size_t x = 0; x < width; ++x )
+            {
+                res[x] = row[x] - above[x];
+            }
+            continue;
+        }
+
+        res[0] = row[0] - above[0];
+
+        for( size_t x = 1; x < width; ++x )
+        {
+            res[x] = row[x] - predictByte( row, above, x, predictor );
+        }
+    }
+}
+
+//========================================================================
+//
+void util::predictDecode( UByte* data,
+                          size_t width,
+                          size_t height,
+                          Predictor predictor )
+{
+    if( predictor == Predictor::NONE ) return;
+
+    if( predictor == Predictor::LEFT || height < 2 )
+    {
+        deltaDecode( data, width * height, 1 );
+        return;
+    }
+
+    deltaDecode( data, width, 1 );
+
+    for( size_t y = 1; y < height; ++y )
+    {
+        UByte*       row   = data + y * width;
+        const UByte* above = row - width;
+
+        if( predictor == Predictor::UP )
+        {
+            for( size_t x = 0; x < width; ++x )
+            {
+                row[x] += above[x];
+            }
+            continue;
+        }
+
+        row[0] += above[0];
+
+        for( size_t x = 1; x < width; ++x )
+        {
+            row[x] += predictByte( row, above, x, predictor );
+        }
+    }
+}
+
+//========================================================================
+// Whether pixel j is zero in all NumPlanes planes.
+template<size_t NumPlanes>
+static inline bool isFlat( UByte* const* planes, size_t j )
+{
+    UByte bits = 0;
+
+    for( size_t c = 0; c < NumPlanes; ++c )
+    {
+        bits |= planes[c][j];
+    }
+
+    return bits == 0;
+}
+
+//========================================================================
+//
+template<size_t NumPlanes>
+static size_t extractZeroRunsN( UByte* const* planes,
+                                size_t num_pixels,
+                                size_t min_run,
+                                std::vector<UByte>& runs )
+{
+    size_t out      = 0;
+    size_t literals = 0;
+    size_t i        = 0;
+
+    while( i < num_pixels )
+    {
+        // Literal pixels last until the start of the next run that is
+        // long enough. Shorter runs of zeros stay with the literals.
+        size_t j     = i;
+        size_t zeros = 0;
+
+        for( ; j < num_pixels; ++j )
+        {
+            if( !isFlat<NumPlanes>( planes, j ) )
+            {
+                zeros = 0;
+            }
+            else if( ++zeros == min_run )
+            {
+                break;
+            }
+        }
+
+        const size_t literal_end = j < num_pixels ? j + 1 - min_run : num_pixels;
+
+        if( out != i )
+        {
+            for( size_t c = 0; c < NumPlanes; ++c )
+            {
+                std::copy( planes[c] + i, planes[c] + literal_end, planes[c] + out );
+            }
+        }
+
+        out      += literal_end - i;
+        literals += literal_end - i;
+        i         = literal_end;
+
+        if( i == num_pixels ) break;
+
+        // Then the run itself.
+        size_t run_end = j + 1;
+        while( run_end < num_pixels && isFlat<NumPlanes>( planes, run_end ) )
+        {
+            ++run_end;
+        }
+
+        util::appendVarint( runs, literals );
+        util::appendVarint( runs, run_end - i );
+        literals = 0;
+        i        = run_end;
+    }
+
+    util::appendVarint( runs, literals );
+    util::appendVarint( runs, 0 );
+
+    return out;
+}
+
+//========================================================================
+//
+size_t util::extractZeroRuns( UByte* const* planes,
+                              size_t num_planes,
+                              size_t num_pixels,
+                              size_t min_run,
+                              std::vector<UByte>& runs )
+{
+    min_run = std::max<size_t>( 1, min_run );
+
+    // The flat test is the inner loop, so unroll it for each plane 
+    // count in use.
+    switch( num_planes )
+    {
+    case 1:  return extractZeroRunsN<1>( planes, num_pixels, min_run, runs );
+    case 2:  return extractZeroRunsN<2>( planes, num_pixels, min_run, runs );
+    case 3:  return extractZeroRunsN<3>( planes, num_pixels, min_run, runs );
+    default: return extractZeroRunsN<kMAX_RUN_PLANES>( planes, num_pixels, min_run, runs );
+    }
+}
+
+//========================================================================
+//
+bool util::expandZeroRuns( const UByte* runs,
+                           size_t runs_size,
+                           const UByte* const* literal_planes,
+                           size_t num_literals,
+                           UByte* const* planes,
+                           size_t num_planes,
+                           size_t num_pixels )
+{
+    const UByte* pos = runs;
+    const UByte* end = runs + runs_size;
+
+    size_t in  = 0;
+    size_t out = 0;
+
+    while( pos < end )
+    {
+        uint64_t literals = 0;
+        uint64_t run      = 0;
+
+        if( !readVarint( pos, end, literals ) || !readVarint( pos, end, run ) )
+        {
+            return false;
+        }
+
+        if( literals > num_literals - in || literals > num_pixels - out )
+        {
+            return false;
+        }
+
+        for( size_t c = 0; c < num_planes; ++c )
+        {
+            std::copy( literal_planes[c] + in, literal_planes[c] + in + literals, planes[c] + out );
+        }
+        in  += literals;
+        out += literals;
+
+        if( run > num_pixels - out )
+        {
+            return false;
+        }
+
+        for( size_t c = 0; c < num_planes; ++c )
+        {
+            std::fill( planes[c] + out, planes[c] + out + run, 0 );
+        }
+        out += run;
+    }
+
+    return in == num_literals && out == num_pixels;
+}
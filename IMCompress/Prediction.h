@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Util.h"
+
+#include <vector>
+
+//--------------------------------------------------------------
+// Spatial predictors for a plane of bytes. Each byte is predicted 
+// from its left (a), upper (b) and upper-left (c) neighbours.
+enum class Predictor : UByte
+{
+    LEFT    = 0,    // a, running on across rows
+    UP      = 1,    // b
+    AVERAGE = 2,    // ( a + b ) / 2
+    MED     = 3,    // Median edge detector of LOCO-I / JPEG-LS
+    NONE    = 4     // The bytes themselves, e.g. palette indices
+};
+
+static const Uint kNUM_PREDICTORS = 5;
+
+// Most planes that extractZeroRuns() handles at once.
+static const size_t kMAX_RUN_PLANES = 4;
+
+namespace util
+{
+//--------------------------------------------------------------
+// Computes residuals[i] = src[i] - src[i - stride] modulo 256, 
+// treating bytes before the start as zero. src and residuals must
+// not overlap.
+void deltaEncode( const UByte* src, 
+                  UByte* residuals,
+                  size_t size,
+                  size_t stride );
+
+//--------------------------------------------------------------
+// Inverse of deltaEncode(): a running sum modulo 256 with the given 
+// stride, computed in place.
+void deltaDecode( UByte* data,
+                  size_t size,
+                  size_t stride );
+
+//--------------------------------------------------------------
+// Computes the residuals modulo 256 of a width x height plane under
+// the given predictor. The first row is always predicted from the 
+// left, and the first byte of every other row from above (except 
+// for LEFT, which continues from the end of the previous row), so 
+// the plane does not depend on anything before it. src and 
+// residuals must not overlap.
+void predictEncode( const UByte* src,
+                    UByte* residuals,
+                    size_t width,
+                    size_t height,
+                    Predictor predictor );
+
+//--------------------------------------------------------------
+// Inverse of predictEncode(), computed in place.
+void predictDecode( UByte* data,
+                    size_t width,
+                    size_t height,
+                    Predictor predictor );
+
+//--------------------------------------------------------------
+// Run mode for flat regions, in the spirit of JPEG-LS. Pixels whose
+// residuals are zero in all num_planes planes (at most 
+// kMAX_RUN_PLANES), in runs of at least min_run pixels, are dropped
+// from the planes, which are compacted in place. The runs are 
+// described by ( literal pixels, run pixels ) pairs appended to runs
+// as base-128 varints, the last pair having a run of zero. Returns
+// the number of literal pixels kept.
+size_t extractZeroRuns( UByte* const* planes,
+                        size_t num_planes,
+                        size_t num_pixels,
+                        size_t min_run,
+                        std::vector<UByte>& runs );
+
+//--------------------------------------------------------------
+// Inverse of extractZeroRuns(): spreads num_literals compacted 
+// pixels over num_pixels full-size planes, zeroing the runs. Returns
+// false if the run description does not match the sizes given.
+bool expandZeroRuns( const UByte* runs,
+                     size_t runs_size,
+                     const UByte* const* literal_planes,
+                     size_t num_literals,
+                     UByte* const* planes,
+                     size_t num_planes,
+                     size_t num_pixels );
+};
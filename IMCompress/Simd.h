@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Util.h"
+
+//--------------------------------------------------------------
+// SSE2 is part of the x64 baseline, and is enabled on x86 with
+// /arch:SSE2 (the default since VS2012).
+#if defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 ) || defined( __SSE2__ )
+#define IMC_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef IMC_HAVE_SSE2
+
+namespace simd
+{
+//========================================================================
+// Splits 16 interleaved 3-byte pixels (48 bytes) at src into three
+// registers holding the first, second and third byte of each pixel.
+inline void deinterleave3( const UByte* src, __m128i& c0, __m128i& c1, __m128i& c2 )
+{
+    __m128i t00 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src ) );
+    __m128i t01 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + 16 ) );
+    __m128i t02 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + 32 ) );
+
+    __m128i t10 = _mm_unpacklo_epi8( t00, _mm_unpackhi_epi64( t01, t01 ) );
+    __m128i t11 = _mm_unpacklo_epi8( _mm_unpackhi_epi64( t00, t00 ), t02 );
+    __m128i t12 = _mm_unpacklo_epi8( t01, _mm_unpackhi_epi64( t02, t02 ) );
+
+    __m128i t20 = _mm_unpacklo_epi8( t10, _mm_unpackhi_epi64( t11, t11 ) );
+    __m128i t21 = _mm_unpacklo_epi8( _mm_unpackhi_epi64( t10, t10 ), t12 );
+    __m128i t22 = _mm_unpacklo_epi8( t11, _mm_unpackhi_epi64( t12, t12 ) );
+
+    __m128i t30 = _mm_unpacklo_epi8( t20, _mm_unpackhi_epi64( t21, t21 ) );
+    __m128i t31 = _mm_unpacklo_epi8( _mm_unpackhi_epi64( t20, t20 ), t22 );
+    __m128i t32 = _mm_unpacklo_epi8( t21, _mm_unpackhi_epi64( t22, t22 ) );
+
+    c0 = _mm_unpacklo_epi8( t30, _mm_unpackhi_epi64( t31, t31 ) );
+    c1 = _mm_unpacklo_epi8( _mm_unpackhi_epi64( t30, t30 ), t32 );
+    c2 = _mm_unpacklo_epi8( t31, _mm_unpackhi_epi64( t32, t32 ) );
+}
+
+//========================================================================
+// Inverse of deinterleave3(): writes 16 3-byte pixels to dst.
+inline void interleave3( UByte* dst, __m128i c0, __m128i c1, __m128i c2 )
+{
+    const __m128i z = _mm_setzero_si128();
+
+    __m128i ab0 = _mm_unpacklo_epi8( c0, c1 );
+    __m128i ab1 = _mm_unpackhi_epi8( c0, c1 );
+    __m128i cz0 = _mm_unpacklo_epi8( c2, z );
+    __m128i cz1 = _mm_unpackhi_epi8( c2, z );
+
+    __m128i p00 = _mm_unpacklo_epi16( ab0, cz0 );
+    __m128i p01 = _mm_unpackhi_epi16( ab0, cz0 );
+    __m128i p02 = _mm_unpacklo_epi16( ab1, cz1 );
+    __m128i p03 = _mm_unpackhi_epi16( ab1, cz1 );
+
+    __m128i p10 = _mm_unpacklo_epi32( p00, p01 );
+    __m128i p11 = _mm_unpackhi_epi32( p00, p01 );
+    __m128i p12 = _mm_unpacklo_epi32( p02, p03 );
+    __m128i p13 = _mm_unpackhi_epi32( p02, p03 );
+
+    __m128i p20 = _mm_unpacklo_epi64( p10, p11 );
+    __m128i p21 = _mm_unpackhi_epi64( p10, p11 );
+    __m128i p22 = _mm_unpacklo_epi64( p12, p13 );
+    __m128i p23 = _mm_unpackhi_epi64( p12, p13 );
+
+    p20 = _mm_slli_si128( p20, 1 );
+    p22 = _mm_slli_si128( p22, 1 );
+
+    __m128i p30 = _mm_slli_epi64( _mm_unpacklo_epi32( p20, p21 ), 8 );
+    __m128i p31 = _mm_srli_epi64( _mm_unpackhi_epi32( p20, p21 ), 8 );
+    __m128i p32 = _mm_slli_epi64( _mm_unpacklo_epi32( p22, p23 ), 8 );
+    __m128i p33 = _mm_srli_epi64( _mm_unpackhi_epi32( p22, p23 ), 8 );
+
+    __m128i p40 = _mm_unpacklo_epi64( p30, p31 );
+    __m128i p41 = _mm_unpackhi_epi64( p30, p31 );
+    __m128i p42 = _mm_unpacklo_epi64( p32, p33 );
+    __m128i p43 = _mm_unpackhi_epi64( p32, p33 );
+
+    __m128i v0 = _mm_or_si128( _mm_srli_si128( p40, 2 ), _mm_slli_si128( p41, 10 ) );
+    __m128i v1 = _mm_or_si128( _mm_srli_si128( p41, 6 ), _mm_slli_si128( p42, 6 ) );
+    __m128i v2 = _mm_or_si128( _mm_srli_si128( p42, 10 ), _mm_slli_si128( p43, 2 ) );
+
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( dst ), v0 );
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( dst + 16 ), v1 );
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( dst + 32 ), v2 );
+}
+
+//========================================================================
+// Arithmetic shift right by one of each signed byte. SSE2 has no
+// 8-bit shifts, so shift 16-bit lanes and restore each sign bit.
+inline __m128i srai8By1( __m128i v )
+{
+    const __m128i low_bits = _mm_set1_epi8( 0x7f );
+    const __m128i sign_bit = _mm_set1_epi8( static_cast<char>( 0x80 ) );
+
+    return _mm_or_si128( _mm_and_si128( _mm_srli_epi16( v, 1 ), low_bits ),
+                         _mm_and_si128( v, sign_bit ) );
+}
+
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include "stdafx.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+//========================================================================
+// Size of the shared pool, set by configureShared().
+static size_t s_shared_threads = 0;
+
+//========================================================================
+//
+ThreadPool::ThreadPool( size_t num_threads )
+    : stopping_( false )
+{
+    if( num_threads == 0 )
+    {
+        num_threads = std::max<size_t>( 1, std::thread::hardware_concurrency() );
+    }
+
+    for( size_t i = 0; i < num_threads; ++i )
+    {
+        workers_.emplace_back( &ThreadPool::workerLoop, this );
+    }
+}
+
+//========================================================================
+//
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        stopping_ = true;
+    }
+
+    job_available_.notify_all();
+
+    for( auto& worker : workers_ )
+    {
+        worker.join();
+    }
+}
+
+//========================================================================
+//
+ThreadPool& ThreadPool::shared()
+{
+    static ThreadPool pool( s_shared_threads );
+    return pool;
+}
+
+//========================================================================
+//
+void ThreadPool::configureShared( size_t num_threads )
+{
+    s_shared_threads = num_threads;
+}
+
+//========================================================================
+//
+void ThreadPool::parallelFor( size_t count, const std::function<void( size_t )>& fn )
+{
+    if( count == 1 || workers_.size() == 1 )
+    {
+        for( size_t i = 0; i < count; ++i ) fn( i );
+        return;
+    }
+
+    std::vector<std::future<void>> pending;
+    pending.reserve( count );
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        pending.push_back( enqueue( [&fn, i]() { fn( i ); } ) );
+    }
+
+    for( auto& job : pending )
+    {
+        job.get();
+    }
+}
+
+//========================================================================
+//
+void ThreadPool::workerLoop()
+{
+    while( true )
+    {
+        std::function<void()> job;
+
+        {
+            std::unique_lock<std::mutex> lock( mutex_ );
+            job_available_.wait( lock, [this]() { return stopping_ || !jobs_.empty(); } );
+
+            if( stopping_ && jobs_.empty() ) return;
+
+            job = std::move( jobs_.front() );
+            jobs_.pop();
+        }
+
+        job();
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+//========================================================================
+// Fixed set of worker threads pulling jobs from a shared queue.
+class ThreadPool
+{
+public:
+
+    //--------------------------------------------------------------
+    // num_threads == 0 uses one thread per hardware thread.
+    explicit ThreadPool( size_t num_threads = 0 );
+
+    //--------------------------------------------------------------
+    // Finishes the queued jobs and joins the workers.
+    ~ThreadPool();
+
+    //--------------------------------------------------------------
+    // Process-wide pool shared by the coders.
+    static ThreadPool& shared();
+
+    //--------------------------------------------------------------
+    // Sets the number of threads of the shared pool, 0 being one per
+    // hardware thread. Only has an effect before the first shared(),
+    // so must be called before any coding starts.
+    static void configureShared( size_t num_threads );
+
+    //--------------------------------------------------------------
+    //
+    size_t size() const { return workers_.size(); }
+
+    //--------------------------------------------------------------
+    // Queues fn and returns a future for its result.
+    template<typename Fn>
+    auto enqueue( Fn fn ) -> std::future<decltype( fn() )>;
+
+    //--------------------------------------------------------------
+    // Runs fn( 0 ) ... fn( count - 1 ) on the pool and waits for all
+    // of them. Jobs must not themselves wait on the same pool.
+    void parallelFor( size_t count, const std::function<void( size_t )>& fn );
+
+private:
+
+    //--------------------------------------------------------------
+    //
+    ThreadPool( const ThreadPool& ) = delete;
+    ThreadPool& operator=( const ThreadPool& ) = delete;
+
+    //--------------------------------------------------------------
+    //
+    void workerLoop();
+
+    //--------------------------------------------------------------
+    //
+    std::vector<std::thread>          workers_;
+    std::queue<std::function<void()>> jobs_;
+    std::mutex                        mutex_;
+    std::condition_variable           job_available_;
+    bool                              stopping_;
+};
+
+//========================================================================
+//
+template<typename Fn>
+auto ThreadPool::enqueue( Fn fn ) -> std::future<decltype( fn() )>
+{
+    using Result = decltype( fn() );
+
+    auto task = std::make_shared<std::packaged_task<Result()>>( std::move( fn ) );
+    std::future<Result> result = task->get_future();
+
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        jobs_.push( [task]() { ( *task )(); } );
+    }
+
+    job_available_.notify_one();
+    return result;
+}
@@ -25,6 +25,7 @@
 #include <array>
 
 #include <numeric>
+#include <cmath>
 
 //--------------------------------------------------------------
 //
@@ -41,7 +42,9 @@ enum class FILE_TYPE
     WAV = 0,
     BMP = 1,
     IM3 = 2,
-    IN3 = 3
+    IN3 = 3,
+    AU3 = 4,
+    AM3 = 5
 };
 
 //========================================================================
@@ -72,6 +75,16 @@ inline MsgNum determineFileType( std::string file_path, FILE_TYPE& type )
             type = FILE_TYPE::IN3;
             return STATUS_OKAY;
         }
+        else if( file_ext == "au3" )
+        {
+            type = FILE_TYPE::AU3;
+            return STATUS_OKAY;
+        }
+        else if( file_ext == "am3" )
+        {
+            type = FILE_TYPE::AM3;
+            return STATUS_OKAY;
+        }
     }
 
     return INVALID_FILE_PATH;
@@ -79,35 +92,104 @@ inline MsgNum determineFileType( std::string file_path, FILE_TYPE& type )
 
 
 //========================================================================
-//
-inline std::string getFileName( std::string file_path )
+// Appends the low num_bytes bytes of value to arr, most significant
+// byte first.
+inline void appendBigEndian( std::vector<UByte>& arr, uint64_t value, Uint num_bytes )
 {
-    std::string file_name;
-    char c = file_path[file_path.length() - 1];
+    for( Uint i = num_bytes - 1; i < num_bytes; --i )
+    {
+        arr.push_back( ( value >> ( i * 8 ) ) & 0xff );
+    }
+}
+
+//========================================================================
+// Appends the low num_bytes bytes of value to arr, least significant
+// byte first, as .bmp and .wav headers are stored.
+inline void appendLittleEndian( std::vector<UByte>& arr, uint64_t value, Uint num_bytes )
+{
+    for( Uint i = 0; i < num_bytes; ++i )
+    {
+        arr.push_back( ( value >> ( i * 8 ) ) & 0xff );
+    }
+}
+
+//========================================================================
+// Reads a value written by appendBigEndian() starting at pos, and
+// advances pos past it.
+inline uint64_t readBigEndian( const UByte* data, size_t& pos, Uint num_bytes )
+{
+    uint64_t value = 0;
+
+    for( Uint i = 0; i < num_bytes; ++i )
+    {
+        value = ( value << 8 ) | data[pos++];
+    }
+
+    return value;
+}
 
-    Uint i = file_path.length() - 1;
-    while( c != '\\' ) { c = file_path[--i]; }
+//========================================================================
+// Reads a 32-bit little endian value. Compilers turn this into a 
+// single load on little endian hosts.
+inline uint32_t loadLE32( const UByte* data )
+{
+    return static_cast<uint32_t>( data[0] ) | ( static_cast<uint32_t>( data[1] ) << 8 ) |
+           ( static_cast<uint32_t>( data[2] ) << 16 ) | ( static_cast<uint32_t>( data[3] ) << 24 );
+}
 
+//========================================================================
+// Appends value as a base-128 varint: 7 bits per byte, least 
+// significant first, with the top bit set on all but the last byte.
+inline void appendVarint( std::vector<UByte>& arr, uint64_t value )
+{
+    while( value >= 0x80 )
+    {
+        arr.push_back( static_cast<UByte>( value | 0x80 ) );
+        value >>= 7;
+    }
+    arr.push_back( static_cast<UByte>( value ) );
+}
 
-    c = file_path[++i];
+//========================================================================
+// Reads a value written by appendVarint() from [pos, end), and 
+// advances pos past it. Returns false if the data ends in the middle
+// of the value.
+inline bool readVarint( const UByte*& pos, const UByte* end, uint64_t& value )
+{
+    value = 0;
 
-    while( c != '.' )
+    for( Uint shift = 0; pos < end && shift < 64; shift += 7 )
     {
-        file_name += c;
-        c = file_path[++i];
+        const UByte byte = *pos++;
+        value |= static_cast<uint64_t>( byte & 0x7f ) << shift;
+
+        if( ( byte & 0x80 ) == 0 ) return true;
     }
 
-    return file_name;
+    return false;
+}
+
+
+//========================================================================
+// The name of the file at file_path, without its directory or 
+// extension. Either separator is accepted.
+inline std::string getFileName( std::string file_path )
+{
+    const size_t dir_end = file_path.find_last_of( "/\\" );
+    std::string file_name = dir_end == std::string::npos ? file_path : file_path.substr( dir_end + 1 );
+
+    return file_name.substr( 0, file_name.find_last_of( '.' ) );
 }
 
 
 //========================================================================
 //
-inline std::vector<int16_t> rgb2yuv( const std::vector<UByte>& rgb )
+inline std::vector<int16_t> rgb2yuv( const UByte* rgb, size_t size )
 {
     std::vector<int16_t> yuv;
+    yuv.reserve( size - size % 3 );
 
-    for( Uint i = 0; i + 2 < rgb.size(); i += 3 )
+    for( size_t i = 0; i + 2 < size; i += 3 )
     {
         // In the raw bytestreams that we should be working with here,
         // the RGB componennts are backwards, so account for this here.
@@ -123,13 +205,20 @@ inline std::vector<int16_t> rgb2yuv( const std::vector<UByte>& rgb )
     return yuv;
 }
 
+//========================================================================
+//
+inline std::vector<int16_t> rgb2yuv( const std::vector<UByte>& rgb )
+{
+    return rgb2yuv( rgb.data(), rgb.size() );
+}
+
 //========================================================================
 //
 inline std::vector<UByte> yuv2rgb( const std::vector<int16_t>& yuv )
 {
     std::vector<UByte> rgb;
 
-    for( Uint i = 0; i + 2 < yuv.size(); i += 3 )
+    for( size_t i = 0; i + 2 < yuv.size(); i += 3 )
     {
         const int16_t Y = yuv[i];
         const int16_t U = yuv[i + 1];
@@ -155,7 +244,7 @@ inline std::vector<Color256> yuvArray2Color256( const std::array<std::vector<int
         std::cout << "Error in yuvArray2rgb() - sizes do not match." << std::endl;
     }
 
-    for( Uint i = 0; i < yuv[0].size(); ++i )
+    for( size_t i = 0; i < yuv[0].size(); ++i )
     {
         const int16_t Y = yuv[0][i];
         const int16_t U = yuv[1][i];
@@ -192,7 +281,7 @@ inline std::vector<UByte> yuvArray2RGB( const std::array<std::vector<int16_t>, 3
         std::cout << "Error in yuvArray2rgb() - sizes do not match." << std::endl;
     }
 
-    for( Uint i = 0; i < yuv[0].size(); ++i )
+    for( size_t i = 0; i < yuv[0].size(); ++i )
     {
         const int16_t Y = yuv[0][i];
         const int16_t U = yuv[1][i];
@@ -226,7 +315,7 @@ inline void extractRGBComponents( const std::vector<UByte>& RGB,
     g.clear();
     b.clear();
 
-    for( Uint i = 0; i + 2 < RGB.size(); i += 3 )
+    for( size_t i = 0; i + 2 < RGB.size(); i += 3 )
     {
         r.push_back( RGB[i] );
         g.push_back( RGB[i + 1] );
@@ -249,7 +338,7 @@ inline void combineRGBComponenets( std::vector<UByte>& RGB,
 
     RGB.clear();
 
-    for( Uint i = 0; i < r.size(); ++i )
+    for( size_t i = 0; i < r.size(); ++i )
     {
         RGB.push_back( r[i] );
         RGB.push_back( g[i] );
@@ -263,7 +352,7 @@ inline std::vector<Color256> RGB2Color256( const std::vector<UByte>& RGB )
 {
     std::vector<Color256> col256arr;
 
-    for( Uint i = 0; i + 2 < RGB.size(); i += 3 )
+    for( size_t i = 0; i + 2 < RGB.size(); i += 3 )
     {
         col256arr.emplace_back( RGB[i], RGB[i + 1], RGB[i + 2] );
     }
@@ -286,7 +375,7 @@ inline void combineRGBComponenets( std::vector<Color256>& RGB,
 
     RGB.clear();
 
-    for( Uint i = 0; i < r.size(); ++i )
+    for( size_t i = 0; i < r.size(); ++i )
     {
         RGB.push_back( Color256( r[i], g[i], b[i] ) );
     }
@@ -303,7 +392,7 @@ inline void extractYUVComponents( const std::vector<int16_t>& YUV,
     u.clear();
     v.clear();
 
-    for( Uint i = 0; i + 2 < YUV.size(); i += 3 )
+    for( size_t i = 0; i + 2 < YUV.size(); i += 3 )
     {
         y.push_back( YUV[i] );
         u.push_back( YUV[i + 1] );
@@ -313,7 +402,7 @@ inline void extractYUVComponents( const std::vector<int16_t>& YUV,
 
 //========================================================================
 //
-inline std::vector<int16_t> downsampleChannel( const std::vector<int16_t>& channel, const Uint w, const Uint h )
+inline std::vector<int16_t> downsampleChannel( const std::vector<int16_t>& channel, const size_t w, const size_t h )
 {
     std::vector<int16_t> downsampled;
 
@@ -350,13 +439,13 @@ inline std::vector<int16_t> downsampleChannel( const std::vector<int16_t>& chann
 
 //========================================================================
 //
-inline std::vector<int16_t> upsampleChannel( const std::vector<int16_t>& channel, const Uint w, const Uint h )
+inline std::vector<int16_t> upsampleChannel( const std::vector<int16_t>& channel, const size_t w, const size_t h )
 {
     std::vector<int16_t> upsampled;
 
     upsampled.resize( channel.size() * 4 );
 
-    Uint channel_ind = 0;
+    size_t channel_ind = 0;
 
     for( size_t y = 0; y < (h / 2); ++y )
     {
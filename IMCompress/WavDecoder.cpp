@@ -15,203 +15,510 @@
 
 #include <iostream>
 #include <algorithm>
+#include <cstring>
+
+#if defined( _M_X64 ) || defined( __SSE2__ )
+#include <emmintrin.h>
+#define IMC_HAVE_SSE2
+#endif
 
 //========================================================================
-//
-WavDecoder::WavDecoder( const std::vector<Byte>& raw_data )
-    : raw_data_( raw_data )
-    , bit_depth_mask_( 0 )
-{
-    wav_data_ = { 0 };
-}
+// audio_format_ of IEEE float data. Anything else is read as PCM.
+static const uint16_t kWAV_FORMAT_FLOAT = 3;
+
+//========================================================================
+// audio_format_ of WAVE_FORMAT_EXTENSIBLE, whose real format is given
+// by its sub-format.
+static const uint16_t kWAV_FORMAT_EXTENSIBLE = 0xfffe;
+
+//========================================================================
+// How much of a file decode() reads at a time.
+static const size_t kSTREAM_BLOCK_SIZE = 1 << 20;
 
 //========================================================================
 //
-WavDecoder::~WavDecoder()
+static uint16_t loadLE16( const UByte* data )
 {
-
+    return static_cast<uint16_t>( data[0] | ( data[1] << 8 ) );
 }
 
 //========================================================================
 //
-MsgNum WavDecoder::decode()
+template <typename T>
+static void sizeBuffers( std::vector<std::vector<T>>& buffers,
+                         size_t num_channels,
+                         size_t num_frames )
 {
-    // pos is a locator to let us keep track of where we are in the file,
-    // and this gets updated when passed to the methods in here.
-    Uint pos = 0;
-
-    MsgNum err = storeMetaData( pos );
-    if( err ) return printMsg( err );
+    buffers.resize( num_channels );
 
-    // Now that we know the bit depth we can store the number of bits
-    // used to then help us decode the audio data.
-    for( Uint i = 0; i < wav_data_.bits_per_sample_; ++i )
+    for( auto& buffer : buffers )
     {
-        bit_depth_mask_ = bit_depth_mask_ | ( static_cast<uint64_t>(0x1) << i );
+        buffer.resize( num_frames );
     }
+}
 
-    err = storeAudioData( pos );
-    if( err ) return printMsg( err );
+//========================================================================
+//
+WavDecoder::WavDecoder( const UByte* raw_data, size_t size )
+    : raw_data_( raw_data )
+    , raw_size_( size )
+    , have_header_( false )
+    , data_offset_( 0 )
+    , next_frame_( 0 )
+{
+    wav_data_ = { 0 };
+}
 
-    //printInfo();
+//========================================================================
+//
+WavDecoder::WavDecoder( const std::vector<Byte>& raw_data )
+    : WavDecoder( reinterpret_cast<const UByte*>( raw_data.data() ), raw_data.size() )
+{
 
-    return STATUS_OKAY;
 }
 
 //========================================================================
 //
-const WavData& WavDecoder::getData() const
+WavDecoder::WavDecoder( const std::string& file_path )
+    : WavDecoder( nullptr, 0 )
 {
-    return wav_data_;
+    file_path_ = file_path;
 }
 
 //========================================================================
 //
-WavData WavDecoder::releaseData()
+WavDecoder::~WavDecoder()
 {
-    return std::move( wav_data_ );
+
 }
 
 //========================================================================
 //
-uint32_t WavDecoder::bytesToUInt32LE( Uint& pos, 
-                                      Uint numBytes ) const
+MsgNum WavDecoder::decode()
 {
-    if( pos + numBytes > raw_data_.size() )
-    {
-        // output err
-        std::cout << "Attempted to decode byte to uint64_t that was out of range." << std::endl;
-        return 0;
-    }
+    MsgNum err = readHeader();
+    if( err ) return err;
 
-    uint32_t res    = 0;
-    Uint multiplier = 0;
+    const size_t num_frames = wav_data_.num_frames_;
+    const size_t frame_size = static_cast<size_t>( wav_data_.num_channels_ ) * ( wav_data_.bits_per_sample_ / 8 );
 
-    for( Uint i = pos; i < pos + numBytes; ++i )
+    allocate( wav_data_, num_frames );
+
+    // Memory is split in one pass; a file is read a block at a time,
+    // so that it is never held twice.
+    const size_t block_frames = file_.is_open() ? std::max<size_t>( 1, kSTREAM_BLOCK_SIZE / frame_size ) : num_frames;
+
+    next_frame_ = 0;
+
+    for( size_t first = 0; first < num_frames; first += block_frames )
     {
-        UByte currByte = static_cast<UByte>( raw_data_[i] );
-        Uint currVal   = currByte << ( 8 * multiplier );
-        res += currVal;
-        ++multiplier;
+        const size_t count = std::min( block_frames, num_frames - first );
+
+        const UByte* data = fetchFrames( count );
+        if( data == nullptr ) return printMsg( FAILURE_READING_FILE );
+
+        deinterleave( data, count, first, wav_data_ );
     }
 
-    pos += numBytes;
-    return res;
+    buffer_.clear();
+    buffer_.shrink_to_fit();
+
+    //printInfo();
+
+    return STATUS_OKAY;
 }
 
 //========================================================================
 //
-inline int64_t WavDecoder::bytesToInt64LE( Uint& pos,
-                                           Uint numBytes ) const
+MsgNum WavDecoder::readHeader()
 {
-    if( pos + numBytes > raw_data_.size() )
+    if( have_header_ ) return STATUS_OKAY;
+
+    uint64_t file_size = raw_size_;
+
+    if( !file_path_.empty() )
     {
-        // output err
-        std::cout << "Attempted to decode byte to int64_t that was out of range." << std::endl;
-        return 0;
+        file_.open( file_path_, std::ifstream::binary );
+        if( !file_.is_open() ) return printMsg( FAILURE_READING_FILE );
+
+        file_.seekg( 0, std::ifstream::end );
+        file_size = static_cast<uint64_t>( file_.tellg() );
     }
 
-    int64_t res = 0;
-    Uint multiplier = 0;
+    // RIFF, or RF64 for files over 4 GB, then the file size and WAVE.
+    UByte riff[12];
+    if( !readBytes( 0, sizeof( riff ), riff ) ) return printMsg( BAD_DATA );
+
+    const bool is_rf64 = std::memcmp( riff, "RF64", 4 ) == 0;
+
+    if( ( !is_rf64 && std::memcmp( riff, "RIFF", 4 ) != 0 ) || std::memcmp( riff + 8, "WAVE", 4 ) != 0 )
+    {
+        return printMsg( BAD_DATA );
+    }
+
+    wav_data_.chunk_size_ = util::loadLE32( riff + 4 );
+
+    // The rest is a run of chunks, each an id, a 32-bit size and the
+    // body, padded to an even length. Only fmt and data are needed,
+    // and RF64's ds64 for the size of the data; others are skipped.
+    uint64_t pos            = sizeof( riff );
+    uint64_t data_size      = 0;
+    uint64_t rf64_data_size = 0;
+    bool     have_format    = false;
+    bool     have_data      = false;
 
-    for( Uint i = pos; i < pos + numBytes; ++i )
+    while( !( have_format && have_data ) && pos + 8 <= file_size )
     {
-        UByte currByte  = static_cast<UByte>( raw_data_[i] );
+        UByte header[8];
+        if( !readBytes( pos, sizeof( header ), header ) ) return printMsg( BAD_DATA );
 
-        if( numBytes == 1 )
+        const uint32_t size      = util::loadLE32( header + 4 );
+        uint64_t       body_size = size;
+
+        if( std::memcmp( header, "fmt ", 4 ) == 0 )
+        {
+            // Nothing past the 40 bytes of the extensible format is
+            // used.
+            UByte body[40] = { 0 };
+            if( !readBytes( pos + 8, std::min<size_t>( size, sizeof( body ) ), body ) ) return printMsg( BAD_DATA );
+
+            MsgNum err = storeFormat( body, size );
+            if( err ) return err;
+
+            have_format = true;
+        }
+        else if( std::memcmp( header, "ds64", 4 ) == 0 && size >= 28 )
         {
-            // According to https://en.wikipedia.org/wiki/WAV, 8-bit .wav
-            // audio is offset binary, and that this is the only bit depth
-            // that stores UNSIGNED integers insted of signed. Subtracting
-            // 127 should get us out of this mess..
-            currByte = currByte - 127;
+            // The RIFF size, then the data size, as 64-bit values.
+            UByte body[16];
+            if( !readBytes( pos + 8, sizeof( body ), body ) ) return printMsg( BAD_DATA );
+
+            rf64_data_size = util::loadLE32( body + 8 ) | ( static_cast<uint64_t>( util::loadLE32( body + 12 ) ) << 32 );
+        }
+        else if( std::memcmp( header, "data", 4 ) == 0 )
+        {
+            if( is_rf64 && size == 0xffffffff ) body_size = rf64_data_size;
+
+            wav_data_.sub_chunk2_size_ = size;
+
+            data_offset_ = pos + 8;
+            data_size    = body_size;
+            have_data    = true;
         }
 
-        int64_t currVal = currByte << ( 8 * multiplier );
-        res |= currVal;
-        ++multiplier;
+        pos += 8 + body_size + ( body_size & 1 );
     }
 
-    // If -ve, find the 2's complement of 64-bit.
-    if( res & ( static_cast<uint64_t>(0x1) << ( wav_data_.bits_per_sample_ - 1 ) ) )
+    if( !have_format || !have_data ) return printMsg( BAD_DATA );
+
+    // Samples are stored little endian, interleaved by channel, and 
+    // are split into one natively sized buffer per channel. Integer 
+    // samples must be whole bytes and no wider than 32 bits; float
+    // samples are 32 or 64-bit IEEE, and the latter are narrowed.
+    const uint16_t bits     = wav_data_.bits_per_sample_;
+    const bool     is_float = wav_data_.audio_format_ == kWAV_FORMAT_FLOAT;
+
+    if( bits % 8 != 0 || bits == 0 || ( is_float ? bits != 32 && bits != 64 : bits > 32 ) )
     {
-        res = ( 0xffffffffffffffff ^ bit_depth_mask_ ) | res;
+        return printMsg( BAD_WAV_BIT_DEPTH );
     }
 
-    pos += numBytes;
-    return res;
+    if( wav_data_.num_channels_ == 0 ) return printMsg( BAD_DATA );
+
+    wav_data_.sample_type_ = is_float ? WavSampleType::FLOAT32 : 
+                             bits <= 16 ? WavSampleType::INT16 : WavSampleType::INT32;
+
+    // The data chunk may be cut short.
+    const uint64_t frame_size = static_cast<uint64_t>( wav_data_.num_channels_ ) * ( bits / 8 );
+    const uint64_t available  = data_offset_ < file_size ? file_size - data_offset_ : 0;
+    const uint64_t read_size  = std::min( available, data_size );
+
+    if( available < data_size || read_size % frame_size != 0 )
+    {
+        // Just print a warning. This is not necessarily a fatal
+        // error.
+        printMsg( WAV_DATA_OUT_RANGE );
+    }
+
+    wav_data_.num_frames_ = static_cast<size_t>( read_size / frame_size );
+
+    next_frame_  = 0;
+    have_header_ = true;
+
+    return STATUS_OKAY;
 }
 
 //========================================================================
 //
-MsgNum WavDecoder::storeMetaData( Uint& pos )
+MsgNum WavDecoder::readFrames( size_t max_frames,
+                               WavData& window )
 {
-    // We need access to at least 44 bytes here.
-    if( raw_data_.size() < 44 )
+    MsgNum err = readHeader();
+    if( err ) return err;
+
+    // Take the format, keeping the window's buffers.
+    window.chunk_size_      = wav_data_.chunk_size_;
+    window.sub_chunk1_size_ = wav_data_.sub_chunk1_size_;
+    window.audio_format_    = wav_data_.audio_format_;
+    window.num_channels_    = wav_data_.num_channels_;
+    window.sample_rate_     = wav_data_.sample_rate_;
+    window.byte_rate_       = wav_data_.byte_rate_;
+    window.block_align_     = wav_data_.block_align_;
+    window.bits_per_sample_ = wav_data_.bits_per_sample_;
+    window.sub_chunk2_size_ = wav_data_.sub_chunk2_size_;
+    window.sample_type_     = wav_data_.sample_type_;
+
+    const size_t count = std::min( max_frames, framesRemaining() );
+
+    allocate( window, count );
+
+    if( count == 0 ) return STATUS_OKAY;
+
+    const UByte* data = fetchFrames( count );
+    if( data == nullptr ) return printMsg( FAILURE_READING_FILE );
+
+    deinterleave( data, count, 0, window );
+
+    return STATUS_OKAY;
+}
+
+//========================================================================
+//
+size_t WavDecoder::framesRemaining() const
+{
+    return have_header_ ? wav_data_.num_frames_ - next_frame_ : 0;
+}
+
+//========================================================================
+//
+const WavData& WavDecoder::getData() const
+{
+    return wav_data_;
+}
+
+//========================================================================
+//
+WavData WavDecoder::releaseData()
+{
+    return std::move( wav_data_ );
+}
+
+//========================================================================
+//
+bool WavDecoder::readBytes( uint64_t offset,
+                            size_t size,
+                            UByte* dst )
+{
+    if( file_.is_open() )
     {
-        return printMsg( BAD_DATA );
+        file_.clear();
+        file_.seekg( static_cast<std::streamoff>( offset ) );
+        file_.read( reinterpret_cast<char*>( dst ), static_cast<std::streamsize>( size ) );
+
+        return file_.gcount() == static_cast<std::streamsize>( size );
     }
 
-    // RIFF
-    pos = 4;
+    if( offset > raw_size_ || size > raw_size_ - offset ) return false;
 
-    wav_data_.chunk_size_       = bytesToUInt32LE( pos, 4 ) & 0xffffffff;
+    std::memcpy( dst, raw_data_ + offset, size );
+    return true;
+}
 
-    // WAVE, fmt []
-    pos += 8;
+//========================================================================
+//
+MsgNum WavDecoder::storeFormat( const UByte* body,
+                                uint32_t size )
+{
+    if( size < 16 ) return printMsg( BAD_DATA );
 
-    wav_data_.sub_chunk1_size_  = bytesToUInt32LE( pos, 4 ) & 0xffffffff;
-    wav_data_.audio_format_     = bytesToUInt32LE( pos, 2 ) & 0x0000ffff;
-    wav_data_.num_channels_     = bytesToUInt32LE( pos, 2 ) & 0x0000ffff;
-    wav_data_.sample_rate_      = bytesToUInt32LE( pos, 4 ) & 0xffffffff;
-    wav_data_.byte_rate_        = bytesToUInt32LE( pos, 4 ) & 0xffffffff;
-    wav_data_.block_align_      = bytesToUInt32LE( pos, 2 ) & 0x0000ffff;
-    wav_data_.bits_per_sample_  = bytesToUInt32LE( pos, 2 ) & 0x0000ffff;
+    wav_data_.sub_chunk1_size_ = size;
+    wav_data_.audio_format_    = loadLE16( body );
+    wav_data_.num_channels_    = loadLE16( body + 2 );
+    wav_data_.sample_rate_     = util::loadLE32( body + 4 );
+    wav_data_.byte_rate_       = util::loadLE32( body + 8 );
+    wav_data_.block_align_     = loadLE16( body + 12 );
+    wav_data_.bits_per_sample_ = loadLE16( body + 14 );
 
-    // data
-    pos += 4;
+    if( wav_data_.audio_format_ == kWAV_FORMAT_EXTENSIBLE )
+    {
+        // After the size of the extension, the valid bits and the
+        // channel mask comes the sub-format GUID, which starts with 
+        // the format code.
+        if( size < 40 ) return printMsg( BAD_DATA );
 
-    wav_data_.sub_chunk2_size_  = bytesToUInt32LE( pos, 4 ) & 0xffffffff;
+        wav_data_.audio_format_ = loadLE16( body + 24 );
+    }
 
     return STATUS_OKAY;
 }
 
 //========================================================================
 //
-MsgNum WavDecoder::storeAudioData( Uint& pos )
+const UByte* WavDecoder::fetchFrames( size_t num_frames )
+{
+    const size_t   frame_size = static_cast<size_t>( wav_data_.num_channels_ ) * ( wav_data_.bits_per_sample_ / 8 );
+    const uint64_t offset     = data_offset_ + static_cast<uint64_t>( next_frame_ ) * frame_size;
+
+    next_frame_ += num_frames;
+
+    // readHeader() has checked that the frames are all there.
+    if( !file_.is_open() ) return raw_data_ + offset;
+
+    buffer_.resize( num_frames * frame_size );
+
+    return readBytes( offset, buffer_.size(), buffer_.data() ) ? buffer_.data() : nullptr;
+}
+
+//========================================================================
+//
+void WavDecoder::allocate( WavData& target,
+                           size_t num_frames )
 {
-    // Here we interpret the data and store to an internal buffer. The 
-    // buffer is always a 64-bit signed integer, as this is the largest
-    // expected bit-depth.
+    const size_t num_channels = target.num_channels_;
 
-    // Assume the bit depth is a multiple of 8 and <= 64 bits, that
-    // is, we are storing at least 1 byte and no more than 8 bytes per 
-    // sample. Expect the samples to be stored little endian.
-    if( wav_data_.bits_per_sample_ % 8 != 0 )
+    target.num_frames_ = num_frames;
+
+    switch( target.sample_type_ )
     {
-        return printMsg( BAD_WAV_BIT_DEPTH );
+    case WavSampleType::INT16:
+        sizeBuffers( target.int16_channels_, num_channels, num_frames );
+        target.int32_channels_.clear();
+        target.float_channels_.clear();
+        break;
+
+    case WavSampleType::INT32:
+        sizeBuffers( target.int32_channels_, num_channels, num_frames );
+        target.int16_channels_.clear();
+        target.float_channels_.clear();
+        break;
+
+    case WavSampleType::FLOAT32:
+        sizeBuffers( target.float_channels_, num_channels, num_frames );
+        target.int16_channels_.clear();
+        target.int32_channels_.clear();
+        break;
     }
+}
 
-    Uint numBytes = wav_data_.bits_per_sample_ / 8;
-
-    for( Uint i = pos; i < raw_data_.size(); i += numBytes )
+//========================================================================
+//
+void WavDecoder::deinterleave( const UByte* data,
+                               size_t num_frames,
+                               size_t first_frame,
+                               WavData& target )
+{
+    const size_t channels   = target.num_channels_;
+    const size_t bytes      = target.bits_per_sample_ / 8;
+    const size_t frame_size = channels * bytes;
+
+    // Each channel is converted in its own tight loop of fixed stride,
+    // built from byte loads and shifts that do not depend on the host's
+    // byte order. Compilers turn these into plain or vector loads.
+    for( size_t c = 0; c < channels; ++c )
     {
-        wav_data_.samples_as_bytes_.push_back( (UByte)raw_data_[i] );
+        const UByte* src = data + c * bytes;
 
-        // Throw this guard in here as a sanity check
-        if( i + numBytes - 1 < raw_data_.size() )
+        switch( bytes )
+        {
+        case 1:
+        {
+            // 8-bit .wav audio is offset binary, the only unsigned bit
+            // depth.
+            int16_t* dst = target.int16_channels_[c].data() + first_frame;
+
+            for( size_t f = 0; f < num_frames; ++f )
+            {
+                dst[f] = static_cast<int16_t>( src[f * frame_size] - 128 );
+            }
+            break;
+        }
+        case 2:
+        {
+            int16_t* dst = target.int16_channels_[c].data() + first_frame;
+
+            size_t f = 0;
+
+#ifdef IMC_HAVE_SSE2
+            // Stereo is by far the most common layout. Eight frames are
+            // 16 samples, alternating left and right: sign extend each 
+            // one to 32 bits in place and pack back down.
+            if( channels == 2 )
+            {
+                const int shift = c == 0 ? 16 : 0;
+
+                for( ; f + 8 <= num_frames; f += 8 )
+                {
+                    const __m128i lo = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + f * 4 ) );
+                    const __m128i hi = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + f * 4 + 16 ) );
+
+                    const __m128i a = _mm_srai_epi32( _mm_slli_epi32( lo, shift ), 16 );
+                    const __m128i b = _mm_srai_epi32( _mm_slli_epi32( hi, shift ), 16 );
+
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( dst + f ), _mm_packs_epi32( a, b ) );
+                }
+            }
+#endif
+            for( ; f < num_frames; ++f )
+            {
+                const UByte* s = src + f * frame_size;
+                dst[f] = static_cast<int16_t>( s[0] | ( s[1] << 8 ) );
+            }
+            break;
+        }
+        case 3:
+        {
+            // Build the sample in the top 24 bits, so that the 
+            // arithmetic shift back down sign extends it.
+            int32_t* dst = target.int32_channels_[c].data() + first_frame;
+
+            for( size_t f = 0; f < num_frames; ++f )
+            {
+                const UByte*   s    = src + f * frame_size;
+                const uint32_t bits = ( static_cast<uint32_t>( s[0] ) << 8 ) | ( static_cast<uint32_t>( s[1] ) << 16 ) | ( static_cast<uint32_t>( s[2] ) << 24 );
+
+                dst[f] = static_cast<int32_t>( bits ) >> 8;
+            }
+            break;
+        }
+        case 4:
         {
-            wav_data_.samples_.push_back( bytesToInt64LE( pos, numBytes ) );
+            if( target.sample_type_ == WavSampleType::FLOAT32 )
+            {
+                float* dst = target.float_channels_[c].data() + first_frame;
+
+                for( size_t f = 0; f < num_frames; ++f )
+                {
+                    const uint32_t bits = util::loadLE32( src + f * frame_size );
+                    std::memcpy( dst + f, &bits, 4 );
+                }
+                break;
+            }
+
+            int32_t* dst = target.int32_channels_[c].data() + first_frame;
+
+            for( size_t f = 0; f < num_frames; ++f )
+            {
+                dst[f] = static_cast<int32_t>( util::loadLE32( src + f * frame_size ) );
+            }
+            break;
         }
-        else
+        case 8:
         {
-            // Just print a warning. This is not necessarily a fatal
-            // error.
-            printMsg( WAV_DATA_OUT_RANGE );
+            float* dst = target.float_channels_[c].data() + first_frame;
+
+            for( size_t f = 0; f < num_frames; ++f )
+            {
+                const uint64_t bits = util::loadLE32( src + f * frame_size ) | 
+                                      ( static_cast<uint64_t>( util::loadLE32( src + f * frame_size + 4 ) ) << 32 );
+                double value;
+                std::memcpy( &value, &bits, 8 );
+
+                dst[f] = static_cast<float>( value );
+            }
+            break;
+        }
         }
     }
-
-    return STATUS_OKAY;
 }
 
 //========================================================================
@@ -219,19 +526,21 @@ MsgNum WavDecoder::storeAudioData( Uint& pos )
 void WavDecoder::printInfo()
 {
     std::cout << "Decoded .wav data with no found errors." << std::endl;
-    std::cout << "Number of samples: " << wav_data_.samples_.size() << std::endl;
+    std::cout << "Number of samples: " << wav_data_.num_frames_ * wav_data_.num_channels_ << std::endl;
 
-    int64_t max_val = *std::max_element( wav_data_.samples_.begin(),
-                                         wav_data_.samples_.end() );
+    int64_t max_val     = 0;
+    int64_t max_abs_val = 0;
 
-    auto absval_comparator = []( int64_t a, int64_t b ) -> bool
+    for( size_t c = 0; c < wav_data_.num_channels_; ++c )
     {
-        return std::abs( a ) < std::abs( b );
-    };
+        for( size_t f = 0; f < wav_data_.num_frames_; ++f )
+        {
+            const int64_t sample = wav_data_.sample( c, f );
 
-    int64_t max_abs_val = std::abs( *std::max_element( wav_data_.samples_.begin(),
-                                                       wav_data_.samples_.end(),
-                                                       absval_comparator ) );
+            max_val     = std::max( max_val, sample );
+            max_abs_val = std::max( max_abs_val, std::abs( sample ) );
+        }
+    }
 
     std::cout << "Maximum sample value: " << max_val << std::endl;
     std::cout << "Maximum (absolute) sample value: " << max_abs_val << std::endl;
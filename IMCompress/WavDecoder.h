@@ -17,9 +17,21 @@
 #include "Util.h"
 #include "Errors.h"
 
-#include <windows.h>
+#include <fstream>
+#include <string>
 #include <vector>
 
+//========================================================================
+// How decoded samples are stored. 8 and 16-bit PCM decode to INT16,
+// 24 and 32-bit PCM to INT32, holding the sample's own value, and
+// IEEE float data to FLOAT32.
+enum class WavSampleType : UByte
+{
+    INT16   = 0,
+    INT32   = 1,
+    FLOAT32 = 2
+};
+
 //========================================================================
 // Container for extracted audio data.
 struct WavData
@@ -34,20 +46,54 @@ struct WavData
     uint16_t bits_per_sample_;
     uint32_t sub_chunk2_size_;
 
-    std::vector<int64_t> samples_;
-    std::vector<UByte>   samples_as_bytes_;
+    WavSampleType sample_type_ = WavSampleType::INT16;
+    size_t        num_frames_  = 0;
+
+    // One buffer of num_frames_ samples per channel. Only the buffers
+    // matching sample_type_ are filled.
+    std::vector<std::vector<int16_t>> int16_channels_;
+    std::vector<std::vector<int32_t>> int32_channels_;
+    std::vector<std::vector<float>>   float_channels_;
+
+    // A sample as an integer on the scale of bits_per_sample_. Float
+    // samples are scaled up to it.
+    int64_t sample( size_t channel, size_t frame ) const
+    {
+        switch( sample_type_ )
+        {
+        case WavSampleType::INT16: return int16_channels_[channel][frame];
+        case WavSampleType::INT32: return int32_channels_[channel][frame];
+        default:                   return static_cast<int64_t>( static_cast<double>( float_channels_[channel][frame] ) * ( static_cast<uint64_t>( 0x1 ) << ( bits_per_sample_ - 1 ) ) );
+        }
+    }
 };
 
 //========================================================================
+// Decodes .wav audio held in memory or streamed from a file. The RIFF
+// chunks are walked to find the format and the samples, so chunks such
+// as LIST may come anywhere; WAVE_FORMAT_EXTENSIBLE and RF64 files are
+// read as well.
 //
+// decode() reads the whole file into getData(). Long recordings can 
+// instead be read a window at a time with readFrames(), which only
+// ever holds one window of samples.
 class WavDecoder
 {
 public:
 
+    //--------------------------------------------------------------
+    // The raw data is read in place, e.g. from a FileSource, and must
+    // outlive the decoder.
+    WavDecoder( const UByte* raw_data, size_t size );
+
     //--------------------------------------------------------------
     //
     WavDecoder( const std::vector<Byte>& raw_data );
 
+    //--------------------------------------------------------------
+    // Streams the file at file_path, which is opened by readHeader().
+    explicit WavDecoder( const std::string& file_path );
+
     //--------------------------------------------------------------
     //
     ~WavDecoder();
@@ -56,6 +102,25 @@ public:
     // Decode and internally store the supplied data.
     MsgNum decode();
 
+    //--------------------------------------------------------------
+    // Reads the format of the audio into getData(), with num_frames_
+    // set to the length of the whole file but no samples decoded. 
+    // Called by decode() and the first readFrames().
+    MsgNum readHeader();
+
+    //--------------------------------------------------------------
+    // Decodes the next max_frames frames, or those left if fewer, into
+    // window. The window takes the format of getData(), and its 
+    // buffers are reused from call to call. window.num_frames_ is 0
+    // once the audio has all been read.
+    MsgNum readFrames( size_t max_frames,
+                       WavData& window );
+
+    //--------------------------------------------------------------
+    // Frames not yet returned by readFrames(), or 0 before the header
+    // has been read.
+    size_t framesRemaining() const;
+
     //--------------------------------------------------------------
     // Returns a constant reference to the data. This object must
     // persist for the duration that we access it externally.
@@ -76,28 +141,36 @@ private:
     WavDecoder() = delete;
     
     //--------------------------------------------------------------
-    // Converts numBytes bytes in a byte array to a 32-bit signed 
-    // int starting at index pos. Little endian intepretation.
-    // Updates pos to next position after the final read byte.
-    uint32_t bytesToUInt32LE( Uint& pos,
-                              Uint numBytes ) const;
+    // Copies size bytes at offset into dst, from memory or the file.
+    bool readBytes( uint64_t offset,
+                    size_t size,
+                    UByte* dst );
+
+    //--------------------------------------------------------------
+    // Parses the body of the fmt chunk.
+    MsgNum storeFormat( const UByte* body,
+                        uint32_t size );
 
     //--------------------------------------------------------------
-    // Converts numBytes bytes in a byte array to a 64-bit unsigned 
-    // int starting at index pos. Little endian intepretation.
-    // Updates pos to next position after the final read byte.
-    int64_t bytesToInt64LE( Uint& pos,
-                            Uint numBytes ) const;
+    // Returns the next num_frames interleaved frames, pointing into 
+    // the raw data or read into buffer_, or nullptr if they could 
+    // not be read.
+    const UByte* fetchFrames( size_t num_frames );
 
     //--------------------------------------------------------------
-    // Extracts the header data from the byte array. Updates pos to 
-    // next position in the raw data.
-    MsgNum storeMetaData( Uint& pos );
+    // Sizes the channel buffers of target to num_frames of its 
+    // sample type, freeing those of the other types.
+    static void allocate( WavData& target,
+                          size_t num_frames );
 
     //--------------------------------------------------------------
-    // Extracts the audio data from the byte array. Updates pos to 
-    // next position in the raw data.
-    MsgNum storeAudioData( Uint& pos );
+    // Splits num_frames interleaved frames starting at data into the
+    // channel buffers of target, from frame first_frame on. The
+    // buffers must already be large enough.
+    static void deinterleave( const UByte* data,
+                              size_t num_frames,
+                              size_t first_frame,
+                              WavData& target );
     
     //--------------------------------------------------------------
     //
@@ -108,6 +181,17 @@ private:
     //==============================================================
 
     WavData                     wav_data_;
-    const std::vector<Byte>&    raw_data_;
-    uint64_t                    bit_depth_mask_;
+    const UByte*                raw_data_;
+    size_t                      raw_size_;
+
+    // Set when streaming from a file rather than reading memory.
+    std::string                 file_path_;
+    std::ifstream               file_;
+    std::vector<UByte>          buffer_;
+
+    // Where the samples of the data chunk start, and the frames that
+    // readFrames() has returned.
+    bool                        have_header_;
+    uint64_t                    data_offset_;
+    size_t                      next_frame_;
 };
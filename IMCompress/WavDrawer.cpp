@@ -29,14 +29,15 @@ WavDrawer::WavDrawer( WavData data )
 {
     // Let's get the maximum absolute value of the data here. This is 
     // used later for scaling the display.
-    auto absval_comparator = []( int64_t a, int64_t b ) -> bool
-    {
-        return std::abs( a ) < std::abs( b );
-    };
+    max_val_ = 0;
 
-    max_val_ = std::abs( *std::max_element( data_.samples_.begin(),
-                                            data_.samples_.end(),
-                                            absval_comparator ) );
+    for( size_t c = 0; c < data_.num_channels_; ++c )
+    {
+        for( size_t f = 0; f < data_.num_frames_; ++f )
+        {
+            max_val_ = std::max<uint64_t>( max_val_, std::abs( data_.sample( c, f ) ) );
+        }
+    }
 }
 
 //========================================================================
@@ -95,10 +96,15 @@ void WavDrawer::writeToWindowBuffer( IWindow& frame )
     int64_t max_samp = 0;
     int64_t min_samp = 0;
 
-    for( auto sample : data_.samples_ )
+    // Samples are drawn in file order, channels interleaved.
+    const size_t num_samples = data_.num_frames_ * data_.num_channels_;
+
+    for( size_t i = 0; i < num_samples; ++i )
     {
+        const int64_t sample = data_.sample( i % data_.num_channels_, i / data_.num_channels_ );
+
         // Compute the current x coordinate based on window width and the number of samples in the audio file.
-        Uint xCoord = static_cast<Uint>( round( ( x / static_cast<double>( data_.samples_.size() ) ) * frame.getWidth() ) );
+        Uint xCoord = static_cast<Uint>( round( ( x / static_cast<double>( num_samples ) ) * frame.getWidth() ) );
 
         // If we are trying to draw a sample less than or greater than the 
         // max/min resp. for which we have already drawn at the same computed 
@@ -0,0 +1,179 @@
+#include "stdafx.h"
+#include "WavWriter.h"
+
+#include <algorithm>
+#include <cstring>
+
+//========================================================================
+// Frames interleaved and written at a time.
+static const size_t kBLOCK_FRAMES = 4096;
+
+//========================================================================
+//
+static void appendTag( std::vector<UByte>& arr, const char* tag )
+{
+    arr.insert( arr.end(), tag, tag + 4 );
+}
+
+//========================================================================
+//
+MsgNum WavWriter::write( const WavData& data,
+                         OutputSink& sink )
+{
+    const uint16_t bits     = data.bits_per_sample_;
+    const size_t   channels = data.num_channels_;
+    const size_t   frames   = data.num_frames_;
+
+    // The bit depth must fit the buffers the samples are held in.
+    bool valid = false;
+
+    switch( data.sample_type_ )
+    {
+    case WavSampleType::INT16:   valid = ( bits == 8 || bits == 16 ) && data.int16_channels_.size() == channels; break;
+    case WavSampleType::INT32:   valid = ( bits == 24 || bits == 32 ) && data.int32_channels_.size() == channels; break;
+    case WavSampleType::FLOAT32: valid = ( bits == 32 || bits == 64 ) && data.float_channels_.size() == channels; break;
+    }
+
+    if( !valid || channels == 0 ) return printMsg( BAD_DATA );
+
+    for( size_t c = 0; c < channels; ++c )
+    {
+        const size_t length = data.sample_type_ == WavSampleType::INT16 ? data.int16_channels_[c].size() :
+                              data.sample_type_ == WavSampleType::INT32 ? data.int32_channels_[c].size() :
+                                                                          data.float_channels_[c].size();
+        if( length < frames ) return printMsg( BAD_DATA );
+    }
+
+    const size_t   bytes       = bits / 8;
+    const size_t   block_align = channels * bytes;
+    const uint64_t data_size   = static_cast<uint64_t>( frames ) * block_align;
+    const uint64_t padding     = data_size & 1;
+
+    // WAVE, the fmt chunk and the data chunk, plus ds64 for RF64.
+    const bool     is_rf64   = data_size + padding + 36 > 0xffffffff;
+    const uint64_t riff_size = 4 + 24 + ( is_rf64 ? 36 : 0 ) + 8 + data_size + padding;
+
+    std::vector<UByte> header;
+
+    appendTag( header, is_rf64 ? "RF64" : "RIFF" );
+    util::appendLittleEndian( header, is_rf64 ? 0xffffffff : riff_size, 4 );
+    appendTag( header, "WAVE" );
+
+    if( is_rf64 )
+    {
+        appendTag( header, "ds64" );
+        util::appendLittleEndian( header, 28, 4 );
+        util::appendLittleEndian( header, riff_size, 8 );
+        util::appendLittleEndian( header, data_size, 8 );
+        util::appendLittleEndian( header, frames, 8 );
+        util::appendLittleEndian( header, 0, 4 );
+    }
+
+    appendTag( header, "fmt " );
+    util::appendLittleEndian( header, 16, 4 );
+    util::appendLittleEndian( header, data.sample_type_ == WavSampleType::FLOAT32 ? 3 : 1, 2 );
+    util::appendLittleEndian( header, channels, 2 );
+    util::appendLittleEndian( header, data.sample_rate_, 4 );
+    util::appendLittleEndian( header, static_cast<uint64_t>( data.sample_rate_ ) * block_align, 4 );
+    util::appendLittleEndian( header, block_align, 2 );
+    util::appendLittleEndian( header, bits, 2 );
+
+    appendTag( header, "data" );
+    util::appendLittleEndian( header, is_rf64 ? 0xffffffff : data_size, 4 );
+
+    MsgNum err = sink.write( header.data(), header.size() );
+    if( err ) return err;
+
+    sink.reserve( static_cast<size_t>( data_size + padding ) );
+
+    // Interleave a block of frames at a time, each channel in its own
+    // loop of fixed stride as WavDecoder splits them.
+    std::vector<UByte> block( std::min( frames, kBLOCK_FRAMES ) * block_align );
+
+    for( size_t first = 0; first < frames; first += kBLOCK_FRAMES )
+    {
+        const size_t count = std::min( kBLOCK_FRAMES, frames - first );
+
+        for( size_t c = 0; c < channels; ++c )
+        {
+            UByte* dst = block.data() + c * bytes;
+
+            switch( data.sample_type_ )
+            {
+            case WavSampleType::INT16:
+            {
+                const int16_t* src = data.int16_channels_[c].data() + first;
+
+                for( size_t f = 0; f < count; ++f )
+                {
+                    UByte* d = dst + f * block_align;
+
+                    // 8-bit .wav audio is offset binary.
+                    if( bytes == 1 )
+                    {
+                        d[0] = static_cast<UByte>( src[f] + 128 );
+                        continue;
+                    }
+
+                    d[0] = static_cast<UByte>( src[f] );
+                    d[1] = static_cast<UByte>( src[f] >> 8 );
+                }
+                break;
+            }
+            case WavSampleType::INT32:
+            {
+                const int32_t* src = data.int32_channels_[c].data() + first;
+
+                for( size_t f = 0; f < count; ++f )
+                {
+                    const uint32_t value = static_cast<uint32_t>( src[f] );
+
+                    for( size_t b = 0; b < bytes; ++b )
+                    {
+                        dst[f * block_align + b] = static_cast<UByte>( value >> ( b * 8 ) );
+                    }
+                }
+                break;
+            }
+            case WavSampleType::FLOAT32:
+            {
+                const float* src = data.float_channels_[c].data() + first;
+
+                for( size_t f = 0; f < count; ++f )
+                {
+                    uint64_t value;
+
+                    if( bytes == 8 )
+                    {
+                        const double wide = src[f];
+                        std::memcpy( &value, &wide, 8 );
+                    }
+                    else
+                    {
+                        uint32_t narrow;
+                        std::memcpy( &narrow, src + f, 4 );
+                        value = narrow;
+                    }
+
+                    for( size_t b = 0; b < bytes; ++b )
+                    {
+                        dst[f * block_align + b] = static_cast<UByte>( value >> ( b * 8 ) );
+                    }
+                }
+                break;
+            }
+            }
+        }
+
+        err = sink.write( block.data(), count * block_align );
+        if( err ) return err;
+    }
+
+    if( padding )
+    {
+        const UByte zero = 0;
+        return sink.write( &zero, 1 );
+    }
+
+    return STATUS_OKAY;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Util.h"
+#include "Errors.h"
+#include "WavDecoder.h"
+#include "OutputSink.h"
+
+//========================================================================
+// Writes decoded audio back out as .wav files, the inverse of 
+// WavDecoder.
+class WavWriter
+{
+public:
+
+    //--------------------------------------------------------------
+    // Writes a plain PCM or IEEE float file at the bit depth of data,
+    // with just the fmt and data chunks. Audio too long for a 32-bit
+    // data size is written as RF64.
+    static MsgNum write( const WavData& data,
+                         OutputSink& sink );
+
+private:
+
+    //--------------------------------------------------------------
+    //
+    WavWriter() = delete;
+};